@@ -0,0 +1,169 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+#include "vulkan_base.h"
+
+//Frame time collection for the headless benchmark mode.
+//Per-frame samples and one-shot stage timings are kept in milliseconds and reported as JSON.
+struct Benchmark
+{
+	bool active = false;
+	uint32_t frameCount = 600;
+	uint32_t warmupFrames = 16;
+	uint32_t currentFrame = 0;
+	//Fixed simulation step so animation and model rotation advance identically on every run
+	float frameTimer = 1.0f / 60.0f;
+	std::string outputFile;
+
+	std::map<std::string, double> stages;
+	std::map<std::string, std::vector<double>> samples;
+	//Per-frame counts such as drawn and culled primitives
+	std::map<std::string, std::vector<double>> counters;
+
+	void addStage(const std::string& name, double ms)
+	{
+		stages[name] += ms;
+	}
+
+	void addSample(const std::string& name, double ms)
+	{
+		//Warm up frames are dominated by pipeline and driver caches, keep them out of the statistics
+		if (currentFrame < warmupFrames)
+		{
+			return;
+		}
+		samples[name].push_back(ms);
+	}
+
+	void addCounter(const std::string& name, double value)
+	{
+		if (currentFrame < warmupFrames)
+		{
+			return;
+		}
+		counters[name].push_back(value);
+	}
+
+	//Deterministic camera path: one full orbit around the model with a slow pitch sway
+	glm::vec3 cameraRotation(uint32_t frame) const
+	{
+		float t = static_cast<float>(frame) / static_cast<float>(std::max(frameCount, 1u));
+		return glm::vec3(15.0f * sin(t * 2.0f * float(M_PI)), 360.0f * t, 0.0f);
+	}
+
+	static double percentile(const std::vector<double>& sorted, double p)
+	{
+		if (sorted.empty())
+		{
+			return 0.0;
+		}
+		double rank = p * static_cast<double>(sorted.size() - 1);
+		size_t lower = static_cast<size_t>(rank);
+		size_t upper = std::min(lower + 1, sorted.size() - 1);
+		return sorted[lower] + (sorted[upper] - sorted[lower]) * (rank - static_cast<double>(lower));
+	}
+
+	//Driver and series names are free text, quote them so the report stays valid JSON
+	static std::string escape(const std::string& text)
+	{
+		std::stringstream escaped;
+		for (char c : text)
+		{
+			switch (c)
+			{
+			case '"': escaped << "\\\""; break;
+			case '\\': escaped << "\\\\"; break;
+			case '\n': escaped << "\\n"; break;
+			case '\r': escaped << "\\r"; break;
+			case '\t': escaped << "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					escaped << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c);
+				}
+				else
+				{
+					escaped << c;
+				}
+			}
+		}
+		return escaped.str();
+	}
+
+	static void writeSeries(std::stringstream& json, const std::map<std::string, std::vector<double>>& series)
+	{
+		json << "{";
+		for (auto it = series.begin(); it != series.end(); ++it)
+		{
+			std::vector<double> sorted(it->second);
+			std::sort(sorted.begin(), sorted.end());
+			double sum = 0.0;
+			for (double value : sorted)
+			{
+				sum += value;
+			}
+			json << (it == series.begin() ? "\n" : ",\n") << "    \"" << escape(it->first) << "\": { ";
+			json << "\"count\": " << sorted.size() << ", ";
+			json << "\"mean\": " << (sorted.empty() ? 0.0 : sum / static_cast<double>(sorted.size())) << ", ";
+			json << "\"min\": " << (sorted.empty() ? 0.0 : sorted.front()) << ", ";
+			json << "\"p50\": " << percentile(sorted, 0.50) << ", ";
+			json << "\"p95\": " << percentile(sorted, 0.95) << ", ";
+			json << "\"p99\": " << percentile(sorted, 0.99) << ", ";
+			json << "\"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << " }";
+		}
+		json << (series.empty() ? "}" : "\n  }");
+	}
+
+	std::string toJson(const std::string& deviceName, uint32_t width, uint32_t height, uint32_t sampleCount) const
+	{
+		std::stringstream json;
+		json << std::fixed << std::setprecision(4);
+		json << "{\n";
+		json << "  \"device\": \"" << escape(deviceName) << "\",\n";
+		json << "  \"width\": " << width << ",\n";
+		json << "  \"height\": " << height << ",\n";
+		json << "  \"samples\": " << sampleCount << ",\n";
+		json << "  \"frames\": " << frameCount << ",\n";
+		json << "  \"warmupFrames\": " << warmupFrames << ",\n";
+		json << "  \"stages\": {";
+		for (auto it = stages.begin(); it != stages.end(); ++it)
+		{
+			json << (it == stages.begin() ? "\n" : ",\n") << "    \"" << escape(it->first) << "\": " << it->second;
+		}
+		json << (stages.empty() ? "},\n" : "\n  },\n");
+		json << "  \"frameTimes\": ";
+		writeSeries(json, samples);
+		json << ",\n";
+		json << "  \"counters\": ";
+		writeSeries(json, counters);
+		json << "\n";
+		json << "}\n";
+		return json.str();
+	}
+
+	void report(const std::string& deviceName, uint32_t width, uint32_t height, uint32_t sampleCount) const
+	{
+		std::string json = toJson(deviceName, width, height, sampleCount);
+		std::cout << json;
+		if (!outputFile.empty())
+		{
+			std::ofstream file(outputFile);
+			if (!file.is_open())
+			{
+				std::cerr << "Could not write benchmark results to \"" << outputFile << "\"" << std::endl;
+				return;
+			}
+			file << json;
+		}
+	}
+};
@@ -6,6 +6,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <array>
 
 class Camera
 {
@@ -225,4 +226,49 @@ public:
 		}
 		return retVal;
 	}
+};
+
+//View frustum planes, extracted from a combined projection * view (* model) matrix with a zero to one depth range
+struct Frustum
+{
+	enum Side { LEFT = 0, RIGHT = 1, TOP = 2, BOTTOM = 3, BACK = 4, FRONT = 5 };
+	std::array<glm::vec4, 6> planes;
+
+	void update(const glm::mat4& matrix)
+	{
+		const glm::vec4 row0(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+		const glm::vec4 row1(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+		const glm::vec4 row2(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+		const glm::vec4 row3(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+
+		planes[LEFT] = row3 + row0;
+		planes[RIGHT] = row3 - row0;
+		planes[TOP] = row3 - row1;
+		planes[BOTTOM] = row3 + row1;
+		planes[BACK] = row3 - row2;
+		planes[FRONT] = row2;
+
+		for (auto& plane : planes)
+		{
+			float length = glm::length(glm::vec3(plane));
+			if (length > 0.0f)
+			{
+				plane /= length;
+			}
+		}
+	}
+
+	//Conservative box test, only rejects boxes lying completely behind one of the planes
+	bool checkBox(const glm::vec3& min, const glm::vec3& max) const
+	{
+		for (const auto& plane : planes)
+		{
+			glm::vec3 positive(plane.x >= 0.0f ? max.x : min.x, plane.y >= 0.0f ? max.y : min.y, plane.z >= 0.0f ? max.z : min.z);
+			if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
 };
\ No newline at end of file
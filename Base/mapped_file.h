@@ -0,0 +1,150 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vulkan
+{
+	//Read-only view of a whole file mapped into memory, pages are read in by the OS as they are touched
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile()
+		{
+			close();
+		}
+
+		bool open(const std::string& filename)
+		{
+			close();
+#if defined(_WIN32)
+			file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			{
+				close();
+				return false;
+			}
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!mapping)
+			{
+				close();
+				return false;
+			}
+			bytes = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			size = static_cast<size_t>(fileSize.QuadPart);
+#else
+			file = ::open(filename.c_str(), O_RDONLY);
+			if (file < 0)
+			{
+				return false;
+			}
+			struct stat fileStat;
+			if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0)
+			{
+				close();
+				return false;
+			}
+			void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+			bytes = view == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(view);
+			size = static_cast<size_t>(fileStat.st_size);
+#endif
+			if (!bytes)
+			{
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		void close()
+		{
+#if defined(_WIN32)
+			if (bytes)
+			{
+				UnmapViewOfFile(bytes);
+			}
+			if (mapping)
+			{
+				CloseHandle(mapping);
+			}
+			if (file != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file);
+			}
+			mapping = nullptr;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (bytes)
+			{
+				munmap(const_cast<uint8_t*>(bytes), size);
+			}
+			if (file >= 0)
+			{
+				::close(file);
+			}
+			file = -1;
+#endif
+			bytes = nullptr;
+			size = 0;
+		}
+
+		const uint8_t* data() const { return bytes; }
+		size_t length() const { return size; }
+		bool isOpen() const { return bytes != nullptr; }
+
+	private:
+		const uint8_t* bytes = nullptr;
+		size_t size = 0;
+#if defined(_WIN32)
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#else
+		int file = -1;
+#endif
+	};
+
+	//Largest resident set of the process so far in bytes, mapped pages count once they were touched
+	inline size_t peakResidentBytes()
+	{
+#if defined(_WIN32)
+		PROCESS_MEMORY_COUNTERS counters{};
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return 0;
+		}
+		return static_cast<size_t>(counters.PeakWorkingSetSize);
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+		{
+			return 0;
+		}
+#if defined(__APPLE__)
+		return static_cast<size_t>(usage.ru_maxrss);
+#else
+		//Linux reports kilobytes
+		return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+	}
+}
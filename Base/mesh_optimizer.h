@@ -0,0 +1,758 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+#include <unordered_map>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+//Load-time index and vertex reordering for triangle lists. All functions work on indices local to one primitive,
+//0 to vertexCount - 1, so primitives can be optimized in parallel.
+namespace vkglTF
+{
+	//Post-transform cache behaviour of an index sequence, simulated as a FIFO
+	struct VertexCacheStats
+	{
+		size_t triangles = 0;
+		//Distinct vertices referenced by the indices
+		size_t vertices = 0;
+		//Vertex shader invocations
+		size_t transforms = 0;
+
+		//Average cache miss ratio, transformed vertices per triangle (0.5 is ideal for large meshes, 3 the worst)
+		float acmr() const { return triangles > 0 ? static_cast<float>(transforms) / triangles : 0.0f; }
+		//Average transform to vertex ratio, 1 means every vertex is shaded exactly once
+		float atvr() const { return vertices > 0 ? static_cast<float>(transforms) / vertices : 0.0f; }
+
+		VertexCacheStats& operator+=(const VertexCacheStats& other)
+		{
+			triangles += other.triangles;
+			vertices += other.vertices;
+			transforms += other.transforms;
+			return *this;
+		}
+	};
+
+	//FIFO size of the simulation, close to what current hardware keeps per batch
+	constexpr uint32_t VERTEX_CACHE_FIFO_SIZE = 16;
+	//LRU size the triangle ordering optimizes for
+	constexpr uint32_t VERTEX_CACHE_LRU_SIZE = 32;
+
+	inline VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_FIFO_SIZE)
+	{
+		VertexCacheStats stats;
+		stats.triangles = indexCount / 3;
+		//A vertex is still cached while fewer than cacheSize others were transformed after it
+		std::vector<size_t> timestamps(vertexCount, 0);
+		size_t time = cacheSize + 1;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			const uint32_t index = indices[i];
+			if (timestamps[index] == 0)
+			{
+				stats.vertices++;
+			}
+			if (time - timestamps[index] > cacheSize)
+			{
+				timestamps[index] = time++;
+				stats.transforms++;
+			}
+		}
+		return stats;
+	}
+
+	//Forsyth's linear-speed vertex cache optimization: greedily emit the triangle whose vertices score highest,
+	//favouring vertices recently emitted and vertices with few triangles left
+	inline void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+	{
+		const size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0)
+		{
+			return;
+		}
+
+		auto vertexScore = [](int32_t cachePosition, uint32_t liveTriangles)
+		{
+			if (liveTriangles == 0)
+			{
+				return -1.0f;
+			}
+			float score = 0.0f;
+			if (cachePosition >= 0)
+			{
+				//The last triangle's vertices get a fixed score so the next one does not simply reuse its edge
+				if (cachePosition < 3)
+				{
+					score = 0.75f;
+				}
+				else
+				{
+					const float scaler = 1.0f / (VERTEX_CACHE_LRU_SIZE - 3);
+					score = std::pow(1.0f - (cachePosition - 3) * scaler, 1.5f);
+				}
+			}
+			//Finish off vertices with few triangles left so they leave the cache for good
+			return score + 2.0f / std::sqrt(static_cast<float>(liveTriangles));
+		};
+
+		//Triangles of every vertex, the live part of each list shrinks as triangles are emitted
+		std::vector<uint32_t> liveTriangles(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+		{
+			liveTriangles[indices[i]]++;
+		}
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+		}
+		std::vector<uint32_t> adjacency(triangleCount * 3);
+		{
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < triangleCount * 3; i++)
+			{
+				adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		std::vector<int32_t> cachePositions(vertexCount, -1);
+		std::vector<float> vertexScores(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			vertexScores[v] = vertexScore(-1, liveTriangles[v]);
+		}
+		std::vector<float> triangleScores(triangleCount);
+		size_t bestTriangle = 0;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+			if (triangleScores[t] > triangleScores[bestTriangle])
+			{
+				bestTriangle = t;
+			}
+		}
+
+		std::vector<uint8_t> emitted(triangleCount, 0);
+		std::vector<uint32_t> output;
+		output.reserve(triangleCount * 3);
+		uint32_t cache[VERTEX_CACHE_LRU_SIZE + 3];
+		uint32_t cacheCount = 0;
+		size_t cursor = 0;
+
+		while (output.size() < triangleCount * 3)
+		{
+			//Nothing adjacent to the cache is left, continue with the next triangle in input order
+			if (bestTriangle == SIZE_MAX)
+			{
+				while (emitted[cursor])
+				{
+					cursor++;
+				}
+				bestTriangle = cursor;
+			}
+
+			const uint32_t* triangle = &indices[bestTriangle * 3];
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				const uint32_t v = triangle[k];
+				output.push_back(v);
+				uint32_t* list = &adjacency[adjacencyOffsets[v]];
+				for (uint32_t a = 0; a < liveTriangles[v]; a++)
+				{
+					if (list[a] == bestTriangle)
+					{
+						std::swap(list[a], list[liveTriangles[v] - 1]);
+						liveTriangles[v]--;
+						break;
+					}
+				}
+			}
+			emitted[bestTriangle] = 1;
+
+			//The emitted vertices move to the front, everything pushed past the end falls out of the cache
+			uint32_t newCache[VERTEX_CACHE_LRU_SIZE + 3];
+			uint32_t newCount = 0;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				if (std::find(newCache, newCache + newCount, triangle[k]) == newCache + newCount)
+				{
+					newCache[newCount++] = triangle[k];
+				}
+			}
+			for (uint32_t i = 0; i < cacheCount; i++)
+			{
+				if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				{
+					newCache[newCount++] = cache[i];
+				}
+			}
+
+			for (uint32_t i = 0; i < newCount; i++)
+			{
+				const uint32_t v = newCache[i];
+				cachePositions[v] = i < VERTEX_CACHE_LRU_SIZE ? static_cast<int32_t>(i) : -1;
+				const float score = vertexScore(cachePositions[v], liveTriangles[v]);
+				const float delta = score - vertexScores[v];
+				vertexScores[v] = score;
+				for (uint32_t a = 0; a < liveTriangles[v]; a++)
+				{
+					triangleScores[adjacency[adjacencyOffsets[v] + a]] += delta;
+				}
+			}
+			cacheCount = std::min(newCount, VERTEX_CACHE_LRU_SIZE);
+			std::copy(newCache, newCache + cacheCount, cache);
+
+			bestTriangle = SIZE_MAX;
+			float bestScore = -1.0f;
+			for (uint32_t i = 0; i < cacheCount; i++)
+			{
+				const uint32_t v = cache[i];
+				for (uint32_t a = 0; a < liveTriangles[v]; a++)
+				{
+					const uint32_t t = adjacency[adjacencyOffsets[v] + a];
+					if (triangleScores[t] > bestScore)
+					{
+						bestScore = triangleScores[t];
+						bestTriangle = t;
+					}
+				}
+			}
+		}
+
+		std::copy(output.begin(), output.end(), indices);
+	}
+
+	//Overdraw ordering after Sander et al.: cut the cache-optimized sequence into clusters where the cache starts over,
+	//then draw clusters facing away from the mesh center first since they tend to occlude the rest.
+	//The new order is kept only if the cache miss ratio stays within threshold of the input order
+	inline void optimizeOverdraw(uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount, float threshold = 1.05f)
+	{
+		const size_t triangleCount = indexCount / 3;
+		if (triangleCount < 2)
+		{
+			return;
+		}
+
+		//A triangle missing the cache with all three vertices starts a new cluster
+		std::vector<size_t> clusterStarts;
+		{
+			std::vector<size_t> timestamps(vertexCount, 0);
+			size_t time = VERTEX_CACHE_FIFO_SIZE + 1;
+			for (size_t t = 0; t < triangleCount; t++)
+			{
+				uint32_t misses = 0;
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					const uint32_t index = indices[t * 3 + k];
+					if (time - timestamps[index] > VERTEX_CACHE_FIFO_SIZE)
+					{
+						timestamps[index] = time++;
+						misses++;
+					}
+				}
+				if (t == 0 || misses == 3)
+				{
+					clusterStarts.push_back(t);
+				}
+			}
+		}
+		if (clusterStarts.size() < 2)
+		{
+			return;
+		}
+
+		glm::vec3 meshCenter(0.0f);
+		float meshArea = 0.0f;
+		struct Cluster
+		{
+			size_t first;
+			size_t count;
+			glm::vec3 center;
+			glm::vec3 normal;
+			float sortKey;
+		};
+		std::vector<Cluster> clusters(clusterStarts.size());
+		for (size_t c = 0; c < clusters.size(); c++)
+		{
+			Cluster& cluster = clusters[c];
+			cluster.first = clusterStarts[c];
+			cluster.count = (c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : triangleCount) - cluster.first;
+			cluster.center = glm::vec3(0.0f);
+			cluster.normal = glm::vec3(0.0f);
+			float area = 0.0f;
+			for (size_t t = cluster.first; t < cluster.first + cluster.count; t++)
+			{
+				const glm::vec3& p0 = positions[indices[t * 3]];
+				const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+				const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+				//Length of the cross product is twice the area, both sums are weighted the same
+				const glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+				const float triangleArea = glm::length(n);
+				cluster.center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+				cluster.normal += n;
+				area += triangleArea;
+			}
+			meshCenter += cluster.center;
+			meshArea += area;
+			cluster.center = area > 0.0f ? cluster.center / area : positions[indices[cluster.first * 3]];
+			const float normalLength = glm::length(cluster.normal);
+			cluster.normal = normalLength > 0.0f ? cluster.normal / normalLength : glm::vec3(0.0f);
+		}
+		if (!(meshArea > 0.0f))
+		{
+			return;
+		}
+		meshCenter /= meshArea;
+		for (Cluster& cluster : clusters)
+		{
+			cluster.sortKey = glm::dot(cluster.center - meshCenter, cluster.normal);
+		}
+		std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+		std::vector<uint32_t> reordered;
+		reordered.reserve(triangleCount * 3);
+		for (const Cluster& cluster : clusters)
+		{
+			reordered.insert(reordered.end(), indices + cluster.first * 3, indices + (cluster.first + cluster.count) * 3);
+		}
+		const float acmrBefore = analyzeVertexCache(indices, triangleCount * 3, vertexCount).acmr();
+		const float acmrAfter = analyzeVertexCache(reordered.data(), reordered.size(), vertexCount).acmr();
+		if (acmrAfter <= acmrBefore * threshold)
+		{
+			std::copy(reordered.begin(), reordered.end(), indices);
+		}
+	}
+
+	//Renumber vertices in the order the indices first reference them so vertex fetches walk memory linearly.
+	//Vertices no index references keep their relative order behind the referenced ones
+	template<typename Vertex>
+	inline void optimizeVertexFetch(uint32_t* indices, size_t indexCount, Vertex* vertices, size_t vertexCount)
+	{
+		std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+		std::vector<Vertex> reordered;
+		reordered.reserve(vertexCount);
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			uint32_t& target = remap[indices[i]];
+			if (target == UINT32_MAX)
+			{
+				target = static_cast<uint32_t>(reordered.size());
+				reordered.push_back(vertices[indices[i]]);
+			}
+			indices[i] = target;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			if (remap[v] == UINT32_MAX)
+			{
+				reordered.push_back(vertices[v]);
+			}
+		}
+		std::copy(reordered.begin(), reordered.end(), vertices);
+	}
+
+	//Sum of squared distances to a set of planes, stored as the upper triangle of a symmetric 4x4 matrix
+	struct Quadric
+	{
+		double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+		double b0 = 0, b1 = 0, b2 = 0;
+		double c = 0;
+
+		void addPlane(const glm::vec3& n, float d)
+		{
+			a00 += n.x * n.x; a01 += n.x * n.y; a02 += n.x * n.z;
+			a11 += n.y * n.y; a12 += n.y * n.z; a22 += n.z * n.z;
+			b0 += n.x * d; b1 += n.y * d; b2 += n.z * d;
+			c += static_cast<double>(d) * d;
+		}
+
+		Quadric& operator+=(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2;
+			c += q.c;
+			return *this;
+		}
+
+		double error(const glm::vec3& p) const
+		{
+			const double x = p.x, y = p.y, z = p.z;
+			const double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + a11 * y * y + 2 * a12 * y * z + a22 * z * z + 2 * (b0 * x + b1 * y + b2 * z) + c;
+			return std::max(e, 0.0);
+		}
+	};
+
+	//Quadric error simplification by half edge collapse: a vertex is merged into a neighbour, so no vertex is moved or
+	//created and every level indexes the same vertex buffer. Vertices on an open border or an attribute seam (another
+	//vertex at the same position) are never removed, which keeps UV and normal seams intact.
+	//Stops at targetIndexCount or once a collapse would exceed targetError, both relative to the mesh extent.
+	//Returns the index count written to destination, resultError receives the largest error of the collapses made
+	inline size_t simplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount, size_t targetIndexCount, float targetError, float* resultError = nullptr)
+	{
+		indexCount -= indexCount % 3;
+		std::vector<uint32_t> result(indices, indices + indexCount);
+		if (resultError)
+		{
+			*resultError = 0.0f;
+		}
+
+		//Errors are measured on positions scaled to a unit extent
+		glm::vec3 minPos(FLT_MAX);
+		glm::vec3 maxPos(-FLT_MAX);
+		for (uint32_t index : result)
+		{
+			minPos = glm::min(minPos, positions[index]);
+			maxPos = glm::max(maxPos, positions[index]);
+		}
+		const glm::vec3 size = maxPos - minPos;
+		const float extent = std::max(size.x, std::max(size.y, size.z));
+		if (indexCount == 0 || !(extent > 0.0f))
+		{
+			std::copy(result.begin(), result.end(), destination);
+			return result.size();
+		}
+		std::vector<glm::vec3> scaled(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			scaled[v] = (positions[v] - minPos) / extent;
+		}
+
+		//Vertices sharing a position with another vertex sit on a seam
+		std::vector<uint32_t> positionIds(vertexCount);
+		std::vector<uint32_t> positionUses;
+		{
+			struct PositionHash
+			{
+				size_t operator()(const glm::vec3& p) const
+				{
+					uint32_t bits[3];
+					memcpy(bits, &p, sizeof(bits));
+					return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+				}
+			};
+			std::unordered_map<glm::vec3, uint32_t, PositionHash> ids;
+			ids.reserve(vertexCount);
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				auto it = ids.emplace(positions[v], static_cast<uint32_t>(positionUses.size())).first;
+				if (it->second == positionUses.size())
+				{
+					positionUses.push_back(0);
+				}
+				positionIds[v] = it->second;
+				positionUses[it->second]++;
+			}
+		}
+		std::vector<uint8_t> locked(vertexCount, 1);
+		for (uint32_t index : result)
+		{
+			locked[index] = positionUses[positionIds[index]] > 1 ? 1 : 0;
+		}
+		//An edge without its opposite half edge (in position space) is on a border, non-manifold edges are treated the same
+		{
+			std::unordered_map<uint64_t, uint32_t> edges;
+			edges.reserve(indexCount);
+			auto edgeKey = [&](uint32_t a, uint32_t b) { return (static_cast<uint64_t>(positionIds[a]) << 32) | positionIds[b]; };
+			for (size_t i = 0; i < indexCount; i += 3)
+			{
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					edges[edgeKey(result[i + k], result[i + (k + 1) % 3])]++;
+				}
+			}
+			for (size_t i = 0; i < indexCount; i += 3)
+			{
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					const uint32_t a = result[i + k];
+					const uint32_t b = result[i + (k + 1) % 3];
+					auto opposite = edges.find(edgeKey(b, a));
+					if (opposite == edges.end() || opposite->second != 1 || edges[edgeKey(a, b)] != 1)
+					{
+						locked[a] = 1;
+						locked[b] = 1;
+					}
+				}
+			}
+		}
+
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t i = 0; i < indexCount; i += 3)
+		{
+			const glm::vec3& p0 = scaled[result[i]];
+			const glm::vec3 n = glm::cross(scaled[result[i + 1]] - p0, scaled[result[i + 2]] - p0);
+			const float length = glm::length(n);
+			if (!(length > 0.0f))
+			{
+				continue;
+			}
+			Quadric plane;
+			plane.addPlane(n / length, -glm::dot(n / length, p0));
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				quadrics[result[i + k]] += plane;
+			}
+		}
+
+		struct Collapse
+		{
+			double cost;
+			uint32_t from;
+			uint32_t to;
+		};
+		std::vector<Collapse> collapses;
+		std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+		std::vector<uint32_t> adjacency;
+		std::vector<uint8_t> touched(vertexCount);
+		std::vector<uint32_t> remap(vertexCount);
+		const double maxCost = static_cast<double>(targetError) * targetError;
+		double resultCost = 0.0;
+
+		while (result.size() > targetIndexCount)
+		{
+			//Triangles of every vertex
+			std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+			for (uint32_t index : result)
+			{
+				adjacencyOffsets[index + 1]++;
+			}
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+			}
+			adjacency.resize(result.size());
+			{
+				std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+				for (size_t i = 0; i < result.size(); i++)
+				{
+					adjacency[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+				}
+			}
+
+			collapses.clear();
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					const uint32_t a = result[i + k];
+					const uint32_t b = result[i + (k + 1) % 3];
+					if (!locked[a])
+					{
+						collapses.push_back({ quadrics[a].error(scaled[b]), a, b });
+					}
+					if (!locked[b])
+					{
+						collapses.push_back({ quadrics[b].error(scaled[a]), b, a });
+					}
+				}
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+			//An interior collapse removes two triangles, leave some room so the pass does not overshoot the target
+			const size_t collapseLimit = std::max<size_t>(1, (result.size() - targetIndexCount) / 6);
+			size_t collapseCount = 0;
+			std::fill(touched.begin(), touched.end(), 0);
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				remap[v] = static_cast<uint32_t>(v);
+			}
+			for (const Collapse& collapse : collapses)
+			{
+				if (collapse.cost > maxCost || collapseCount >= collapseLimit)
+				{
+					break;
+				}
+				if (touched[collapse.from] || touched[collapse.to])
+				{
+					continue;
+				}
+				//Reject collapses that flip a remaining triangle
+				bool flips = false;
+				for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; a++)
+				{
+					const uint32_t* triangle = &result[adjacency[a] * 3];
+					if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+					{
+						continue;
+					}
+					glm::vec3 before[3];
+					glm::vec3 after[3];
+					for (uint32_t k = 0; k < 3; k++)
+					{
+						before[k] = scaled[triangle[k]];
+						after[k] = triangle[k] == collapse.from ? scaled[collapse.to] : before[k];
+					}
+					const glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+					const glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+					flips = glm::dot(n0, n1) <= 0.0f;
+				}
+				if (flips)
+				{
+					continue;
+				}
+
+				remap[collapse.from] = collapse.to;
+				quadrics[collapse.to] += quadrics[collapse.from];
+				for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++)
+				{
+					const uint32_t* triangle = &result[adjacency[a] * 3];
+					touched[triangle[0]] = 1;
+					touched[triangle[1]] = 1;
+					touched[triangle[2]] = 1;
+				}
+				resultCost = std::max(resultCost, collapse.cost);
+				collapseCount++;
+			}
+			if (collapseCount == 0)
+			{
+				break;
+			}
+
+			size_t write = 0;
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				const uint32_t a = remap[result[i]];
+				const uint32_t b = remap[result[i + 1]];
+				const uint32_t c = remap[result[i + 2]];
+				if (a != b && b != c && c != a)
+				{
+					result[write++] = a;
+					result[write++] = b;
+					result[write++] = c;
+				}
+			}
+			result.resize(write);
+		}
+
+		if (resultError)
+		{
+			*resultError = static_cast<float>(std::sqrt(resultCost));
+		}
+		std::copy(result.begin(), result.end(), destination);
+		return result.size();
+	}
+
+	//Meshlet limits, small enough that the vertices of a meshlet stay in the post-transform cache
+	constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+	constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+	//A contiguous range of a primitive's indices with the bounds needed to cull it on its own
+	struct Meshlet
+	{
+		//Relative to the primitive's first index
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		//Bounding sphere, center and radius
+		glm::vec4 sphere;
+		//Average normal and the sine of the spread of its triangles' normals around it, 1 when they face too many ways to cull
+		glm::vec4 cone;
+	};
+
+	//Cut the index sequence into meshlets wherever the next triangle would exceed the vertex or triangle limit.
+	//Triangles are not reordered, run after the cache and overdraw optimizations so their order (and the locality of
+	//the cache-optimized sequence) is kept
+	inline std::vector<Meshlet> buildMeshlets(const uint32_t* indices, size_t indexCount, const glm::vec3* positions, size_t vertexCount)
+	{
+		std::vector<Meshlet> meshlets;
+		std::vector<uint32_t> meshletVertices;
+		std::vector<uint32_t> usedBy(vertexCount, UINT32_MAX);
+		const size_t triangleCount = indexCount / 3;
+
+		auto finish = [&](size_t firstTriangle, size_t lastTriangle)
+		{
+			Meshlet meshlet{};
+			meshlet.firstIndex = static_cast<uint32_t>(firstTriangle * 3);
+			meshlet.indexCount = static_cast<uint32_t>((lastTriangle - firstTriangle) * 3);
+
+			glm::vec3 minPos(FLT_MAX);
+			glm::vec3 maxPos(-FLT_MAX);
+			for (uint32_t v : meshletVertices)
+			{
+				minPos = glm::min(minPos, positions[v]);
+				maxPos = glm::max(maxPos, positions[v]);
+			}
+			const glm::vec3 center = 0.5f * (minPos + maxPos);
+			float radius = 0.0f;
+			for (uint32_t v : meshletVertices)
+			{
+				radius = std::max(radius, glm::length(positions[v] - center));
+			}
+			meshlet.sphere = glm::vec4(center, radius);
+
+			glm::vec3 axis(0.0f);
+			for (size_t t = firstTriangle; t < lastTriangle; t++)
+			{
+				const glm::vec3& p0 = positions[indices[t * 3]];
+				const glm::vec3 n = glm::cross(positions[indices[t * 3 + 1]] - p0, positions[indices[t * 3 + 2]] - p0);
+				const float length = glm::length(n);
+				if (length > 0.0f)
+				{
+					axis += n / length;
+				}
+			}
+			meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+			const float axisLength = glm::length(axis);
+			if (axisLength > 0.0f)
+			{
+				axis /= axisLength;
+				float minDot = 1.0f;
+				for (size_t t = firstTriangle; t < lastTriangle; t++)
+				{
+					const glm::vec3& p0 = positions[indices[t * 3]];
+					const glm::vec3 n = glm::cross(positions[indices[t * 3 + 1]] - p0, positions[indices[t * 3 + 2]] - p0);
+					const float length = glm::length(n);
+					if (length > 0.0f)
+					{
+						minDot = std::min(minDot, glm::dot(axis, n / length));
+					}
+				}
+				//Normals more than 90 degrees apart leave no direction from which every triangle is back facing
+				if (minDot > 0.0f)
+				{
+					meshlet.cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+				}
+			}
+			meshlets.push_back(meshlet);
+		};
+
+		size_t firstTriangle = 0;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			uint32_t newVertices = 0;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				const uint32_t v = indices[t * 3 + k];
+				if (usedBy[v] != meshlets.size() && std::find(indices + t * 3, indices + t * 3 + k, v) == indices + t * 3 + k)
+				{
+					newVertices++;
+				}
+			}
+			if (meshletVertices.size() + newVertices > MESHLET_MAX_VERTICES || t - firstTriangle >= MESHLET_MAX_TRIANGLES)
+			{
+				finish(firstTriangle, t);
+				firstTriangle = t;
+				meshletVertices.clear();
+			}
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				const uint32_t v = indices[t * 3 + k];
+				if (usedBy[v] != meshlets.size())
+				{
+					usedBy[v] = static_cast<uint32_t>(meshlets.size());
+					meshletVertices.push_back(v);
+				}
+			}
+		}
+		if (triangleCount > firstTriangle)
+		{
+			finish(firstTriangle, triangleCount);
+		}
+		return meshlets;
+	}
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <filesystem>
+#include <type_traits>
+
+//Cooked form of a loaded glTF scene: the packed vertex and index pools, mip chains and the scene graph in the
+//layout they are uploaded or rebuilt from, so a warm load is a file mapping plus staging copies.
+//All values are written in the byte order of the machine that cooked them, a cache is not meant to be shared.
+namespace vkglTF
+{
+	//"VKSC"
+	constexpr uint32_t SCENE_CACHE_MAGIC = 0x43534B56;
+	//Bump whenever anything written to the cache changes
+	constexpr uint32_t SCENE_CACHE_VERSION = 2;
+	//Payloads start at this alignment so they can be copied or read straight out of the mapping
+	constexpr size_t SCENE_CACHE_ALIGNMENT = 16;
+
+	//FNV-1a, chain calls by passing the previous result
+	inline uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	//Size and modification time of a file the scene was cooked from
+	struct SceneCacheDependency
+	{
+		std::string path;
+		uint64_t size = 0;
+		int64_t modified = 0;
+
+		static bool stamp(const std::string& path, SceneCacheDependency& dependency)
+		{
+			std::error_code error;
+			const auto size = std::filesystem::file_size(path, error);
+			if (error)
+			{
+				return false;
+			}
+			const auto modified = std::filesystem::last_write_time(path, error);
+			if (error)
+			{
+				return false;
+			}
+			dependency.path = path;
+			dependency.size = static_cast<uint64_t>(size);
+			dependency.modified = static_cast<int64_t>(modified.time_since_epoch().count());
+			return true;
+		}
+
+		bool current() const
+		{
+			SceneCacheDependency now;
+			return stamp(path, now) && now.size == size && now.modified == modified;
+		}
+	};
+
+	class SceneCacheWriter
+	{
+	public:
+		std::vector<uint8_t> data;
+
+		template<typename T>
+		void write(const T& value)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be written");
+			writeBytes(&value, sizeof(T));
+		}
+
+		void writeBytes(const void* bytes, size_t size)
+		{
+			const uint8_t* source = static_cast<const uint8_t*>(bytes);
+			data.insert(data.end(), source, source + size);
+		}
+
+		void writeString(const std::string& value)
+		{
+			write(static_cast<uint64_t>(value.size()));
+			writeBytes(value.data(), value.size());
+		}
+
+		//Count followed by the aligned elements
+		template<typename T>
+		void writeArray(const T* values, size_t count)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be written");
+			write(static_cast<uint64_t>(count));
+			align();
+			writeBytes(values, count * sizeof(T));
+		}
+
+		template<typename T>
+		void writeVector(const std::vector<T>& values)
+		{
+			writeArray(values.data(), values.size());
+		}
+
+		void align()
+		{
+			data.resize((data.size() + SCENE_CACHE_ALIGNMENT - 1) & ~(SCENE_CACHE_ALIGNMENT - 1), 0);
+		}
+
+		//Written next to the target and renamed, a reader never sees a partial cache
+		bool save(const std::string& filename) const
+		{
+			const std::string temporary = filename + ".tmp";
+			{
+				std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+				if (!file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size())))
+				{
+					return false;
+				}
+			}
+			std::error_code error;
+			std::filesystem::rename(temporary, filename, error);
+			return !error;
+		}
+	};
+
+	//Reads what SceneCacheWriter wrote. Running past the end sets a flag and returns zeroes instead of reading on
+	class SceneCacheReader
+	{
+	public:
+		SceneCacheReader(const uint8_t* data, size_t size) : begin(data), cursor(data), end(data + size) {}
+
+		template<typename T>
+		T read()
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "Only plain values can be read");
+			T value{};
+			const uint8_t* bytes = readBytes(sizeof(T));
+			if (bytes)
+			{
+				memcpy(&value, bytes, sizeof(T));
+			}
+			return value;
+		}
+
+		const uint8_t* readBytes(size_t size)
+		{
+			if (failed || static_cast<size_t>(end - cursor) < size)
+			{
+				failed = true;
+				return nullptr;
+			}
+			const uint8_t* bytes = cursor;
+			cursor += size;
+			return bytes;
+		}
+
+		//Element count of a section, each element takes at least minSize bytes so a damaged count fails here
+		size_t readCount(size_t minSize)
+		{
+			const uint64_t count = read<uint64_t>();
+			if (count > static_cast<uint64_t>(end - cursor) / minSize)
+			{
+				failed = true;
+				return 0;
+			}
+			return static_cast<size_t>(count);
+		}
+
+		std::string readString()
+		{
+			const uint64_t size = read<uint64_t>();
+			const uint8_t* bytes = readBytes(static_cast<size_t>(size));
+			return bytes ? std::string(reinterpret_cast<const char*>(bytes), static_cast<size_t>(size)) : std::string();
+		}
+
+		//Points into the mapped data, valid as long as the mapping is
+		template<typename T>
+		const T* readArray(size_t& count)
+		{
+			count = static_cast<size_t>(read<uint64_t>());
+			align();
+			if (count > static_cast<size_t>(end - cursor) / sizeof(T))
+			{
+				failed = true;
+				count = 0;
+				return nullptr;
+			}
+			return reinterpret_cast<const T*>(readBytes(count * sizeof(T)));
+		}
+
+		template<typename T>
+		std::vector<T> readVector()
+		{
+			size_t count;
+			const T* values = readArray<T>(count);
+			return values ? std::vector<T>(values, values + count) : std::vector<T>();
+		}
+
+		void align()
+		{
+			const size_t offset = static_cast<size_t>(cursor - begin);
+			const size_t aligned = (offset + SCENE_CACHE_ALIGNMENT - 1) & ~(SCENE_CACHE_ALIGNMENT - 1);
+			if (aligned > static_cast<size_t>(end - begin))
+			{
+				failed = true;
+				return;
+			}
+			cursor = begin + aligned;
+		}
+
+		bool ok() const { return !failed; }
+
+	private:
+		const uint8_t* begin;
+		const uint8_t* cursor;
+		const uint8_t* end;
+		bool failed = false;
+	};
+}
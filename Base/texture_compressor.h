@@ -0,0 +1,448 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+//Block compression of RGBA8 images into the BC formats textures are cooked to. Every 4x4 block is encoded on its own,
+//blocks at the right and bottom edge repeat the last column and row. Endpoints come from the principal axis of the
+//block and every texel takes the closest palette entry, fast enough for load time with predictable quality.
+namespace vkglTF
+{
+	enum class TextureEncoding : uint32_t
+	{
+		RGBA8,
+		//Opaque RGB, 8 bytes per block
+		BC1,
+		//One channel, 8 bytes per block
+		BC4,
+		//Two channels, 16 bytes per block
+		BC5,
+		//RGBA, 16 bytes per block, mode 6 only
+		BC7
+	};
+
+	//Bytes per block, a block of RGBA8 is a single texel
+	inline size_t encodedBlockSize(TextureEncoding encoding)
+	{
+		switch (encoding)
+		{
+		case TextureEncoding::BC1:
+		case TextureEncoding::BC4:
+			return 8;
+		case TextureEncoding::BC5:
+		case TextureEncoding::BC7:
+			return 16;
+		default:
+			return 4;
+		}
+	}
+
+	inline uint32_t encodedBlockExtent(TextureEncoding encoding)
+	{
+		return encoding == TextureEncoding::RGBA8 ? 1 : 4;
+	}
+
+	//Bytes of one encoded level
+	inline size_t encodedSize(TextureEncoding encoding, uint32_t width, uint32_t height)
+	{
+		const uint32_t extent = encodedBlockExtent(encoding);
+		return size_t((width + extent - 1) / extent) * ((height + extent - 1) / extent) * encodedBlockSize(encoding);
+	}
+
+	//Texels of the block at x, y as floats, clamped to the image
+	inline void loadBlock(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t x, uint32_t y, float block[16][4])
+	{
+		for (uint32_t by = 0; by < 4; by++)
+		{
+			const uint8_t* row = rgba + size_t(std::min(y + by, height - 1)) * width * 4;
+			for (uint32_t bx = 0; bx < 4; bx++)
+			{
+				const uint8_t* texel = row + size_t(std::min(x + bx, width - 1)) * 4;
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					block[by * 4 + bx][c] = texel[c];
+				}
+			}
+		}
+	}
+
+	//Ends of the block's first C channels along their principal axis, pulled in by a 32th of the range on both sides
+	//as the extremes are rarely hit exactly once the endpoints are quantized
+	template<uint32_t C>
+	inline void principalEndpoints(const float block[16][4], float lo[4], float hi[4])
+	{
+		float mean[C] = {};
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			for (uint32_t c = 0; c < C; c++)
+			{
+				mean[c] += block[i][c] / 16.0f;
+			}
+		}
+		float covariance[C][C] = {};
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			float d[C];
+			for (uint32_t c = 0; c < C; c++)
+			{
+				d[c] = block[i][c] - mean[c];
+			}
+			for (uint32_t a = 0; a < C; a++)
+			{
+				for (uint32_t b = 0; b < C; b++)
+				{
+					covariance[a][b] += d[a] * d[b];
+				}
+			}
+		}
+		//Power iteration, started on the diagonal of the covariance so flat channels do not pull the axis
+		float axis[C];
+		for (uint32_t c = 0; c < C; c++)
+		{
+			axis[c] = covariance[c][c];
+		}
+		for (uint32_t iteration = 0; iteration < 8; iteration++)
+		{
+			float next[C] = {};
+			float length = 0.0f;
+			for (uint32_t a = 0; a < C; a++)
+			{
+				for (uint32_t b = 0; b < C; b++)
+				{
+					next[a] += covariance[a][b] * axis[b];
+				}
+				length = std::max(length, std::abs(next[a]));
+			}
+			if (length < 1e-6f)
+			{
+				break;
+			}
+			for (uint32_t c = 0; c < C; c++)
+			{
+				axis[c] = next[c] / length;
+			}
+		}
+		float axisLength = 0.0f;
+		for (uint32_t c = 0; c < C; c++)
+		{
+			axisLength += axis[c] * axis[c];
+		}
+		float tMin = 0.0f;
+		float tMax = 0.0f;
+		if (axisLength > 1e-12f)
+		{
+			axisLength = std::sqrt(axisLength);
+			for (uint32_t c = 0; c < C; c++)
+			{
+				axis[c] /= axisLength;
+			}
+			tMin = FLT_MAX;
+			tMax = -FLT_MAX;
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				float t = 0.0f;
+				for (uint32_t c = 0; c < C; c++)
+				{
+					t += (block[i][c] - mean[c]) * axis[c];
+				}
+				tMin = std::min(tMin, t);
+				tMax = std::max(tMax, t);
+			}
+			const float inset = (tMax - tMin) / 32.0f;
+			tMin += inset;
+			tMax -= inset;
+		}
+		for (uint32_t c = 0; c < C; c++)
+		{
+			lo[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * tMin));
+			hi[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * tMax));
+		}
+	}
+
+	inline uint16_t packRgb565(const float color[4])
+	{
+		const uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+		const uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+		const uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	inline void unpackRgb565(uint16_t packed, float color[3])
+	{
+		const uint32_t r = (packed >> 11) & 31;
+		const uint32_t g = (packed >> 5) & 63;
+		const uint32_t b = packed & 31;
+		color[0] = static_cast<float>((r << 3) | (r >> 2));
+		color[1] = static_cast<float>((g << 2) | (g >> 4));
+		color[2] = static_cast<float>((b << 3) | (b >> 2));
+	}
+
+	//Always the four color mode, alpha is dropped
+	inline void encodeBC1Block(const float block[16][4], uint8_t* out)
+	{
+		float lo[4];
+		float hi[4];
+		principalEndpoints<3>(block, lo, hi);
+		uint16_t color0 = packRgb565(hi);
+		uint16_t color1 = packRgb565(lo);
+		if (color0 < color1)
+		{
+			std::swap(color0, color1);
+		}
+		uint32_t indices = 0;
+		//Equal endpoints select the three color mode, where index 0 still is color0
+		if (color0 != color1)
+		{
+			float palette[4][3];
+			unpackRgb565(color0, palette[0]);
+			unpackRgb565(color1, palette[1]);
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+				palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+			}
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				uint32_t best = 0;
+				float bestError = FLT_MAX;
+				for (uint32_t p = 0; p < 4; p++)
+				{
+					float error = 0.0f;
+					for (uint32_t c = 0; c < 3; c++)
+					{
+						const float d = block[i][c] - palette[p][c];
+						error += d * d;
+					}
+					if (error < bestError)
+					{
+						bestError = error;
+						best = p;
+					}
+				}
+				indices |= best << (2 * i);
+			}
+		}
+		memcpy(out, &color0, 2);
+		memcpy(out + 2, &color1, 2);
+		memcpy(out + 4, &indices, 4);
+	}
+
+	//Channel of the block in the eight value mode
+	inline void encodeBC4Block(const float block[16][4], uint32_t channel, uint8_t* out)
+	{
+		float lo = 255.0f;
+		float hi = 0.0f;
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			lo = std::min(lo, block[i][channel]);
+			hi = std::max(hi, block[i][channel]);
+		}
+		const uint8_t red0 = static_cast<uint8_t>(hi + 0.5f);
+		const uint8_t red1 = static_cast<uint8_t>(lo + 0.5f);
+		uint64_t indices = 0;
+		//Equal endpoints select the six value mode, where index 0 still is red0
+		if (red0 > red1)
+		{
+			float palette[8];
+			palette[0] = red0;
+			palette[1] = red1;
+			for (uint32_t k = 1; k < 7; k++)
+			{
+				palette[k + 1] = ((7 - k) * red0 + k * red1) / 7.0f;
+			}
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				uint64_t best = 0;
+				float bestError = FLT_MAX;
+				for (uint32_t p = 0; p < 8; p++)
+				{
+					const float error = std::abs(block[i][channel] - palette[p]);
+					if (error < bestError)
+					{
+						bestError = error;
+						best = p;
+					}
+				}
+				indices |= best << (3 * i);
+			}
+		}
+		out[0] = red0;
+		out[1] = red1;
+		for (uint32_t b = 0; b < 6; b++)
+		{
+			out[2 + b] = static_cast<uint8_t>(indices >> (8 * b));
+		}
+	}
+
+	inline void encodeBC5Block(const float block[16][4], uint8_t* out)
+	{
+		encodeBC4Block(block, 0, out);
+		encodeBC4Block(block, 1, out + 8);
+	}
+
+	//Mode 6: one subset, RGBA endpoints of 7 bits plus a p-bit each and 4 bit indices
+	inline void encodeBC7Block(const float block[16][4], uint8_t* out)
+	{
+		float lo[4];
+		float hi[4];
+		principalEndpoints<4>(block, lo, hi);
+		//The p-bit is the shared lowest bit of all channels of an endpoint, pick the one that lands closer
+		auto quantize = [](const float endpoint[4], uint32_t quantized[4], uint32_t& pBit)
+		{
+			float bestError = FLT_MAX;
+			for (uint32_t p = 0; p < 2; p++)
+			{
+				uint32_t candidate[4];
+				float error = 0.0f;
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					candidate[c] = static_cast<uint32_t>(std::min(127.0f, std::max(0.0f, std::floor((endpoint[c] - p) / 2.0f + 0.5f))));
+					const float d = static_cast<float>(candidate[c] * 2 + p) - endpoint[c];
+					error += d * d;
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					pBit = p;
+					memcpy(quantized, candidate, sizeof(candidate));
+				}
+			}
+		};
+		uint32_t endpoints[2][4] = {};
+		uint32_t pBits[2] = {};
+		quantize(lo, endpoints[0], pBits[0]);
+		quantize(hi, endpoints[1], pBits[1]);
+
+		static const uint32_t weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		float palette[16][4];
+		for (uint32_t k = 0; k < 16; k++)
+		{
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				const uint32_t e0 = endpoints[0][c] * 2 + pBits[0];
+				const uint32_t e1 = endpoints[1][c] * 2 + pBits[1];
+				palette[k][c] = static_cast<float>(((64 - weights[k]) * e0 + weights[k] * e1 + 32) >> 6);
+			}
+		}
+		uint32_t indices[16] = {};
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			float bestError = FLT_MAX;
+			for (uint32_t k = 0; k < 16; k++)
+			{
+				float error = 0.0f;
+				for (uint32_t c = 0; c < 4; c++)
+				{
+					const float d = block[i][c] - palette[k][c];
+					error += d * d;
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					indices[i] = k;
+				}
+			}
+		}
+		//The first index is stored without its top bit, swapping the endpoints makes it 0
+		if (indices[0] & 8)
+		{
+			std::swap(endpoints[0], endpoints[1]);
+			std::swap(pBits[0], pBits[1]);
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				indices[i] = 15 - indices[i];
+			}
+		}
+
+		uint64_t bits[2] = {};
+		uint32_t position = 0;
+		auto put = [&bits, &position](uint64_t value, uint32_t count)
+		{
+			for (uint32_t b = 0; b < count; b++, position++)
+			{
+				bits[position / 64] |= ((value >> b) & 1) << (position % 64);
+			}
+		};
+		put(1 << 6, 7);
+		for (uint32_t c = 0; c < 4; c++)
+		{
+			put(endpoints[0][c], 7);
+			put(endpoints[1][c], 7);
+		}
+		put(pBits[0], 1);
+		put(pBits[1], 1);
+		put(indices[0], 3);
+		for (uint32_t i = 1; i < 16; i++)
+		{
+			put(indices[i], 4);
+		}
+		memcpy(out, bits, 16);
+	}
+
+	//One level, blocks row by row as vkCmdCopyBufferToImage expects them
+	inline void encodeImage(const uint8_t* rgba, uint32_t width, uint32_t height, TextureEncoding encoding, uint8_t* out)
+	{
+		if (encoding == TextureEncoding::RGBA8)
+		{
+			memcpy(out, rgba, size_t(width) * height * 4);
+			return;
+		}
+		const size_t blockSize = encodedBlockSize(encoding);
+		float block[16][4];
+		for (uint32_t y = 0; y < height; y += 4)
+		{
+			for (uint32_t x = 0; x < width; x += 4)
+			{
+				loadBlock(rgba, width, height, x, y, block);
+				switch (encoding)
+				{
+				case TextureEncoding::BC1:
+					encodeBC1Block(block, out);
+					break;
+				case TextureEncoding::BC4:
+					encodeBC4Block(block, 0, out);
+					break;
+				case TextureEncoding::BC5:
+					encodeBC5Block(block, out);
+					break;
+				default:
+					encodeBC7Block(block, out);
+					break;
+				}
+				out += blockSize;
+			}
+		}
+	}
+
+	//Bytes of a tightly packed mip chain
+	inline size_t encodedChainSize(TextureEncoding encoding, uint32_t width, uint32_t height, uint32_t mipLevels)
+	{
+		size_t size = 0;
+		for (uint32_t i = 0; i < mipLevels; i++)
+		{
+			size += encodedSize(encoding, std::max(1u, width >> i), std::max(1u, height >> i));
+		}
+		return size;
+	}
+
+	//Every level of a tightly packed RGBA mip chain, the result is packed the same way
+	inline std::vector<uint8_t> encodeMipChain(const uint8_t* mips, uint32_t width, uint32_t height, uint32_t mipLevels, TextureEncoding encoding)
+	{
+		std::vector<uint8_t> encoded(encodedChainSize(encoding, width, height, mipLevels));
+		size_t srcOffset = 0;
+		size_t dstOffset = 0;
+		for (uint32_t i = 0; i < mipLevels; i++)
+		{
+			const uint32_t levelWidth = std::max(1u, width >> i);
+			const uint32_t levelHeight = std::max(1u, height >> i);
+			encodeImage(mips + srcOffset, levelWidth, levelHeight, encoding, encoded.data() + dstOffset);
+			srcOffset += size_t(levelWidth) * levelHeight * 4;
+			dstOffset += encodedSize(encoding, levelWidth, levelHeight);
+		}
+		return encoded;
+	}
+}
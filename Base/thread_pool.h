@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+//Fixed set of worker threads, each with its own job queue.
+//Jobs are pinned to a thread so per-thread resources (e.g. command pools) are never shared.
+class ThreadPool
+{
+private:
+	class Thread
+	{
+	private:
+		bool destroying = false;
+		std::thread worker;
+		std::queue<std::function<void()>> jobQueue;
+		std::mutex queueMutex;
+		std::condition_variable condition;
+
+		void queueLoop()
+		{
+			while (true)
+			{
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(queueMutex);
+					condition.wait(lock, [this] { return !jobQueue.empty() || destroying; });
+					if (destroying)
+					{
+						break;
+					}
+					job = jobQueue.front();
+				}
+
+				job();
+
+				{
+					std::lock_guard<std::mutex> lock(queueMutex);
+					jobQueue.pop();
+					condition.notify_one();
+				}
+			}
+		}
+
+	public:
+		Thread()
+		{
+			worker = std::thread(&Thread::queueLoop, this);
+		}
+
+		~Thread()
+		{
+			if (worker.joinable())
+			{
+				wait();
+				{
+					std::lock_guard<std::mutex> lock(queueMutex);
+					destroying = true;
+					condition.notify_one();
+				}
+				worker.join();
+			}
+		}
+
+		void addJob(std::function<void()> function)
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			jobQueue.push(std::move(function));
+			condition.notify_one();
+		}
+
+		//Block until all queued jobs of this thread have finished
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			condition.wait(lock, [this]() { return jobQueue.empty(); });
+		}
+	};
+
+public:
+	std::vector<std::unique_ptr<Thread>> threads;
+
+	void setThreadCount(uint32_t count)
+	{
+		threads.clear();
+		for (uint32_t i = 0; i < count; i++)
+		{
+			threads.push_back(std::make_unique<Thread>());
+		}
+	}
+
+	uint32_t size() const
+	{
+		return static_cast<uint32_t>(threads.size());
+	}
+
+	void wait()
+	{
+		for (auto& thread : threads)
+		{
+			thread->wait();
+		}
+	}
+};
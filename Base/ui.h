@@ -18,8 +18,18 @@ struct UI
 {
 private:
 	VkDevice device;
+	vulkan::VulkanDevice* vulkanDevice;
+	VkRenderPass renderPass;
+	VkCommandPool commandPool;
 public:
-	Buffer vertexBuffer, indexBuffer;
+	//Per-frame geometry and command buffer, only touched once the frame's fence has signaled
+	struct FrameResources
+	{
+		Buffer vertexBuffer;
+		Buffer indexBuffer;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	};
+	std::vector<FrameResources> frames;
 	vulkan::Texture2D fontTexture;
 	VkPipelineLayout pipelineLayout;
 	VkPipeline pipeline;
@@ -33,11 +43,25 @@ public:
 		glm::vec2 translate;
 	}pushConstBlock;
 
-	UI(vulkan::VulkanDevice* vulkanDevice, VkRenderPass renderPass, VkQueue queue, VkPipelineCache pipelineCache, VkSampleCountFlagBits multiSampleCount)
+	UI(vulkan::VulkanDevice* vulkanDevice, VkRenderPass renderPass, VkPipelineCache pipelineCache, VkSampleCountFlagBits multiSampleCount, uint32_t frameCount)
 	{
 		assert(vulkanDevice);
 
 		this->device = vulkanDevice->logicalDevice;
+		this->vulkanDevice = vulkanDevice;
+		this->renderPass = renderPass;
+		//Secondary command buffers, re-recorded every frame
+		commandPool = vulkanDevice->createCommandPool(vulkanDevice->queueFamilyIndices.graphicsFamily.value());
+		frames.resize(frameCount);
+		for (auto& frame : frames)
+		{
+			VkCommandBufferAllocateInfo allocateInfo{};
+			allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocateInfo.commandPool = commandPool;
+			allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocateInfo.commandBufferCount = 1;
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocateInfo, &frame.commandBuffer));
+		}
 
 		ImGui::CreateContext();
 		//Font texture loading
@@ -48,7 +72,7 @@ public:
 		io.Fonts->AddFontFromFileTTF((FONT_PATH + "Roboto-Medium.ttf").c_str(), 16.0f);
 
 		io.Fonts->GetTexDataAsRGBA32(&fontData, &texWidth, &texHeight);
-		fontTexture.loadFromBuffer(fontData, texWidth * texHeight * 4 * sizeof(char), VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, vulkanDevice, queue);
+		fontTexture.loadFromBuffer(fontData, texWidth * texHeight * 4 * sizeof(char), VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, vulkanDevice);
 		//Set up
 		ImGuiStyle& style = ImGui::GetStyle();
 		style.FrameBorderSize = 0.0f;
@@ -147,6 +171,7 @@ public:
 		//Multisample
 		VkPipelineMultisampleStateCreateInfo multisampleStateCI{};
 		multisampleStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampleStateCI.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 		if (multiSampleCount > VK_SAMPLE_COUNT_1_BIT)
 		{
 			multisampleStateCI.rasterizationSamples = multiSampleCount;
@@ -198,25 +223,115 @@ public:
 	~UI()
 	{
 		ImGui::DestroyContext();
-		vertexBuffer.destroy();
-		indexBuffer.destroy();
+		for (auto& frame : frames)
+		{
+			if (frame.vertexBuffer.buffer)
+			{
+				frame.vertexBuffer.destroy();
+			}
+			if (frame.indexBuffer.buffer)
+			{
+				frame.indexBuffer.destroy();
+			}
+		}
+		vkDestroyCommandPool(device, commandPool, nullptr);
+		fontTexture.destroy();
 		vkDestroyPipeline(device, pipeline, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 	}
 
-	void draw(VkCommandBuffer cmdBuffer) {
+	//Grow a persistently mapped buffer to at least the given size, old contents are discarded
+	void reserve(Buffer& buffer, VkBufferUsageFlags usage, VkDeviceSize size)
+	{
+		if (buffer.buffer != VK_NULL_HANDLE && buffer.descriptor.range >= size)
+		{
+			return;
+		}
+		VkDeviceSize capacity = buffer.buffer != VK_NULL_HANDLE ? buffer.descriptor.range : 16384;
+		while (capacity < size)
+		{
+			capacity *= 2;
+		}
+		if (buffer.buffer != VK_NULL_HANDLE)
+		{
+			buffer.destroy();
+		}
+		buffer.create(vulkanDevice, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, capacity);
+	}
+
+	//Copy the current ImGui draw data into the buffers of the given frame
+	void update(uint32_t frame)
+	{
+		ImDrawData* imDrawData = ImGui::GetDrawData();
+		if (!imDrawData || imDrawData->TotalVtxCount == 0 || imDrawData->TotalIdxCount == 0)
+		{
+			return;
+		}
+		FrameResources& resources = frames[frame];
+		reserve(resources.vertexBuffer, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, imDrawData->TotalVtxCount * sizeof(ImDrawVert));
+		reserve(resources.indexBuffer, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, imDrawData->TotalIdxCount * sizeof(ImDrawIdx));
+		resources.vertexBuffer.count = imDrawData->TotalVtxCount;
+		resources.indexBuffer.count = imDrawData->TotalIdxCount;
+
+		ImDrawVert* vtxDst = (ImDrawVert*)resources.vertexBuffer.mapped;
+		ImDrawIdx* idxDst = (ImDrawIdx*)resources.indexBuffer.mapped;
+		for (int n = 0; n < imDrawData->CmdListsCount; n++)
+		{
+			const ImDrawList* cmd_list = imDrawData->CmdLists[n];
+			memcpy(vtxDst, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+			memcpy(idxDst, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+			vtxDst += cmd_list->VtxBuffer.Size;
+			idxDst += cmd_list->IdxBuffer.Size;
+		}
+	}
+
+	//Record the frame's secondary command buffer, executed inside the main render pass
+	VkCommandBuffer record(uint32_t frame, uint32_t width, uint32_t height)
+	{
+		FrameResources& resources = frames[frame];
+
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = 0;
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(resources.commandBuffer, &beginInfo));
+
+		VkViewport viewport{};
+		viewport.width = (float)width;
+		viewport.height = (float)height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(resources.commandBuffer, 0, 1, &viewport);
+
+		draw(resources.commandBuffer, frame);
+
+		VK_CHECK_RESULT(vkEndCommandBuffer(resources.commandBuffer));
+		return resources.commandBuffer;
+	}
+
+	void draw(VkCommandBuffer cmdBuffer, uint32_t frame) {
+		FrameResources& resources = frames[frame];
+		ImDrawData* imDrawData = ImGui::GetDrawData();
+		if (!imDrawData || resources.vertexBuffer.buffer == VK_NULL_HANDLE || resources.indexBuffer.count == 0)
+		{
+			return;
+		}
+
 		vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 		vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 
 		const VkDeviceSize offsets[1] = { 0 };
-		vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &vertexBuffer.buffer, offsets);
-		vkCmdBindIndexBuffer(cmdBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+		vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &resources.vertexBuffer.buffer, offsets);
+		vkCmdBindIndexBuffer(cmdBuffer, resources.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
 
 		vkCmdPushConstants(cmdBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(UI::PushConstBlock), &pushConstBlock);
 
-		ImDrawData* imDrawData = ImGui::GetDrawData();
 		int32_t vertexOffset = 0;
 		int32_t indexOffset = 0;
 		for (int32_t j = 0; j < imDrawData->CmdListsCount; j++)
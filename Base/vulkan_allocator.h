@@ -0,0 +1,523 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#include "vulkan_base.h"
+
+namespace vulkan
+{
+	class MemoryAllocator;
+
+	//A range of device memory handed out by the MemoryAllocator
+	struct Allocation
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		//Host visible memory stays mapped for its whole lifetime, this points at offset
+		void* mapped = nullptr;
+	private:
+		friend class MemoryAllocator;
+		uint32_t pool = 0;
+		//Owning block and node inside it, both null for dedicated allocations
+		void* block = nullptr;
+		void* node = nullptr;
+	};
+
+	//Two level segregated fit (TLSF) free lists over one VkDeviceMemory block.
+	//Allocation and free are O(1): sizes map to a first level power of two and
+	//SUB_LIST_COUNT linear second level lists, bitmaps find the next non-empty list.
+	class TLSFBlock
+	{
+	public:
+		struct Node
+		{
+			VkDeviceSize offset;
+			VkDeviceSize size;
+			bool free = true;
+			Node* prevPhysical = nullptr;
+			Node* nextPhysical = nullptr;
+			Node* prevFree = nullptr;
+			Node* nextFree = nullptr;
+		};
+
+		//All offsets and sizes are multiples of this
+		static constexpr VkDeviceSize MIN_ALIGNMENT = 16;
+
+		TLSFBlock(VkDeviceSize size)
+		{
+			this->size = size - size % MIN_ALIGNMENT;
+			Node* node = new Node();
+			node->offset = 0;
+			node->size = this->size;
+			insertFree(node);
+		}
+
+		~TLSFBlock()
+		{
+			//Walk the physical chain from any node to delete all of them
+			Node* node = nullptr;
+			for (uint32_t fl = 0; fl < FIRST_LEVEL_COUNT && !node; fl++)
+			{
+				for (uint32_t sl = 0; sl < SUB_LIST_COUNT && !node; sl++)
+				{
+					node = freeLists[fl][sl];
+				}
+			}
+			if (!node)
+			{
+				return;
+			}
+			while (node->prevPhysical)
+			{
+				node = node->prevPhysical;
+			}
+			while (node)
+			{
+				Node* next = node->nextPhysical;
+				delete node;
+				node = next;
+			}
+		}
+
+		//Returns the allocated node or nullptr if no free range fits
+		Node* allocate(VkDeviceSize requestSize, VkDeviceSize alignment, VkDeviceSize& offset)
+		{
+			requestSize = alignUp(std::max(requestSize, MIN_ALIGNMENT), MIN_ALIGNMENT);
+			alignment = std::max(alignment, MIN_ALIGNMENT);
+			//Worst case padding in front of the aligned offset
+			Node* node = findFree(requestSize + alignment - MIN_ALIGNMENT);
+			if (!node)
+			{
+				return nullptr;
+			}
+			removeFree(node);
+
+			VkDeviceSize padding = alignUp(node->offset, alignment) - node->offset;
+			if (padding > 0)
+			{
+				Node* front = split(node, padding);
+				//The padding stays free, the aligned remainder is allocated
+				std::swap(front, node);
+				insertFree(front);
+			}
+			if (node->size - requestSize >= MIN_ALIGNMENT)
+			{
+				insertFree(split(node, requestSize));
+			}
+			node->free = false;
+			used += node->size;
+			allocationCount++;
+			offset = node->offset;
+			return node;
+		}
+
+		void free(Node* node)
+		{
+			used -= node->size;
+			allocationCount--;
+			node->free = true;
+			//Merge with free physical neighbours
+			if (node->prevPhysical && node->prevPhysical->free)
+			{
+				Node* prev = node->prevPhysical;
+				removeFree(prev);
+				prev->size += node->size;
+				prev->nextPhysical = node->nextPhysical;
+				if (node->nextPhysical)
+				{
+					node->nextPhysical->prevPhysical = prev;
+				}
+				delete node;
+				node = prev;
+			}
+			if (node->nextPhysical && node->nextPhysical->free)
+			{
+				Node* next = node->nextPhysical;
+				removeFree(next);
+				node->size += next->size;
+				node->nextPhysical = next->nextPhysical;
+				if (next->nextPhysical)
+				{
+					next->nextPhysical->prevPhysical = node;
+				}
+				delete next;
+			}
+			insertFree(node);
+		}
+
+		VkDeviceSize getSize() const { return size; }
+		VkDeviceSize getUsed() const { return used; }
+		uint32_t getAllocationCount() const { return allocationCount; }
+
+		VkDeviceSize getLargestFree() const
+		{
+			if (!firstLevelBitmap)
+			{
+				return 0;
+			}
+			uint32_t fl = bitScanReverse(firstLevelBitmap);
+			uint32_t sl = bitScanReverse(secondLevelBitmaps[fl]);
+			VkDeviceSize largest = 0;
+			for (Node* node = freeLists[fl][sl]; node; node = node->nextFree)
+			{
+				largest = std::max(largest, node->size);
+			}
+			return largest;
+		}
+
+	private:
+		static constexpr uint32_t SUB_LIST_LOG2 = 4;
+		static constexpr uint32_t SUB_LIST_COUNT = 1 << SUB_LIST_LOG2;
+		static constexpr uint32_t FIRST_LEVEL_COUNT = 64;
+
+		VkDeviceSize size;
+		VkDeviceSize used = 0;
+		uint32_t allocationCount = 0;
+		uint64_t firstLevelBitmap = 0;
+		uint32_t secondLevelBitmaps[FIRST_LEVEL_COUNT]{};
+		Node* freeLists[FIRST_LEVEL_COUNT][SUB_LIST_COUNT]{};
+
+		static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+		{
+			return (value + alignment - 1) & ~(alignment - 1);
+		}
+
+		static uint32_t bitScanForward(uint64_t value)
+		{
+			uint32_t index = 0;
+			while (!(value & 1))
+			{
+				value >>= 1;
+				index++;
+			}
+			return index;
+		}
+
+		static uint32_t bitScanReverse(uint64_t value)
+		{
+			uint32_t index = 0;
+			while (value >>= 1)
+			{
+				index++;
+			}
+			return index;
+		}
+
+		//Size in MIN_ALIGNMENT units to first and second level list
+		static void mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl)
+		{
+			VkDeviceSize units = size / MIN_ALIGNMENT;
+			fl = bitScanReverse(units);
+			VkDeviceSize normalized = fl < SUB_LIST_LOG2 ? units << (SUB_LIST_LOG2 - fl) : units >> (fl - SUB_LIST_LOG2);
+			sl = static_cast<uint32_t>(normalized) - SUB_LIST_COUNT;
+		}
+
+		//First free node whose list only holds ranges of at least size
+		Node* findFree(VkDeviceSize size)
+		{
+			VkDeviceSize units = size / MIN_ALIGNMENT;
+			uint32_t fl = bitScanReverse(units);
+			if (fl >= SUB_LIST_LOG2)
+			{
+				//Round up to the next list so any node in it fits
+				units += (VkDeviceSize(1) << (fl - SUB_LIST_LOG2)) - 1;
+			}
+			uint32_t sl;
+			mapping(units * MIN_ALIGNMENT, fl, sl);
+			if (fl >= FIRST_LEVEL_COUNT)
+			{
+				return nullptr;
+			}
+			uint32_t secondLevelMap = secondLevelBitmaps[fl] & (~0u << sl);
+			if (!secondLevelMap)
+			{
+				uint64_t firstLevelMap = fl + 1 < FIRST_LEVEL_COUNT ? firstLevelBitmap & (~uint64_t(0) << (fl + 1)) : 0;
+				if (!firstLevelMap)
+				{
+					return nullptr;
+				}
+				fl = bitScanForward(firstLevelMap);
+				secondLevelMap = secondLevelBitmaps[fl];
+			}
+			sl = bitScanForward(secondLevelMap);
+			return freeLists[fl][sl];
+		}
+
+		void insertFree(Node* node)
+		{
+			uint32_t fl, sl;
+			mapping(node->size, fl, sl);
+			node->free = true;
+			node->prevFree = nullptr;
+			node->nextFree = freeLists[fl][sl];
+			if (node->nextFree)
+			{
+				node->nextFree->prevFree = node;
+			}
+			freeLists[fl][sl] = node;
+			firstLevelBitmap |= uint64_t(1) << fl;
+			secondLevelBitmaps[fl] |= 1u << sl;
+		}
+
+		void removeFree(Node* node)
+		{
+			uint32_t fl, sl;
+			mapping(node->size, fl, sl);
+			if (node->prevFree)
+			{
+				node->prevFree->nextFree = node->nextFree;
+			}
+			else
+			{
+				freeLists[fl][sl] = node->nextFree;
+			}
+			if (node->nextFree)
+			{
+				node->nextFree->prevFree = node->prevFree;
+			}
+			node->prevFree = nullptr;
+			node->nextFree = nullptr;
+			if (!freeLists[fl][sl])
+			{
+				secondLevelBitmaps[fl] &= ~(1u << sl);
+				if (!secondLevelBitmaps[fl])
+				{
+					firstLevelBitmap &= ~(uint64_t(1) << fl);
+				}
+			}
+		}
+
+		//Cut node at size, node keeps the front part and the returned node the rest
+		Node* split(Node* node, VkDeviceSize size)
+		{
+			Node* rest = new Node();
+			rest->offset = node->offset + size;
+			rest->size = node->size - size;
+			rest->prevPhysical = node;
+			rest->nextPhysical = node->nextPhysical;
+			if (node->nextPhysical)
+			{
+				node->nextPhysical->prevPhysical = rest;
+			}
+			node->nextPhysical = rest;
+			node->size = size;
+			return rest;
+		}
+	};
+
+	//Sub-allocates buffers and images from large VkDeviceMemory blocks, one pool per memory type
+	//and resource kind. Linear (buffers) and optimal (images) resources get separate pools so
+	//bufferImageGranularity never has to be considered between neighbours.
+	//Blocks are kept until the allocator is destroyed, so reloading scenes reuses them.
+	class MemoryAllocator
+	{
+	public:
+		struct Stats
+		{
+			//vkAllocateMemory calls over the allocator's lifetime
+			uint32_t deviceAllocations = 0;
+			uint32_t blockCount = 0;
+			uint32_t dedicatedCount = 0;
+			uint32_t allocationCount = 0;
+			VkDeviceSize reservedBytes = 0;
+			VkDeviceSize usedBytes = 0;
+			//1 - largest free range / total free, 0 when all free space is contiguous
+			float fragmentation = 0.0f;
+		};
+
+		//Requests larger than half a block get their own VkDeviceMemory
+		static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+		MemoryAllocator(VkDevice device, const VkPhysicalDeviceMemoryProperties& memoryProperties, const VkPhysicalDeviceLimits& limits)
+		{
+			this->device = device;
+			this->memoryProperties = memoryProperties;
+			nonCoherentAtomSize = limits.nonCoherentAtomSize;
+			pools.resize(memoryProperties.memoryTypeCount * 2);
+			for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+			{
+				//Small heaps (e.g. host visible device local on some GPUs) get smaller blocks
+				VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].size;
+				VkDeviceSize blockSize = std::min(DEFAULT_BLOCK_SIZE, heapSize / 8);
+				pools[i * 2].blockSize = blockSize;
+				pools[i * 2 + 1].blockSize = blockSize;
+			}
+		}
+
+		~MemoryAllocator()
+		{
+			for (auto& pool : pools)
+			{
+				for (auto& block : pool.blocks)
+				{
+					vkFreeMemory(device, block->memory, nullptr);
+				}
+			}
+		}
+
+		Allocation allocate(const VkMemoryRequirements& requirements, uint32_t memoryType, bool optimal)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			VkDeviceSize alignment = requirements.alignment;
+			VkDeviceSize size = requirements.size;
+			const VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[memoryType].propertyFlags;
+			const bool hostVisible = flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+			//Non-coherent ranges are flushed in whole atoms, keep neighbours out of them
+			if (hostVisible && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+			{
+				alignment = std::max(alignment, nonCoherentAtomSize);
+				size = (size + nonCoherentAtomSize - 1) & ~(nonCoherentAtomSize - 1);
+			}
+
+			Allocation allocation{};
+			allocation.pool = memoryType * 2 + (optimal ? 1 : 0);
+			allocation.size = size;
+			Pool& pool = pools[allocation.pool];
+
+			//Large and lazily allocated (transient attachment) resources are not worth sharing a block
+			if (size > pool.blockSize / 2 || (flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+			{
+				allocation.memory = allocateDeviceMemory(size, memoryType);
+				if (hostVisible)
+				{
+					VK_CHECK_RESULT(vkMapMemory(device, allocation.memory, 0, VK_WHOLE_SIZE, 0, &allocation.mapped));
+				}
+				dedicatedCount++;
+				dedicatedBytes += size;
+				return allocation;
+			}
+
+			for (auto& block : pool.blocks)
+			{
+				if (tryAllocate(*block, size, alignment, allocation))
+				{
+					return allocation;
+				}
+			}
+
+			auto block = std::make_unique<Block>(pool.blockSize);
+			block->memory = allocateDeviceMemory(pool.blockSize, memoryType);
+			if (hostVisible)
+			{
+				VK_CHECK_RESULT(vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped));
+			}
+			if (!tryAllocate(*block, size, alignment, allocation))
+			{
+				throw std::runtime_error("failed to sub-allocate from a new memory block!");
+			}
+			pool.blocks.push_back(std::move(block));
+			return allocation;
+		}
+
+		void free(Allocation& allocation)
+		{
+			if (allocation.memory == VK_NULL_HANDLE)
+			{
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			if (allocation.block)
+			{
+				Block* block = static_cast<Block*>(allocation.block);
+				block->tlsf.free(static_cast<TLSFBlock::Node*>(allocation.node));
+			}
+			else
+			{
+				vkFreeMemory(device, allocation.memory, nullptr);
+				dedicatedCount--;
+				dedicatedBytes -= allocation.size;
+			}
+			allocation = Allocation{};
+		}
+
+		Stats getStats()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Stats stats{};
+			stats.deviceAllocations = deviceAllocations;
+			stats.dedicatedCount = dedicatedCount;
+			stats.allocationCount = dedicatedCount;
+			stats.reservedBytes = dedicatedBytes;
+			stats.usedBytes = dedicatedBytes;
+			VkDeviceSize freeBytes = 0;
+			VkDeviceSize largestFree = 0;
+			for (auto& pool : pools)
+			{
+				for (auto& block : pool.blocks)
+				{
+					stats.blockCount++;
+					stats.allocationCount += block->tlsf.getAllocationCount();
+					stats.reservedBytes += block->tlsf.getSize();
+					stats.usedBytes += block->tlsf.getUsed();
+					freeBytes += block->tlsf.getSize() - block->tlsf.getUsed();
+					largestFree = std::max(largestFree, block->tlsf.getLargestFree());
+				}
+			}
+			if (freeBytes > 0)
+			{
+				stats.fragmentation = 1.0f - static_cast<float>(largestFree) / static_cast<float>(freeBytes);
+			}
+			return stats;
+		}
+
+	private:
+		struct Block
+		{
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			void* mapped = nullptr;
+			TLSFBlock tlsf;
+			Block(VkDeviceSize size) : tlsf(size) {}
+		};
+		struct Pool
+		{
+			VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+			std::vector<std::unique_ptr<Block>> blocks;
+		};
+
+		VkDevice device;
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		VkDeviceSize nonCoherentAtomSize = 1;
+		std::vector<Pool> pools;
+		std::mutex mutex;
+		uint32_t deviceAllocations = 0;
+		uint32_t dedicatedCount = 0;
+		VkDeviceSize dedicatedBytes = 0;
+
+		VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType)
+		{
+			VkMemoryAllocateInfo memAlloc{};
+			memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			memAlloc.allocationSize = size;
+			memAlloc.memoryTypeIndex = memoryType;
+			VkDeviceMemory memory;
+			if (vkAllocateMemory(device, &memAlloc, nullptr, &memory) != VK_SUCCESS)
+			{
+				throw std::runtime_error("failed to allocate device memory!");
+			}
+			deviceAllocations++;
+			return memory;
+		}
+
+		bool tryAllocate(Block& block, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation)
+		{
+			VkDeviceSize offset;
+			TLSFBlock::Node* node = block.tlsf.allocate(size, alignment, offset);
+			if (!node)
+			{
+				return false;
+			}
+			allocation.memory = block.memory;
+			allocation.offset = offset;
+			allocation.mapped = block.mapped ? static_cast<uint8_t*>(block.mapped) + offset : nullptr;
+			allocation.block = &block;
+			allocation.node = node;
+			return true;
+		}
+	};
+}
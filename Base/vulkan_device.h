@@ -1,8 +1,13 @@
 #pragma once
 
 #include <optional>
+#include <mutex>
+#include <cstddef>
+#include <cstring>
 
 #include "vulkan_base.h"
+#include "vulkan_allocator.h"
+#include "vulkan_staging.h"
 
 #if defined(VK_USE_PLATFORM_MACOS_MVK) && (VK_HEADER_VERSION >= 216)
 #include <vulkan/vulkan_beta.h>
@@ -21,11 +26,22 @@ namespace vulkan
 		VkPhysicalDeviceMemoryProperties memoryProperties;
 		std::vector<VkQueueFamilyProperties> queueFamilyProperties;
 		VkCommandPool commandPool = VK_NULL_HANDLE;
+		//Sub-allocates all buffer and image memory created through this device
+		MemoryAllocator* allocator = nullptr;
+		//Queues are shared with loader threads, hold this around every submit, present and wait idle
+		std::mutex queueMutex;
+		//Staging memory of all uploads, copies run on the transfer queue when the device has a dedicated one
+		StagingRing* staging = nullptr;
+		//Samplers handed out by getSampler, owned by the device
+		std::vector<std::pair<VkSamplerCreateInfo, VkSampler>> samplers;
+		std::mutex samplerMutex;
 
 		struct QueueFamilyIndices
 		{
 			std::optional<uint32_t> graphicsFamily;
 			std::optional<uint32_t> computeFamily;
+			//Transfer only family (DMA engines) when there is one, the graphics family otherwise
+			std::optional<uint32_t> transferFamily;
 			bool isComplete()
 			{
 				return graphicsFamily.has_value() && computeFamily.has_value();
@@ -60,6 +76,32 @@ namespace vulkan
 					}
 					i++;
 				}
+				//No dedicated compute family (e.g. software rasterizers), share the graphics family
+				if (!computeFamily.has_value() && graphicsFamily.has_value() && (queueFamilies[graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT))
+				{
+					computeFamily = graphicsFamily;
+				}
+				//Prefer a family without graphics and compute, then one without graphics
+				for (uint32_t family = 0; family < queueFamilyCount && !transferFamily.has_value(); family++)
+				{
+					const VkQueueFlags flags = queueFamilies[family].queueFlags;
+					if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+					{
+						transferFamily = family;
+					}
+				}
+				for (uint32_t family = 0; family < queueFamilyCount && !transferFamily.has_value(); family++)
+				{
+					const VkQueueFlags flags = queueFamilies[family].queueFlags;
+					if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+					{
+						transferFamily = family;
+					}
+				}
+				if (!transferFamily.has_value())
+				{
+					transferFamily = graphicsFamily;
+				}
 			}
 		} queueFamilyIndices;
 
@@ -74,6 +116,10 @@ namespace vulkan
 			vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 			vkGetPhysicalDeviceFeatures(physicalDevice, &features);
 			vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+			uint32_t queueFamilyCount = 0;
+			vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+			queueFamilyProperties.resize(queueFamilyCount);
+			vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
 			queueFamilyIndices.init(physicalDevice);
 			if (!queueFamilyIndices.isComplete())
 			{
@@ -87,12 +133,40 @@ namespace vulkan
 			{
 				vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 			}
+			for (auto& sampler : samplers)
+			{
+				vkDestroySampler(logicalDevice, sampler.second, nullptr);
+			}
+			delete staging;
+			delete allocator;
 			if (logicalDevice)
 			{
 				vkDestroyDevice(logicalDevice, nullptr);
 			}
 		}
 
+		//Sampler for the create info, identical create infos share one handle that lives as long as the device.
+		//Callers must not destroy it. pNext is not part of the key and has to be null.
+		VkSampler getSampler(const VkSamplerCreateInfo& createInfo)
+		{
+			assert(createInfo.pNext == nullptr);
+			//Everything from flags on, the members are all 32 bit so there is no padding to compare
+			const size_t keyOffset = offsetof(VkSamplerCreateInfo, flags);
+			const size_t keySize = sizeof(VkSamplerCreateInfo) - keyOffset;
+			std::lock_guard<std::mutex> lock(samplerMutex);
+			for (const auto& sampler : samplers)
+			{
+				if (memcmp(reinterpret_cast<const uint8_t*>(&sampler.first) + keyOffset, reinterpret_cast<const uint8_t*>(&createInfo) + keyOffset, keySize) == 0)
+				{
+					return sampler.second;
+				}
+			}
+			VkSampler sampler;
+			VK_CHECK_RESULT(vkCreateSampler(logicalDevice, &createInfo, nullptr, &sampler));
+			samplers.push_back({ createInfo, sampler });
+			return sampler;
+		}
+
 		//Get the index of a memory type that has all the requested property bits set.
 		uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkBool32* memTypeFound = nullptr)
 		{
@@ -122,7 +196,7 @@ namespace vulkan
 			}
 		}
 
-		VkResult createLogicalDevice(VkPhysicalDeviceFeatures enabledFeatures, std::vector<const char*> enabledExtensions, VkQueueFlags requestedQueueTypes = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)
+		VkResult createLogicalDevice(VkPhysicalDeviceFeatures enabledFeatures, std::vector<const char*> enabledExtensions, VkQueueFlags requestedQueueTypes = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT, void* pNextChain = nullptr)
 		{
 			std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{};
 
@@ -153,15 +227,39 @@ namespace vulkan
 				}
 			}
 
-			//Create the logical device representation.
+			//Dedicated transfer queue for uploads, falls back to the graphics queue when not requested
+			if (!(requestedQueueTypes & VK_QUEUE_TRANSFER_BIT))
+			{
+				queueFamilyIndices.transferFamily = queueFamilyIndices.graphicsFamily;
+			}
+			else if (queueFamilyIndices.transferFamily.value() != queueFamilyIndices.graphicsFamily.value())
+			{
+				bool created = false;
+				for (const auto& queueInfo : queueCreateInfos)
+				{
+					created |= queueInfo.queueFamilyIndex == queueFamilyIndices.transferFamily.value();
+				}
+				if (!created)
+				{
+					VkDeviceQueueCreateInfo queueInfo{};
+					queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+					queueInfo.queueFamilyIndex = queueFamilyIndices.transferFamily.value();
+					queueInfo.queueCount = 1;
+					queueInfo.pQueuePriorities = &defaultQueuePriority;
+					queueCreateInfos.push_back(queueInfo);
+				}
+			}
+
+			//Create the logical device representation, the swapchain extension is requested by the caller unless running headless.
 			std::vector<const char*> deviceExtensions(enabledExtensions);
-			deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
 			VkDeviceCreateInfo deviceCreateInfo = {};
 			deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 			deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 			deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 			deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
+			//Feature structures of newer core versions and extensions
+			deviceCreateInfo.pNext = pNextChain;
 
 			if (deviceExtensions.size() > 0)
 			{
@@ -174,6 +272,15 @@ namespace vulkan
 			if (result == VK_SUCCESS)
 			{
 				commandPool = createCommandPool(queueFamilyIndices.graphicsFamily.value());
+				allocator = new MemoryAllocator(logicalDevice, memoryProperties, properties.limits);
+				if (requestedQueueTypes & VK_QUEUE_GRAPHICS_BIT)
+				{
+					VkQueue graphicsQueue, transferQueue;
+					vkGetDeviceQueue(logicalDevice, queueFamilyIndices.graphicsFamily.value(), 0, &graphicsQueue);
+					vkGetDeviceQueue(logicalDevice, queueFamilyIndices.transferFamily.value(), 0, &transferQueue);
+					staging = new StagingRing(logicalDevice, allocator, memoryProperties, properties.limits,
+						queueFamilyIndices.transferFamily.value(), transferQueue, queueFamilyIndices.graphicsFamily.value(), graphicsQueue, queueMutex);
+				}
 			}
 
 			this->enabledFeatures = enabledFeatures;
@@ -181,8 +288,8 @@ namespace vulkan
 			return result;
 		}
 
-		//Create a buffer on the device
-		VkResult createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer* buffer, VkDeviceMemory* memory, void* data = nullptr)
+		//Create a buffer on the device, its memory is sub-allocated and host visible memory stays mapped
+		VkResult createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer* buffer, Allocation* memory, void* data = nullptr)
 		{
 			//Create the buffer handle
 			VkBufferCreateInfo bufferCreateInfo{};
@@ -197,35 +304,28 @@ namespace vulkan
 
 			//Create the memory backing up the buffer handle
 			VkMemoryRequirements memReqs;
-			VkMemoryAllocateInfo memAlloc{};
-			memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 			vkGetBufferMemoryRequirements(logicalDevice, *buffer, &memReqs);
-			memAlloc.allocationSize = memReqs.size;
 			//Find a memory type index that fits the properties of the buffer.
-			memAlloc.memoryTypeIndex = findMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
-			VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, memory));
+			*memory = allocator->allocate(memReqs, findMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags), false);
 
-			//If a pointer to the buffer data has been passed, map the buffer and copy over the data.
+			//If a pointer to the buffer data has been passed, copy it over through the persistent mapping.
 			if (data != nullptr)
 			{
-				void* mapped;
-				VK_CHECK_RESULT(vkMapMemory(logicalDevice, *memory, 0, size, 0, &mapped));
-				memcpy(mapped, data, size);
+				memcpy(memory->mapped, data, size);
 				//If host coherency hasn't been requested, do a manual flush to make writes visible.
 				if ((memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
 				{
 					VkMappedMemoryRange mappedRange{};
 					mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-					mappedRange.memory = *memory;
-					mappedRange.offset = 0;
-					mappedRange.size = size;
+					mappedRange.memory = memory->memory;
+					mappedRange.offset = memory->offset;
+					mappedRange.size = memory->size;
 					vkFlushMappedMemoryRanges(logicalDevice, 1, &mappedRange);
 				}
-				vkUnmapMemory(logicalDevice, *memory);
 			}
 
 			//Attach the memory to the buffer object.
-			VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, *buffer, *memory, 0));
+			VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, *buffer, memory->memory, memory->offset));
 
 			return VK_SUCCESS;
 		}
@@ -244,16 +344,20 @@ namespace vulkan
 		}
 
 		//Allocate a command buffer from the command pool.
-
-		VkCommandBuffer createCommandBuffer(VkCommandBufferLevel level)
+		//Threads other than the render thread pass a pool of their own, command pools are not thread safe.
+		VkCommandBuffer createCommandBuffer(VkCommandBufferLevel level, VkCommandPool pool = VK_NULL_HANDLE)
 		{
-			if (!commandPool)
+			if (!pool)
+			{
+				pool = commandPool;
+			}
+			if (!pool)
 			{
 				throw std::runtime_error("failed to create command buffer! command pool is not ready!");
 			}
 			VkCommandBufferAllocateInfo allocateInfo{};
 			allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-			allocateInfo.commandPool = commandPool;
+			allocateInfo.commandPool = pool;
 			allocateInfo.level = level;
 			allocateInfo.commandBufferCount = 1;
 
@@ -276,7 +380,7 @@ namespace vulkan
 		}
 
 		//Finish command buffer recoding and submit it to a queue.
-		void flushCommandBuffer(VkCommandBuffer buffer, VkQueue queue, bool freeMemory = true)
+		void flushCommandBuffer(VkCommandBuffer buffer, VkQueue queue, bool freeMemory = true, VkCommandPool pool = VK_NULL_HANDLE)
 		{
 			endCommandBuffer(buffer);
 
@@ -291,7 +395,10 @@ namespace vulkan
 			VkFence fence;
 			VK_CHECK_RESULT(vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &fence));
 			//Submit to the queue
-			VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+			}
 			//Wait for the fence to signal that command buffer has finished executing
 			VK_CHECK_RESULT(vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX));
 
@@ -299,11 +406,18 @@ namespace vulkan
 
 			if (freeMemory)
 			{
-				vkFreeCommandBuffers(logicalDevice, commandPool, 1, &buffer);
+				vkFreeCommandBuffers(logicalDevice, pool ? pool : commandPool, 1, &buffer);
 			}
 		}
 
-		void createImage(VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties,  VkImage& image, VkDeviceMemory& imageMemory, bool memTypeFound = false)
+		//vkDeviceWaitIdle needs all queues externally synchronized
+		void waitIdle()
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			vkDeviceWaitIdle(logicalDevice);
+		}
+
+		void createImage(VkImageCreateInfo& imageInfo, VkMemoryPropertyFlags properties,  VkImage& image, Allocation& imageMemory, bool memTypeFound = false)
 		{
 
 			if (vkCreateImage(logicalDevice, &imageInfo, nullptr, &image) != VK_SUCCESS)
@@ -314,25 +428,29 @@ namespace vulkan
 			VkMemoryRequirements memRequirements;
 			vkGetImageMemoryRequirements(logicalDevice, image, &memRequirements);
 
-			VkMemoryAllocateInfo allocInfo{};
-			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-			allocInfo.allocationSize = memRequirements.size;
+			uint32_t memoryTypeIndex;
 			if (memTypeFound)
 			{
 				VkBool32 lazyMemTypePresent;
-				allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties, &lazyMemTypePresent);
+				memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties, &lazyMemTypePresent);
 				if (!lazyMemTypePresent)
 				{
-					allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+					memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 				}
 			}
-
-			if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
+			else
 			{
-				throw std::runtime_error("failed to allocate image memory!");
+				memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
 			}
 
-			vkBindImageMemory(logicalDevice, image, imageMemory, 0);
+			imageMemory = allocator->allocate(memRequirements, memoryTypeIndex, imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL);
+			vkBindImageMemory(logicalDevice, image, imageMemory.memory, imageMemory.offset);
+		}
+
+		//Return sub-allocated memory to the allocator
+		void freeMemory(Allocation& memory)
+		{
+			allocator->free(memory);
 		}
 
 		void recordTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, VkImageSubresourceRange resourceRange, VkAccessFlagBits destMask = VK_ACCESS_FLAG_BITS_MAX_ENUM)
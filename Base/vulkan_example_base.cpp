@@ -42,14 +42,18 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	appInfo.pEngineName = name.c_str();
 	appInfo.apiVersion = VK_API_VERSION_1_3;
 
-	std::vector<const char*> instanceExtensions = { VK_KHR_SURFACE_EXTENSION_NAME };
+	std::vector<const char*> instanceExtensions;
 
-	//Enable surface extensions depending on os
+	//Enable surface extensions depending on os, headless rendering does not present anything
+	if (!settings.headless)
+	{
+		instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #if defined(_WIN32)
-	instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_MACOS_MVK)
-	instanceExtensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
 #endif
+	}
 
 #if defined(VK_USE_PLATFORM_MACOS_MVK) && (VK_HEADER_VERSION >= 216)
 	instanceExtensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
@@ -65,12 +69,12 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	instanceCreateInfo.flags = VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
 #endif
 
+	if (settings.validation)
+	{
+		instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	}
 	if (instanceExtensions.size() > 0)
 	{
-		if (settings.validation)
-		{
-			instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
-		}
 		instanceCreateInfo.enabledExtensionCount = (uint32_t)instanceExtensions.size();
 		instanceCreateInfo.ppEnabledExtensionNames = instanceExtensions.data();
 	}
@@ -87,9 +91,18 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 void VulkanExampleBase::prepare()
 {
 	//Swapchain
-	initSurface();
-	initSwapchain();
-	createSwapchain();
+	if (settings.headless)
+	{
+		swapchain.createHeadless(device, width, height, VK_FORMAT_R8G8B8A8_UNORM, 3);
+	}
+	else
+	{
+		initSurface();
+		initSwapchain();
+		createSwapchain();
+	}
+	//Offscreen targets are never presented
+	const VkImageLayout colorFinalLayout = settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 	//Command pool
 	VkCommandPoolCreateInfo cmdPoolInfo = {};
 	cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -118,7 +131,7 @@ void VulkanExampleBase::prepare()
 		attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		attachments[1].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		attachments[1].finalLayout = colorFinalLayout;
 		//Multisampled depth attachment we render to
 		attachments[2].format = depthFormat;
 		attachments[2].samples = settings.sampleCount;
@@ -198,7 +211,7 @@ void VulkanExampleBase::prepare()
 		attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 		attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		attachments[0].finalLayout = colorFinalLayout;
 		// Depth attachment
 		attachments[1].format = depthFormat;
 		attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
@@ -276,6 +289,11 @@ void VulkanExampleBase::renderFrame()
 	auto tEnd = std::chrono::high_resolution_clock::now();
 	auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
 	frameTimer = (float)tDiff / 1000.0f;
+	if (benchmark.active)
+	{
+		benchmark.addSample("cpuFrame", tDiff);
+		frameTimer = benchmark.frameTimer;
+	}
 	camera.update(frameTimer);
 	fpsTimer += (float)tDiff;
 	if (fpsTimer > 1000.0f)
@@ -290,6 +308,21 @@ void VulkanExampleBase::renderLoop()
 {
 	destWidth = width;
 	destHeight = height;
+	if (settings.headless)
+	{
+		//Fixed camera path and frame count, no window messages to pump
+		auto tStart = std::chrono::high_resolution_clock::now();
+		frameTimer = benchmark.frameTimer;
+		for (benchmark.currentFrame = 0; benchmark.currentFrame < benchmark.frameCount; benchmark.currentFrame++)
+		{
+			camera.setRotation(benchmark.cameraRotation(benchmark.currentFrame));
+			renderFrame();
+		}
+		device->waitIdle();
+		benchmark.addStage("renderLoop", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count());
+		benchmark.report(deviceProperties.deviceName, width, height, settings.multiSampling ? settings.sampleCount : 1);
+		return;
+	}
 #if defined(_WIN32)
 	MSG msg;
 	bool quitMessageReceived = false;
@@ -314,7 +347,7 @@ void VulkanExampleBase::renderLoop()
 [NSApp run];
 #endif
 	//Flush device to make sure all resources can be freed
-	vkDeviceWaitIdle(logicalDevice);
+	device->waitIdle();
 }
 
 VulkanExampleBase::VulkanExampleBase()
@@ -345,7 +378,80 @@ VulkanExampleBase::VulkanExampleBase()
 			uint32_t h = strtol(args[i + 1], &numConvPtr, 10);
 			if (numConvPtr != args[i + 1]) { height = h; };
 		}
+		if (args[i] == std::string("--headless"))
+		{
+			settings.headless = true;
+		}
+		if (args[i] == std::string("--prebaked"))
+		{
+			settings.perFrameRecording = false;
+		}
+		if (args[i] == std::string("--no-indirect"))
+		{
+			settings.indirectDrawing = false;
+		}
+		if (args[i] == std::string("--no-mesh-optimization"))
+		{
+			settings.optimizeMeshes = false;
+		}
+		if (args[i] == std::string("--depth-prepass"))
+		{
+			settings.depthPrepass = true;
+		}
+		if (args[i] == std::string("--no-scene-cache"))
+		{
+			settings.sceneCache = false;
+		}
+		if ((args[i] == std::string("--texture-budget")) && (i + 1 < args.size()))
+		{
+			uint32_t budget = strtol(args[i + 1], &numConvPtr, 10);
+			if (numConvPtr != args[i + 1]) { settings.textureBudget = budget; };
+		}
+		if (args[i] == std::string("--no-texture-compression"))
+		{
+			settings.textureCompression = false;
+		}
+		if (args[i] == std::string("--float-uvs"))
+		{
+			settings.floatTexCoords = true;
+		}
+		if (args[i] == std::string("--no-meshlets"))
+		{
+			settings.meshlets = false;
+		}
+		if (args[i] == std::string("--lods"))
+		{
+			settings.lods = true;
+		}
+		if ((args[i] == std::string("--lod-threshold")) && (i + 1 < args.size()))
+		{
+			float threshold = strtof(args[i + 1], &numConvPtr);
+			if (numConvPtr != args[i + 1]) { settings.lodThreshold = threshold; };
+		}
+		if (args[i] == std::string("--no-bindless"))
+		{
+			settings.bindlessMaterials = false;
+		}
+		if ((args[i] == std::string("--record-threads")) && (i + 1 < args.size()))
+		{
+			uint32_t threads = strtol(args[i + 1], &numConvPtr, 10);
+			if (numConvPtr != args[i + 1]) { settings.recordThreads = threads; };
+		}
+		if ((args[i] == std::string("--frames")) && (i + 1 < args.size()))
+		{
+			uint32_t frames = strtol(args[i + 1], &numConvPtr, 10);
+			if (numConvPtr != args[i + 1]) { benchmark.frameCount = frames; };
+		}
+		if ((args[i] == std::string("--benchmark-output")) && (i + 1 < args.size()))
+		{
+			benchmark.outputFile = args[i + 1];
+		}
 	}
+#if !defined(_WIN32) && !defined(VK_USE_PLATFORM_MACOS_MVK)
+	//No windowing backend on other platforms yet
+	settings.headless = true;
+#endif
+	benchmark.active = settings.headless;
 #if defined(_WIN32)
 	AllocConsole();
 	AttachConsole(GetCurrentProcessId());
@@ -360,7 +466,10 @@ VulkanExampleBase::~VulkanExampleBase()
 {
 	// Clean up Vulkan resources
 	swapchain.cleanup();
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (surface)
+	{
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
 	vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
 	vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
 	for (uint32_t i = 0; i < frameBuffers.size(); i++)
@@ -369,17 +478,17 @@ VulkanExampleBase::~VulkanExampleBase()
 	}
 	vkDestroyImageView(logicalDevice, depthStencil.view, nullptr);
 	vkDestroyImage(logicalDevice, depthStencil.image, nullptr);
-	vkFreeMemory(logicalDevice, depthStencil.memory, nullptr);
+	device->freeMemory(depthStencil.memory);
 	vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
 	vkDestroyCommandPool(logicalDevice, cmdPool, nullptr);
 	if (settings.multiSampling)
 	{
 		vkDestroyImage(logicalDevice, multisampleTarget.color.image, nullptr);
 		vkDestroyImageView(logicalDevice, multisampleTarget.color.view, nullptr);
-		vkFreeMemory(logicalDevice, multisampleTarget.color.memory, nullptr);
+		device->freeMemory(multisampleTarget.color.memory);
 		vkDestroyImage(logicalDevice, multisampleTarget.depth.image, nullptr);
 		vkDestroyImageView(logicalDevice, multisampleTarget.depth.view, nullptr);
-		vkFreeMemory(logicalDevice, multisampleTarget.depth.memory, nullptr);
+		device->freeMemory(multisampleTarget.depth.memory);
 	}
 	delete device;
 	if (settings.validation)
@@ -389,7 +498,7 @@ VulkanExampleBase::~VulkanExampleBase()
 	vkDestroyInstance(instance, nullptr);
 }
 
-bool checkDeviceExtensionSupport(VkPhysicalDevice device)
+bool checkDeviceExtensionSupport(VkPhysicalDevice device, const std::vector<const char*>& deviceExtensions)
 {
 	uint32_t extensionCount;
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
@@ -411,7 +520,7 @@ bool checkDeviceExtensionSupport(VkPhysicalDevice device)
 	return false;
 }
 
-bool isDeviceSuitable(VkPhysicalDevice device)
+bool isDeviceSuitable(VkPhysicalDevice device, bool headless)
 {
 	//Basic device properties like the name, type and supported Vulkan version can be queried.
 	VkPhysicalDeviceProperties deviceProperties;
@@ -420,8 +529,8 @@ bool isDeviceSuitable(VkPhysicalDevice device)
 	VkPhysicalDeviceFeatures deviceFeatures;
 	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
 
-	//dedicated graphics cards that support geometry shaders.
-	if (deviceProperties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU || !deviceFeatures.geometryShader || !deviceFeatures.samplerAnisotropy)
+	//dedicated graphics cards that support geometry shaders, headless benchmarking also runs on integrated and software devices.
+	if ((!headless && deviceProperties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) || !deviceFeatures.geometryShader || !deviceFeatures.samplerAnisotropy)
 	{
 		return false;
 	}
@@ -429,7 +538,7 @@ bool isDeviceSuitable(VkPhysicalDevice device)
 	vulkan::VulkanDevice::QueueFamilyIndices indices;
 	indices.init(device);
 	//Check extensions support
-	bool extensionsSupported = checkDeviceExtensionSupport(device);
+	bool extensionsSupported = headless || checkDeviceExtensionSupport(device, deviceExtensions);
 
 	return indices.isComplete() && extensionsSupported;
 }
@@ -477,7 +586,7 @@ void VulkanExampleBase::pickPhysicalDevice()
 	int bestScore = 0;
 	for (const auto& device : devices)
 	{
-		if (isDeviceSuitable(device))
+		if (isDeviceSuitable(device, settings.headless))
 		{
 			int score = rateDeviceSuitability(device);
 			if (score > bestScore)
@@ -519,15 +628,40 @@ void VulkanExampleBase::initVulkan()
 	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
 	vkGetPhysicalDeviceFeatures(physicalDevice, &deviceFeatures);
 	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
+	//Vulkan 1.2 features can only be queried and enabled on devices exposing 1.2
+	const bool vulkan12 = deviceProperties.apiVersion >= VK_API_VERSION_1_2;
+	deviceFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	enabledFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	if (vulkan12)
+	{
+		VkPhysicalDeviceFeatures2 deviceFeatures2{};
+		deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		deviceFeatures2.pNext = &deviceFeatures12;
+		vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures2);
+		deviceFeatures12.pNext = nullptr;
+	}
 	//Device creation
 	device = new vulkan::VulkanDevice(physicalDevice);
-	VkPhysicalDeviceFeatures enabledFeatures{};
 	if (deviceFeatures.samplerAnisotropy)
 	{
 		enabledFeatures.samplerAnisotropy = VK_TRUE;
 		enabledFeatures.sampleRateShading = VK_TRUE;
 	}
-	VkResult res = device->createLogicalDevice(enabledFeatures, deviceExtensions);
+	//Scene textures are cooked to BC formats when they can be sampled
+	enabledFeatures.textureCompressionBC = deviceFeatures.textureCompressionBC;
+	//GPU-driven rendering: multi draw indirect with the draw count written by a compute pass
+	enabledFeatures.multiDrawIndirect = deviceFeatures.multiDrawIndirect;
+	enabledFeatures.drawIndirectFirstInstance = deviceFeatures.drawIndirectFirstInstance;
+	enabledFeatures12.drawIndirectCount = deviceFeatures12.drawIndirectCount;
+	//Bindless materials: one runtime sized texture array indexed per material
+	if (deviceFeatures12.runtimeDescriptorArray && deviceFeatures12.shaderSampledImageArrayNonUniformIndexing && deviceFeatures12.descriptorBindingPartiallyBound && deviceFeatures12.descriptorBindingVariableDescriptorCount)
+	{
+		enabledFeatures12.runtimeDescriptorArray = VK_TRUE;
+		enabledFeatures12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		enabledFeatures12.descriptorBindingPartiallyBound = VK_TRUE;
+		enabledFeatures12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+	}
+	VkResult res = device->createLogicalDevice(enabledFeatures, settings.headless ? std::vector<const char*>() : deviceExtensions, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT, vulkan12 ? &enabledFeatures12 : nullptr);
 	if (res != VK_SUCCESS)
 	{
 		std::cerr << "Could not create Vulkan device!" << std::endl;
@@ -550,8 +684,21 @@ void VulkanExampleBase::initVulkan()
 		}
 	}
 	assert(validDepthFormat);
+	//Clamp the requested MSAA sample count to what the device supports for both color and depth
+	VkSampleCountFlags sampleCounts = deviceProperties.limits.framebufferColorSampleCounts & deviceProperties.limits.framebufferDepthSampleCounts;
+	while (settings.sampleCount > VK_SAMPLE_COUNT_1_BIT && !(sampleCounts & settings.sampleCount))
+	{
+		settings.sampleCount = static_cast<VkSampleCountFlagBits>(settings.sampleCount >> 1);
+	}
+	if (settings.sampleCount == VK_SAMPLE_COUNT_1_BIT)
+	{
+		settings.multiSampling = false;
+	}
 
-	swapchain.connect(instance, device);
+	if (!settings.headless)
+	{
+		swapchain.connect(instance, device);
+	}
 }
 
 #if defined(_WIN32)
@@ -853,7 +1000,7 @@ void VulkanExampleBase::setupFrameBuffer()
 		imageCI.samples = settings.sampleCount;
 		imageCI.usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 		imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		device->createImage(imageCI, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, multisampleTarget.depth.image, multisampleTarget.depth.memory);
+		device->createImage(imageCI, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, multisampleTarget.depth.image, multisampleTarget.depth.memory, true);
 		// Create image view for the MSAA target
 		imageViewCI.image = multisampleTarget.depth.image;
 		imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
@@ -936,7 +1083,7 @@ void VulkanExampleBase::windowResize(bool manual)
 	}
 	prepared = false;
 
-	vkDeviceWaitIdle(logicalDevice);
+	device->waitIdle();
 	width = destWidth;
 	height = destHeight;
 	recreateSwapchain();
@@ -944,20 +1091,20 @@ void VulkanExampleBase::windowResize(bool manual)
 	{
 		vkDestroyImageView(logicalDevice, multisampleTarget.color.view, nullptr);
 		vkDestroyImage(logicalDevice, multisampleTarget.color.image, nullptr);
-		vkFreeMemory(logicalDevice, multisampleTarget.color.memory, nullptr);
+		device->freeMemory(multisampleTarget.color.memory);
 		vkDestroyImageView(logicalDevice, multisampleTarget.depth.view, nullptr);
 		vkDestroyImage(logicalDevice, multisampleTarget.depth.image, nullptr);
-		vkFreeMemory(logicalDevice, multisampleTarget.depth.memory, nullptr);
+		device->freeMemory(multisampleTarget.depth.memory);
 	}
 	vkDestroyImageView(logicalDevice, depthStencil.view, nullptr);
 	vkDestroyImage(logicalDevice, depthStencil.image, nullptr);
-	vkFreeMemory(logicalDevice, depthStencil.memory, nullptr);
+	device->freeMemory(depthStencil.memory);
 	for (uint32_t i = 0; i < frameBuffers.size(); i++)
 	{
 		vkDestroyFramebuffer(logicalDevice, frameBuffers[i], nullptr);
 	}
 	setupFrameBuffer();
-	vkDeviceWaitIdle(logicalDevice);
+	device->waitIdle();
 
 	camera.updateAspectRatio((float)width / (float)height);
 	windowResized();
@@ -12,6 +12,7 @@
 #include <glm/glm.hpp>
 #include <sys/stat.h>
 #include "vulkan_swapchain.h"
+#include "benchmark.h"
 #include "keycodes.h"
 #include "camera.h"
 #include "keycodes.h"
@@ -23,7 +24,7 @@ class VulkanExampleBase
 	{
 		VkImage image;
 		VkImageView view;
-		VkDeviceMemory memory;
+		vulkan::Allocation memory;
 	};
 private:
 	float fpsTimer = 0.0f;
@@ -45,6 +46,10 @@ protected:
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 	VkPhysicalDeviceProperties deviceProperties;
 	VkPhysicalDeviceFeatures deviceFeatures;
+	VkPhysicalDeviceVulkan12Features deviceFeatures12{};
+	//Features enabled on the logical device
+	VkPhysicalDeviceFeatures enabledFeatures{};
+	VkPhysicalDeviceVulkan12Features enabledFeatures12{};
 	VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
 	VkDevice logicalDevice;
 	vulkan::VulkanDevice* device;
@@ -54,7 +59,7 @@ protected:
 	VkRenderPass renderPass;
 	std::vector<VkFramebuffer>frameBuffers;
 	uint32_t currentBuffer = 0;
-	VkDescriptorPool descriptorPool;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
 	VkPipelineCache pipelineCache;
 	VulkanSwapchain swapchain;
 	std::string title = "PBR Renderer";
@@ -78,9 +83,39 @@ public:
 		bool vsync = false;
 		bool multiSampling = true;
 		bool SpecularGlossiness = false;
+		//Render offscreen without a window or swapchain and run the frame time benchmark
+		bool headless = false;
+		//Record the scene pass every frame with frustum culling instead of baking it per swapchain image
+		bool perFrameRecording = true;
+		//Cull opaque draws in a compute pass and draw them with vkCmdDrawIndexedIndirectCount where supported
+		bool indirectDrawing = true;
+		//Index all material textures from one descriptor array and read material parameters from a storage buffer
+		bool bindlessMaterials = true;
+		//Reorder scene triangles and vertices at load time for the vertex cache, overdraw and fetch locality
+		bool optimizeMeshes = true;
+		//Lay down the depth of opaque geometry from the position stream before shading it
+		bool depthPrepass = false;
+		//Cook loaded scenes into a binary cache next to the glTF file and load from it while the sources are unchanged
+		bool sceneCache = true;
+		//Megabytes of decoded texture pixels a scene load may hold at once, 0 decodes all images together
+		uint32_t textureBudget = 0;
+		//Encode scene textures to BC formats by material role at load time where the device can sample them
+		bool textureCompression = true;
+		//Keep scene texture coordinates as 32 bit floats instead of unorm16 where they all lie in [0,1]
+		bool floatTexCoords = false;
+		//Split dense triangle lists into meshlets that the GPU-driven path culls one by one
+		bool meshlets = true;
+		//Generate simplified levels of every triangle list at load time and pick one per draw from its projected size
+		bool lods = false;
+		//Largest surface deviation in pixels a simplified level may show
+		float lodThreshold = 1.0f;
+		//Worker threads recording the scene pass, 0 uses one per hardware thread
+		uint32_t recordThreads = 0;
 		VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_8_BIT;
 	} settings;
 
+	Benchmark benchmark;
+
 	ImageInfo depthStencil;
 
 	struct GamePadState
@@ -16,7 +16,7 @@ namespace vkglTF
 	BoundingBox::BoundingBox(glm::vec3 min, glm::vec3 max) : min(min), max(max)
 	{};
 
-	BoundingBox BoundingBox::getAABB(glm::mat4 m)
+	BoundingBox BoundingBox::getAABB(glm::mat4 m) const
 	{
 		glm::vec3 min = glm::vec3(m[3]);
 		glm::vec3 max = min;
@@ -52,70 +52,33 @@ namespace vkglTF
 	}
 	void Texture::destroy()
 	{
+		if (sharedImage)
+		{
+			return;
+		}
 		vkDestroyImageView(device->logicalDevice, imageView, nullptr);
 		vkDestroyImage(device->logicalDevice, image, nullptr);
-		vkFreeMemory(device->logicalDevice, deviceMemory, nullptr);
-		vkDestroySampler(device->logicalDevice, sampler, nullptr);
+		device->freeMemory(deviceMemory);
 	}
 
-	void Texture::LoadFromglTfImage(tinygltf::Image& gltfimage, TextureSampler textureSampler, vulkan::VulkanDevice* device, VkQueue copyQueue)
+	void Texture::createFromPixels(const unsigned char* pixels, uint32_t width, uint32_t height, TextureSampler textureSampler, vulkan::VulkanDevice* device)
 	{
 		this->device = device;
 
-		unsigned char* buffer = nullptr;
-		VkDeviceSize bufferSize = 0;
-		bool deleteBuffer = false;
-		if (gltfimage.component == 3)
-		{
-			//Most devices don't support RGB only on Vulkan so convert if necessary.
-			bufferSize = gltfimage.width * gltfimage.height * 4;
-			buffer = new unsigned char[bufferSize];
-			unsigned char* rgba = buffer;
-			unsigned char* rgb = &gltfimage.image[0];
-			for (int32_t i = 0; i < gltfimage.width * gltfimage.height; ++i)
-			{
-				for (int32_t j = 0; j < 3; ++j)
-				{
-					rgba[j] = rgb[j];
-				}
-				rgba += 4;
-				rgb + 3;
-			}
-			deleteBuffer = true;
-		}
-		else
-		{
-			buffer = &gltfimage.image[0];
-			bufferSize = gltfimage.image.size();
-		}
-
+		//Decoded images are always RGBA, most devices don't support RGB only on Vulkan
 		VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+		const VkDeviceSize bufferSize = VkDeviceSize(width) * height * 4;
 
 		VkFormatProperties formatProperties;
 
-		width = gltfimage.width;
-		height = gltfimage.height;
+		this->width = width;
+		this->height = height;
 		mipLevels = static_cast<uint32_t>(floor(log2(std::max(width, height))) + 1.0f);
 
 		vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
 		assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
 		assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
 
-		VkMemoryAllocateInfo memAllocInfo{};
-		memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
-
-		device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, bufferSize, &stagingBuffer, &stagingMemory);
-
-		//Copy texture data into staging buffer.
-		VkMemoryRequirements memReqs;
-		vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-
-		uint8_t* data;
-		VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-		memcpy(data, buffer, bufferSize);
-		vkUnmapMemory(device->logicalDevice, stagingMemory);
 		//Create image
 		VkImageCreateInfo imageCreateInfo{};
 		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -132,75 +95,150 @@ namespace vkglTF
 		imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 
 		device->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, deviceMemory);
-		//Create command buffer
-		VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
-		//Begin record command
-		device->beginCommandBuffer(copyCmd);
-		//Record command buffer
-		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
-
-		device->recordTransitionImageLayout(copyCmd, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
-		//Copying.
-		VkBufferImageCopy bufferCopyRegion = {};
-		bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		bufferCopyRegion.imageSubresource.mipLevel = 0;
-		bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
-		bufferCopyRegion.imageSubresource.layerCount = 1;
-		bufferCopyRegion.imageExtent.width = width;
-		bufferCopyRegion.imageExtent.height = height;
-		bufferCopyRegion.imageExtent.depth = 1;
-
-		vkCmdCopyBufferToImage(
-			copyCmd, 
-			stagingBuffer, 
-			image, 
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1, 
-			&bufferCopyRegion);
-
-		device->recordTransitionImageLayout(copyCmd, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange);
-
-		device->flushCommandBuffer(copyCmd, copyQueue);
-
-		vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-		vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
-
-		//Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
-		VkCommandBuffer blitCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
-		device->beginCommandBuffer(blitCmd);
-
-		for (uint32_t i = 1; i < mipLevels; i++) {
-			VkImageBlit imageBlit{};
-
-			imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageBlit.srcSubresource.layerCount = 1;
-			imageBlit.srcSubresource.mipLevel = i - 1;
-			imageBlit.srcOffsets[1].x = int32_t(width >> (i - 1));
-			imageBlit.srcOffsets[1].y = int32_t(height >> (i - 1));
-			imageBlit.srcOffsets[1].z = 1;
-
-			imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageBlit.dstSubresource.layerCount = 1;
-			imageBlit.dstSubresource.mipLevel = i;
-			imageBlit.dstOffsets[1].x = int32_t(width >> i);
-			imageBlit.dstOffsets[1].y = int32_t(height >> i);
-			imageBlit.dstOffsets[1].z = 1;
-
-			VkImageSubresourceRange mipSubRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1};
-			device->recordTransitionImageLayout(blitCmd, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipSubRange);
-
-			vkCmdBlitImage(blitCmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
-
-			device->recordTransitionImageLayout(blitCmd, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, mipSubRange);
-		}
-
-		subresourceRange.levelCount = mipLevels;
+		//Pixels go straight into the staging ring, copy and mip chain are submitted with whatever else is pending
+		device->staging->upload(bufferSize, [&](const vulkan::StagingRing::Region& region)
+		{
+			memcpy(region.mapped, pixels, bufferSize);
+			VkCommandBuffer copyCmd = region.commandBuffer;
+			VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+			device->recordTransitionImageLayout(copyCmd, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+			//Copying.
+			VkBufferImageCopy bufferCopyRegion = {};
+			bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			bufferCopyRegion.imageSubresource.mipLevel = 0;
+			bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
+			bufferCopyRegion.imageSubresource.layerCount = 1;
+			bufferCopyRegion.imageExtent.width = width;
+			bufferCopyRegion.imageExtent.height = height;
+			bufferCopyRegion.imageExtent.depth = 1;
+			bufferCopyRegion.bufferOffset = region.offset;
+
+			vkCmdCopyBufferToImage(
+				copyCmd, 
+				region.buffer, 
+				image, 
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				1, 
+				&bufferCopyRegion);
+
+			//Blits need a graphics queue, the copied base level moves over to it as the first blit source.
+			//Without a fence wait between copy and blits every level has to be made readable for the next blit
+			device->staging->transferOwnership(region, image, subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+			copyCmd = region.graphicsCommandBuffer;
+
+			//Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
+			for (uint32_t i = 1; i < mipLevels; i++) {
+				VkImageBlit imageBlit{};
+
+				imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				imageBlit.srcSubresource.layerCount = 1;
+				imageBlit.srcSubresource.mipLevel = i - 1;
+				imageBlit.srcOffsets[1].x = int32_t(width >> (i - 1));
+				imageBlit.srcOffsets[1].y = int32_t(height >> (i - 1));
+				imageBlit.srcOffsets[1].z = 1;
+
+				imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				imageBlit.dstSubresource.layerCount = 1;
+				imageBlit.dstSubresource.mipLevel = i;
+				imageBlit.dstOffsets[1].x = int32_t(width >> i);
+				imageBlit.dstOffsets[1].y = int32_t(height >> i);
+				imageBlit.dstOffsets[1].z = 1;
+
+				VkImageSubresourceRange mipSubRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1};
+				device->recordTransitionImageLayout(copyCmd, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipSubRange);
+
+				vkCmdBlitImage(copyCmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
+
+				device->recordTransitionImageLayout(copyCmd, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, mipSubRange, VK_ACCESS_TRANSFER_READ_BIT);
+			}
+
+			subresourceRange.levelCount = mipLevels;
+			device->recordTransitionImageLayout(copyCmd, image, format, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange, VK_ACCESS_SHADER_READ_BIT);
+		});
+		imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		createSamplerAndView(textureSampler, format);
+	}
+
+	static VkFormat encodingFormat(TextureEncoding encoding)
+	{
+		switch (encoding)
+		{
+		case TextureEncoding::BC1:
+			return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case TextureEncoding::BC4:
+			return VK_FORMAT_BC4_UNORM_BLOCK;
+		case TextureEncoding::BC5:
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		case TextureEncoding::BC7:
+			return VK_FORMAT_BC7_UNORM_BLOCK;
+		default:
+			return VK_FORMAT_R8G8B8A8_UNORM;
+		}
+	}
+
+	void Texture::createFromMipChain(const unsigned char* mips, uint32_t width, uint32_t height, uint32_t mipLevels, TextureSampler textureSampler, vulkan::VulkanDevice* device, TextureEncoding encoding)
+	{
+		this->device = device;
+		this->width = width;
+		this->height = height;
+		this->mipLevels = mipLevels;
+		this->encoding = encoding;
+
+		const VkFormat format = encodingFormat(encoding);
+		VkImageCreateInfo imageCreateInfo{};
+		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageCreateInfo.format = format;
+		imageCreateInfo.mipLevels = mipLevels;
+		imageCreateInfo.arrayLayers = 1;
+		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageCreateInfo.extent = { width, height, 1 };
+		imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		device->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, deviceMemory);
+
+		std::vector<VkBufferImageCopy> copyRegions(mipLevels);
+		VkDeviceSize bufferSize = 0;
+		for (uint32_t i = 0; i < mipLevels; i++)
+		{
+			VkBufferImageCopy& copyRegion = copyRegions[i];
+			copyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1 };
+			copyRegion.imageExtent = { std::max(1u, width >> i), std::max(1u, height >> i), 1 };
+			copyRegion.bufferOffset = bufferSize;
+			//Levels smaller than a block still take a whole one
+			bufferSize += encodedSize(encoding, copyRegion.imageExtent.width, copyRegion.imageExtent.height);
+		}
+
+		//Every level is copied, no blits, so the whole texture can stay on the transfer queue
+		device->staging->upload(bufferSize, [&](const vulkan::StagingRing::Region& region)
+		{
+			memcpy(region.mapped, mips, bufferSize);
+			VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+			device->recordTransitionImageLayout(region.commandBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+			for (VkBufferImageCopy& copyRegion : copyRegions)
+			{
+				copyRegion.bufferOffset += region.offset;
+			}
+			vkCmdCopyBufferToImage(region.commandBuffer, region.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, copyRegions.data());
+			device->staging->transferOwnership(region, image, subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		});
 		imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		createSamplerAndView(textureSampler, format);
+	}
 
-		device->recordTransitionImageLayout(blitCmd, image, format, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
+	void Texture::shareImage(const Texture& owner, TextureSampler textureSampler)
+	{
+		*this = owner;
+		sharedImage = true;
+		createSampler(textureSampler);
+		updateDescriptor();
+	}
 
-		device->flushCommandBuffer(blitCmd, copyQueue, true);
-		//Create sampler
+	void Texture::createSampler(TextureSampler textureSampler)
+	{
 		VkSamplerCreateInfo samplerInfo{};
 		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 		samplerInfo.magFilter = textureSampler.magFilter;
@@ -214,7 +252,12 @@ namespace vkglTF
 		samplerInfo.maxLod = (float)mipLevels;
 		samplerInfo.maxAnisotropy = device->enabledFeatures.samplerAnisotropy ? device->properties.limits.maxSamplerAnisotropy : 1.0f;
 		samplerInfo.anisotropyEnable = VK_TRUE;
-		VK_CHECK_RESULT(vkCreateSampler(device->logicalDevice, &samplerInfo, nullptr, &sampler));
+		sampler = device->getSampler(samplerInfo);
+	}
+
+	void Texture::createSamplerAndView(TextureSampler textureSampler, VkFormat format)
+	{
+		createSampler(textureSampler);
 		//Create image view
 		VkImageViewCreateInfo viewInfo{};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -230,9 +273,6 @@ namespace vkglTF
 		descriptor.sampler = sampler;
 		descriptor.imageView = imageView;
 		descriptor.imageLayout = imageLayout;
-
-		if (deleteBuffer)
-			delete[] buffer;
 	}
 
 	//Primitive
@@ -249,19 +289,13 @@ namespace vkglTF
 	}
 
 	//Mesh
-	Mesh::Mesh(vulkan::VulkanDevice* device, glm::mat4 matrix)
+	Mesh::Mesh(glm::mat4 matrix)
 	{
-		this->device = device;
-		this->uniformBlock.matrix = matrix;
-		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, sizeof(uniformBlock), &uniformBuffer.buffer, &uniformBuffer.memory, &uniformBlock));
-		VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, uniformBuffer.memory, 0, sizeof(uniformBlock), 0, &uniformBuffer.mapped));
-		uniformBuffer.descriptor = { uniformBuffer.buffer, 0, sizeof(uniformBlock) };
+		this->matrix = matrix;
 	}
 
 	Mesh::~Mesh()
 	{
-		vkDestroyBuffer(device->logicalDevice, uniformBuffer.buffer, nullptr);
-		vkFreeMemory(device->logicalDevice, uniformBuffer.memory, nullptr);
 		for (Primitive* p : primitives)
 			delete p;
 	}
@@ -296,25 +330,19 @@ namespace vkglTF
 		if (mesh)
 		{
 			glm::mat4 m = getMatrix();
+			mesh->matrix = m;
 			if (skin)
 			{
-				mesh->uniformBlock.matrix = m;
 				// Update join matrices
 				glm::mat4 inverseTranform = glm::inverse(m);
-				size_t numJoints = std::min((uint32_t)skin->joints.size(), MAX_NUM_JOINTS);
-				for (size_t i = 0; i < numJoints; i++)
+				mesh->jointMatrices.resize(skin->joints.size());
+				for (size_t i = 0; i < skin->joints.size(); i++)
 				{
 					Node* jointNode = skin->joints[i];
 					glm::mat4 jointMat = jointNode->getMatrix() * skin->inverseBindMatrices[i];
 					jointMat = inverseTranform * jointMat;
-					mesh->uniformBlock.jointMatrix[i] = jointMat;
+					mesh->jointMatrices[i] = jointMat;
 				}
-				mesh->uniformBlock.jointcount = (float)numJoints;
-				memcpy(mesh->uniformBuffer.mapped, &mesh->uniformBlock, sizeof(mesh->uniformBlock));
-			}
-			else
-			{
-				memcpy(mesh->uniformBuffer.mapped, &m, sizeof(glm::mat4));
 			}
 		}
 
@@ -335,6 +363,227 @@ namespace vkglTF
 			delete child;
 		}
 	}
+	//Vertex layout
+
+	//Octahedral mapping of a unit vector onto [-1, 1]^2, zero or invalid normals map to +Z
+	static glm::vec2 octEncode(glm::vec3 n)
+	{
+		const float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		if (!(sum > 0.0f))
+		{
+			return glm::vec2(0.0f);
+		}
+		n /= sum;
+		glm::vec2 e(n.x, n.y);
+		if (n.z < 0.0f)
+		{
+			e.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+			e.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		return e;
+	}
+
+	//Unorm16 steps by 1/65535 over [0,1], NaNs and tiled coordinates fail the test
+	static bool isUnitTexCoord(glm::vec2 uv)
+	{
+		return uv.x >= 0.0f && uv.x <= 1.0f && uv.y >= 0.0f && uv.y <= 1.0f;
+	}
+
+	static void packTexCoord(VkFormat format, glm::vec2 uv, uint8_t* dst)
+	{
+		if (format == VK_FORMAT_R16G16_UNORM)
+		{
+			const uint32_t packed = glm::packUnorm2x16(uv);
+			memcpy(dst, &packed, sizeof(packed));
+		}
+		else
+		{
+			memcpy(dst, &uv, sizeof(uv));
+		}
+	}
+
+	Model::VertexLayout::VertexLayout(const bool used[ATTRIBUTE_COUNT], uint32_t maxJoint, const bool unormTexCoords[2])
+	{
+		const bool wideJoints = maxJoint > 255;
+		formats[POSITION] = VK_FORMAT_R32G32B32_SFLOAT;
+		formats[NORMAL] = VK_FORMAT_R16G16_SNORM;
+		formats[UV0] = unormTexCoords[0] ? VK_FORMAT_R16G16_UNORM : VK_FORMAT_R32G32_SFLOAT;
+		formats[UV1] = unormTexCoords[1] ? VK_FORMAT_R16G16_UNORM : VK_FORMAT_R32G32_SFLOAT;
+		formats[JOINT0] = wideJoints ? VK_FORMAT_R16G16B16A16_UINT : VK_FORMAT_R8G8B8A8_UINT;
+		formats[WEIGHT0] = VK_FORMAT_R16G16B16A16_UNORM;
+		formats[COLOR0] = VK_FORMAT_R8G8B8A8_UNORM;
+		const uint32_t sizes[ATTRIBUTE_COUNT] = { 12, 4, unormTexCoords[0] ? 4u : 8u, unormTexCoords[1] ? 4u : 8u, wideJoints ? 8u : 4u, 8, 4 };
+		const uint32_t attributeStreams[ATTRIBUTE_COUNT] = { STREAM_POSITION, STREAM_ATTRIBUTES, STREAM_ATTRIBUTES, STREAM_ATTRIBUTES, STREAM_SKINNING, STREAM_SKINNING, STREAM_ATTRIBUTES };
+		//Constant block: +Z normal, zero UVs and joints, full first weight, white
+		const uint32_t constantOffsets[ATTRIBUTE_COUNT] = { 0, 0, 4, 4, 8, 16, 24 };
+
+		for (uint32_t i = 0; i < ATTRIBUTE_COUNT; i++)
+		{
+			present[i] = i == POSITION || used[i];
+			if (present[i])
+			{
+				streams[i] = attributeStreams[i];
+				offsets[i] = strides[streams[i]];
+				strides[streams[i]] += sizes[i];
+			}
+			else
+			{
+				streams[i] = STREAM_CONSTANTS;
+				offsets[i] = constantOffsets[i];
+			}
+		}
+	}
+
+	uint32_t Model::VertexLayout::stride() const
+	{
+		uint32_t total = 0;
+		for (uint32_t i = 0; i < STREAM_COUNT; i++)
+		{
+			total += strides[i];
+		}
+		return total;
+	}
+
+	VkDeviceSize Model::VertexLayout::streamOffsets(size_t count, VkDeviceSize offsets[STREAM_COUNT]) const
+	{
+		VkDeviceSize size = 0;
+		for (uint32_t i = 0; i < STREAM_CONSTANTS; i++)
+		{
+			offsets[i] = size;
+			size = (size + count * strides[i] + STREAM_ALIGNMENT - 1) & ~(STREAM_ALIGNMENT - 1);
+		}
+		//Empty streams are never read but still need an offset inside the buffer
+		for (uint32_t i = 0; i < STREAM_CONSTANTS; i++)
+		{
+			if (strides[i] == 0)
+			{
+				offsets[i] = size;
+			}
+		}
+		offsets[STREAM_CONSTANTS] = size;
+		return size + CONSTANT_BLOCK_SIZE;
+	}
+
+	void Model::VertexLayout::pack(const Vertex* vertices, size_t count, uint8_t* dst) const
+	{
+		VkDeviceSize streamStarts[STREAM_COUNT];
+		streamOffsets(count, streamStarts);
+		for (uint32_t i = 0; i < STREAM_COUNT; i++)
+		{
+			packStream(i, vertices, i == STREAM_CONSTANTS ? 1 : count, dst + streamStarts[i]);
+		}
+	}
+
+	void Model::VertexLayout::packStream(uint32_t stream, const Vertex* vertices, size_t count, uint8_t* dst) const
+	{
+		if (stream == STREAM_CONSTANTS)
+		{
+			memset(dst, 0, CONSTANT_BLOCK_SIZE);
+			const uint16_t firstWeight = 0xFFFF;
+			memcpy(dst + 16, &firstWeight, sizeof(firstWeight));
+			memset(dst + 24, 0xFF, 4);
+			return;
+		}
+		for (size_t v = 0; v < count; v++)
+		{
+			const Vertex& vertex = vertices[v];
+			uint8_t* out = dst + v * strides[stream];
+			if (streams[POSITION] == stream)
+			{
+				memcpy(out + offsets[POSITION], &vertex.pos, sizeof(glm::vec3));
+			}
+			if (present[NORMAL] && streams[NORMAL] == stream)
+			{
+				const uint32_t normal = glm::packSnorm2x16(octEncode(vertex.normal));
+				memcpy(out + offsets[NORMAL], &normal, sizeof(normal));
+			}
+			if (present[UV0] && streams[UV0] == stream)
+			{
+				packTexCoord(formats[UV0], vertex.uv0, out + offsets[UV0]);
+			}
+			if (present[UV1] && streams[UV1] == stream)
+			{
+				packTexCoord(formats[UV1], vertex.uv1, out + offsets[UV1]);
+			}
+			if (present[JOINT0] && streams[JOINT0] == stream)
+			{
+				if (formats[JOINT0] == VK_FORMAT_R16G16B16A16_UINT)
+				{
+					const glm::u16vec4 joints(vertex.joint0);
+					memcpy(out + offsets[JOINT0], &joints, sizeof(joints));
+				}
+				else
+				{
+					const glm::u8vec4 joints(vertex.joint0);
+					memcpy(out + offsets[JOINT0], &joints, sizeof(joints));
+				}
+			}
+			if (present[WEIGHT0] && streams[WEIGHT0] == stream)
+			{
+				const uint64_t weights = glm::packUnorm4x16(vertex.weight0);
+				memcpy(out + offsets[WEIGHT0], &weights, sizeof(weights));
+			}
+			if (present[COLOR0] && streams[COLOR0] == stream)
+			{
+				const uint32_t color = glm::packUnorm4x8(vertex.color);
+				memcpy(out + offsets[COLOR0], &color, sizeof(color));
+			}
+		}
+	}
+
+	std::vector<VkVertexInputAttributeDescription> Model::VertexLayout::attributeDescriptions(uint32_t attributeMask) const
+	{
+		std::vector<VkVertexInputAttributeDescription> descriptions;
+		for (uint32_t i = 0; i < ATTRIBUTE_COUNT; i++)
+		{
+			if (attributeMask & (1u << i))
+			{
+				descriptions.push_back({ i, streams[i], formats[i], offsets[i] });
+			}
+		}
+		return descriptions;
+	}
+
+	std::vector<VkVertexInputBindingDescription> Model::VertexLayout::bindingDescriptions(uint32_t attributeMask) const
+	{
+		bool used[STREAM_COUNT] = {};
+		for (uint32_t i = 0; i < ATTRIBUTE_COUNT; i++)
+		{
+			if (attributeMask & (1u << i))
+			{
+				used[streams[i]] = true;
+			}
+		}
+		std::vector<VkVertexInputBindingDescription> descriptions;
+		for (uint32_t i = 0; i < STREAM_COUNT; i++)
+		{
+			if (used[i])
+			{
+				descriptions.push_back({ i, strides[i], VK_VERTEX_INPUT_RATE_VERTEX });
+			}
+		}
+		return descriptions;
+	}
+
+	bool Model::VertexLayout::operator==(const VertexLayout& other) const
+	{
+		for (uint32_t i = 0; i < ATTRIBUTE_COUNT; i++)
+		{
+			if (present[i] != other.present[i] || formats[i] != other.formats[i] || streams[i] != other.streams[i] || offsets[i] != other.offsets[i])
+			{
+				return false;
+			}
+		}
+		for (uint32_t i = 0; i < STREAM_COUNT; i++)
+		{
+			if (strides[i] != other.strides[i])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
 	//Model
 
 	void Model::destroy(VkDevice device)
@@ -342,13 +591,13 @@ namespace vkglTF
 		if (vertices.buffer != VK_NULL_HANDLE)
 		{
 			vkDestroyBuffer(device, vertices.buffer, nullptr);
-			vkFreeMemory(device, vertices.memory, nullptr);
+			this->device->freeMemory(vertices.memory);
 			vertices.buffer = VK_NULL_HANDLE;
 		}
 		if (indices.buffer != VK_NULL_HANDLE)
 		{
 			vkDestroyBuffer(device, indices.buffer, nullptr);
-			vkFreeMemory(device, indices.memory, nullptr);
+			this->device->freeMemory(indices.memory);
 			indices.buffer = VK_NULL_HANDLE;
 		}
 		for (auto texture : textures)
@@ -366,6 +615,8 @@ namespace vkglTF
 		nodes.resize(0);
 		linearNodes.resize(0);
 		extensions.resize(0);
+		drawList.clear();
+		matrixCount = 0;
 		for (auto skin : skins)
 		{
 			delete skin;
@@ -419,7 +670,7 @@ namespace vkglTF
 		if (node.mesh > -1)
 		{
 			const tinygltf::Mesh mesh = model.meshes[node.mesh];
-			Mesh* newMesh = new Mesh(device, newNode->matrix);
+			Mesh* newMesh = new Mesh(newNode->matrix);
 			for (size_t j = 0; j < mesh.primitives.size(); j++)
 			{
 				const tinygltf::Primitive& primitive = mesh.primitives[j];
@@ -446,6 +697,7 @@ namespace vkglTF
 					int uv0ByteStride;
 					int uv1ByteStride;
 					int color0ByteStride;
+					int color0Components = 4;
 					int jointByteStride;
 					int weightByteStride;
 
@@ -456,7 +708,7 @@ namespace vkglTF
 
 					const tinygltf::Accessor& posAccessor = model.accessors[primitive.attributes.find("POSITION")->second];
 					const tinygltf::BufferView& posView = model.bufferViews[posAccessor.bufferView];
-					bufferPos = reinterpret_cast<const float*>(&(model.buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
+					bufferPos = reinterpret_cast<const float*>(loaderInfo.bufferData[posView.buffer] + posAccessor.byteOffset + posView.byteOffset);
 					posMin = glm::vec3(posAccessor.minValues[0], posAccessor.minValues[1], posAccessor.minValues[2]);
 					posMax = glm::vec3(posAccessor.maxValues[0], posAccessor.maxValues[1], posAccessor.maxValues[2]);
 					vertexCount = static_cast<uint32_t>(posAccessor.count);
@@ -466,7 +718,7 @@ namespace vkglTF
 					{
 						const tinygltf::Accessor& normAccessor = model.accessors[primitive.attributes.find("NORMAL")->second];
 						const tinygltf::BufferView& normView = model.bufferViews[normAccessor.bufferView];
-						bufferNormals = reinterpret_cast<const float*>(&(model.buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
+						bufferNormals = reinterpret_cast<const float*>(loaderInfo.bufferData[normView.buffer] + normAccessor.byteOffset + normView.byteOffset);
 						normByteStride = normAccessor.ByteStride(normView) ? (normAccessor.ByteStride(normView) / sizeof(float)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC3);
 					}
 
@@ -475,14 +727,14 @@ namespace vkglTF
 					{
 						const tinygltf::Accessor& uvAccessor = model.accessors[primitive.attributes.find("TEXCOORD_0")->second];
 						const tinygltf::BufferView& uvView = model.bufferViews[uvAccessor.bufferView];
-						bufferTexCoordSet0 = reinterpret_cast<const float*>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
+						bufferTexCoordSet0 = reinterpret_cast<const float*>(loaderInfo.bufferData[uvView.buffer] + uvAccessor.byteOffset + uvView.byteOffset);
 						uv0ByteStride = uvAccessor.ByteStride(uvView) ? (uvAccessor.ByteStride(uvView) / sizeof(float)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC2);
 					}
 					if (primitive.attributes.find("TEXCOORD_1") != primitive.attributes.end())
 					{
 						const tinygltf::Accessor& uvAccessor = model.accessors[primitive.attributes.find("TEXCOORD_1")->second];
 						const tinygltf::BufferView& uvView = model.bufferViews[uvAccessor.bufferView];
-						bufferTexCoordSet1 = reinterpret_cast<const float*>(&(model.buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
+						bufferTexCoordSet1 = reinterpret_cast<const float*>(loaderInfo.bufferData[uvView.buffer] + uvAccessor.byteOffset + uvView.byteOffset);
 						uv1ByteStride = uvAccessor.ByteStride(uvView) ? (uvAccessor.ByteStride(uvView) / sizeof(float)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC2);
 					}
 
@@ -491,8 +743,9 @@ namespace vkglTF
 					{
 						const tinygltf::Accessor& accessor = model.accessors[primitive.attributes.find("COLOR_0")->second];
 						const tinygltf::BufferView& view = model.bufferViews[accessor.bufferView];
-						bufferColorSet0 = reinterpret_cast<const float*>(&(model.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-						color0ByteStride = accessor.ByteStride(view) ? (accessor.ByteStride(view) / sizeof(float)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC3);
+						bufferColorSet0 = reinterpret_cast<const float*>(loaderInfo.bufferData[view.buffer] + accessor.byteOffset + view.byteOffset);
+						color0Components = tinygltf::GetNumComponentsInType(accessor.type);
+						color0ByteStride = accessor.ByteStride(view) ? (accessor.ByteStride(view) / sizeof(float)) : color0Components;
 					}
 
 					// Skinning
@@ -501,7 +754,7 @@ namespace vkglTF
 					{
 						const tinygltf::Accessor& jointAccessor = model.accessors[primitive.attributes.find("JOINTS_0")->second];
 						const tinygltf::BufferView& jointView = model.bufferViews[jointAccessor.bufferView];
-						bufferJoints = &(model.buffers[jointView.buffer].data[jointAccessor.byteOffset + jointView.byteOffset]);
+						bufferJoints = loaderInfo.bufferData[jointView.buffer] + jointAccessor.byteOffset + jointView.byteOffset;
 						jointComponentType = jointAccessor.componentType;
 						jointByteStride = jointAccessor.ByteStride(jointView) ? (jointAccessor.ByteStride(jointView) / tinygltf::GetComponentSizeInBytes(jointComponentType)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC4);
 					}
@@ -510,12 +763,19 @@ namespace vkglTF
 					{
 						const tinygltf::Accessor& weightAccessor = model.accessors[primitive.attributes.find("WEIGHTS_0")->second];
 						const tinygltf::BufferView& weightView = model.bufferViews[weightAccessor.bufferView];
-						bufferWeights = reinterpret_cast<const float*>(&(model.buffers[weightView.buffer].data[weightAccessor.byteOffset + weightView.byteOffset]));
+						bufferWeights = reinterpret_cast<const float*>(loaderInfo.bufferData[weightView.buffer] + weightAccessor.byteOffset + weightView.byteOffset);
 						weightByteStride = weightAccessor.ByteStride(weightView) ? (weightAccessor.ByteStride(weightView) / sizeof(float)) : tinygltf::GetNumComponentsInType(TINYGLTF_TYPE_VEC4);
 					}
 
 					hasSkin = (bufferJoints && bufferWeights);
 
+					loaderInfo.usedAttributes[VertexLayout::NORMAL] |= bufferNormals != nullptr;
+					loaderInfo.usedAttributes[VertexLayout::UV0] |= bufferTexCoordSet0 != nullptr;
+					loaderInfo.usedAttributes[VertexLayout::UV1] |= bufferTexCoordSet1 != nullptr;
+					loaderInfo.usedAttributes[VertexLayout::JOINT0] |= hasSkin;
+					loaderInfo.usedAttributes[VertexLayout::WEIGHT0] |= hasSkin;
+					loaderInfo.usedAttributes[VertexLayout::COLOR0] |= bufferColorSet0 != nullptr;
+
 					for (size_t v = 0; v < posAccessor.count; v++)
 					{
 						Vertex& vert = loaderInfo.vertexBuffer[loaderInfo.vertexPos];
@@ -523,7 +783,14 @@ namespace vkglTF
 						vert.normal = glm::normalize(glm::vec3(bufferNormals ? glm::make_vec3(&bufferNormals[v * normByteStride]) : glm::vec3(0.0f)));
 						vert.uv0 = bufferTexCoordSet0 ? glm::make_vec2(&bufferTexCoordSet0[v * uv0ByteStride]) : glm::vec3(0.0f);
 						vert.uv1 = bufferTexCoordSet1 ? glm::make_vec2(&bufferTexCoordSet1[v * uv1ByteStride]) : glm::vec3(0.0f);
-						vert.color = bufferColorSet0 ? glm::make_vec4(&bufferColorSet0[v * color0ByteStride]) : glm::vec4(1.0f);
+						loaderInfo.unitTexCoords[0] = loaderInfo.unitTexCoords[0] && isUnitTexCoord(vert.uv0);
+						loaderInfo.unitTexCoords[1] = loaderInfo.unitTexCoords[1] && isUnitTexCoord(vert.uv1);
+						vert.color = glm::vec4(1.0f);
+						if (bufferColorSet0)
+						{
+							//RGB colors must not read the next vertex as alpha
+							vert.color = color0Components == 3 ? glm::vec4(glm::make_vec3(&bufferColorSet0[v * color0ByteStride]), 1.0f) : glm::make_vec4(&bufferColorSet0[v * color0ByteStride]);
+						}
 
 						if (hasSkin)
 						{
@@ -549,6 +816,8 @@ namespace vkglTF
 						{
 							vert.joint0 = glm::vec4(0.0f);
 						}
+						const glm::vec4 joint = glm::max(vert.joint0, glm::vec4(0.0f));
+						loaderInfo.maxJoint = std::max(loaderInfo.maxJoint, static_cast<uint32_t>(std::max(std::max(joint.x, joint.y), std::max(joint.z, joint.w))));
 						vert.weight0 = hasSkin ? glm::make_vec4(&bufferWeights[v * weightByteStride]) : glm::vec4(0.0f);
 						// Fix for all zero weights
 						if (glm::length(vert.weight0) == 0.0f)
@@ -563,10 +832,9 @@ namespace vkglTF
 				{
 					const tinygltf::Accessor& accessor = model.accessors[primitive.indices > -1 ? primitive.indices : 0];
 					const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
-					const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
 
 					indexCount = static_cast<uint32_t>(accessor.count);
-					const void* dataPtr = &(buffer.data[accessor.byteOffset + bufferView.byteOffset]);
+					const void* dataPtr = loaderInfo.bufferData[bufferView.buffer] + accessor.byteOffset + bufferView.byteOffset;
 
 					switch (accessor.componentType)
 					{
@@ -574,7 +842,7 @@ namespace vkglTF
 						const uint32_t* buf = static_cast<const uint32_t*>(dataPtr);
 						for (size_t index = 0; index < accessor.count; index++)
 						{
-							loaderInfo.indexBuffer[loaderInfo.indexPos] = buf[index] + vertexStart;
+							loaderInfo.indexBuffer[loaderInfo.indexPos] = buf[index];
 							loaderInfo.indexPos++;
 						}
 						break;
@@ -583,7 +851,7 @@ namespace vkglTF
 						const uint16_t* buf = static_cast<const uint16_t*>(dataPtr);
 						for (size_t index = 0; index < accessor.count; index++)
 						{
-							loaderInfo.indexBuffer[loaderInfo.indexPos] = buf[index] + vertexStart;
+							loaderInfo.indexBuffer[loaderInfo.indexPos] = buf[index];
 							loaderInfo.indexPos++;
 						}
 						break;
@@ -592,7 +860,7 @@ namespace vkglTF
 						const uint8_t* buf = static_cast<const uint8_t*>(dataPtr);
 						for (size_t index = 0; index < accessor.count; index++)
 						{
-							loaderInfo.indexBuffer[loaderInfo.indexPos] = buf[index] + vertexStart;
+							loaderInfo.indexBuffer[loaderInfo.indexPos] = buf[index];
 							loaderInfo.indexPos++;
 						}
 						break;
@@ -603,7 +871,12 @@ namespace vkglTF
 					}
 				}
 				Primitive* newPrimitive = new Primitive(indexStart, indexCount, vertexCount, primitive.material > -1 ? materials[primitive.material] : materials.back());
+				newPrimitive->firstVertex = vertexStart;
 				newPrimitive->setBoundingBox(posMin, posMax);
+				if (hasIndices && primitive.mode == TINYGLTF_MODE_TRIANGLES && indexCount >= 3)
+				{
+					loaderInfo.triangleLists.push_back({ indexStart, indexCount, vertexStart, vertexCount, newPrimitive, {} });
+				}
 				newMesh->primitives.push_back(newPrimitive);
 			}
 			// Mesh BB from BBs of primitives
@@ -630,6 +903,139 @@ namespace vkglTF
 		linearNodes.push_back(newNode);
 	}
 
+	//Vertex cache, overdraw and fetch optimization, meshlets and LOD generation of every triangle list, spread over one worker per hardware thread
+	void Model::optimizePrimitives(LoaderInfo& loaderInfo)
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+		std::vector<LoaderInfo::TriangleList>& lists = loaderInfo.triangleLists;
+		std::vector<VertexCacheStats> before(lists.size());
+		std::vector<VertexCacheStats> after(lists.size());
+		std::vector<uint8_t> optimized(lists.size(), 0);
+		const uint32_t threadCount = std::max(1u, std::min(std::thread::hardware_concurrency(), static_cast<uint32_t>(lists.size())));
+		if (!lists.empty())
+		{
+			ThreadPool optimizePool;
+			optimizePool.setThreadCount(threadCount);
+			for (uint32_t t = 0; t < threadCount; t++)
+			{
+				optimizePool.threads[t]->addJob([this, &loaderInfo, &lists, &before, &after, &optimized, t, threadCount]
+				{
+					std::vector<uint32_t> indices;
+					std::vector<uint32_t> lodIndices;
+					std::vector<glm::vec3> positions;
+					for (size_t i = t; i < lists.size(); i += threadCount)
+					{
+						LoaderInfo::TriangleList& list = lists[i];
+						Vertex* vertices = loaderInfo.vertexBuffer + list.firstVertex;
+						//A primitive reaching outside its own vertices is left alone
+						indices.assign(loaderInfo.indexBuffer + list.firstIndex, loaderInfo.indexBuffer + list.firstIndex + list.indexCount);
+						if (*std::max_element(indices.begin(), indices.end()) >= list.vertexCount)
+						{
+							continue;
+						}
+
+						before[i] = analyzeVertexCache(indices.data(), indices.size(), list.vertexCount);
+						positions.resize(list.vertexCount);
+						for (uint32_t v = 0; v < list.vertexCount; v++)
+						{
+							positions[v] = vertices[v].pos;
+						}
+						if (optimizeMeshes)
+						{
+							optimizeVertexCache(indices.data(), indices.size(), list.vertexCount);
+							optimizeOverdraw(indices.data(), indices.size(), positions.data(), list.vertexCount);
+							optimizeVertexFetch(indices.data(), indices.size(), vertices, list.vertexCount);
+							//Fetch optimization reorders the vertices
+							for (uint32_t v = 0; v < list.vertexCount; v++)
+							{
+								positions[v] = vertices[v].pos;
+							}
+						}
+						after[i] = analyzeVertexCache(indices.data(), indices.size(), list.vertexCount);
+						std::copy(indices.begin(), indices.end(), loaderInfo.indexBuffer + list.firstIndex);
+						optimized[i] = 1;
+
+						if (generateMeshlets && list.indexCount / 3 >= MESHLET_MIN_TRIANGLES)
+						{
+							list.primitive->meshlets = buildMeshlets(indices.data(), indices.size(), positions.data(), list.vertexCount);
+						}
+
+						//Each level halves the previous one, errors add up since every level is simplified from the last
+						if (generateLods && list.indexCount >= LOD_MIN_TRIANGLES * 6)
+						{
+							float error = 0.0f;
+							for (uint32_t level = 0; level < MAX_LODS; level++)
+							{
+								const size_t sourceCount = indices.size();
+								lodIndices.resize(sourceCount);
+								float levelError = 0.0f;
+								const size_t count = simplifyMesh(lodIndices.data(), indices.data(), sourceCount, positions.data(), list.vertexCount, sourceCount / 6 * 3, LOD_MAX_ERROR, &levelError);
+								if (count < LOD_MIN_TRIANGLES * 3 || count > sourceCount * 9 / 10)
+								{
+									break;
+								}
+								optimizeVertexCache(lodIndices.data(), count, list.vertexCount);
+								error += levelError;
+								list.primitive->lods.push_back({ static_cast<uint32_t>(list.lodIndices.size()), static_cast<uint32_t>(count), error });
+								list.lodIndices.insert(list.lodIndices.end(), lodIndices.begin(), lodIndices.begin() + count);
+								indices.assign(lodIndices.begin(), lodIndices.begin() + count);
+							}
+						}
+					}
+				});
+			}
+			optimizePool.wait();
+		}
+
+		meshStats = {};
+		lodStats = {};
+		meshletStats = {};
+		for (size_t i = 0; i < lists.size(); i++)
+		{
+			if (optimized[i])
+			{
+				meshStats.primitives++;
+				meshStats.before += before[i];
+				meshStats.after += after[i];
+			}
+			const Primitive* primitive = lists[i].primitive;
+			if (!primitive->meshlets.empty())
+			{
+				meshletStats.primitives++;
+				meshletStats.meshlets += static_cast<uint32_t>(primitive->meshlets.size());
+				for (const Meshlet& meshlet : primitive->meshlets)
+				{
+					meshletStats.cones += meshlet.cone.w < 1.0f ? 1 : 0;
+				}
+			}
+			if (!primitive->lods.empty())
+			{
+				lodStats.primitives++;
+				lodStats.levels += static_cast<uint32_t>(primitive->lods.size());
+				lodStats.triangles += primitive->indexCount / 3;
+				for (const Primitive::Lod& lod : primitive->lods)
+				{
+					lodStats.lodTriangles += lod.indexCount / 3;
+				}
+			}
+		}
+		loadTimings.optimize = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		if (optimizeMeshes)
+		{
+			std::cout << "Mesh optimization: " << meshStats.primitives << " of " << lists.size() << " primitives in " << loadTimings.optimize << " ms on " << threadCount << " threads, ACMR "
+				<< meshStats.before.acmr() << " -> " << meshStats.after.acmr() << ", ATVR " << meshStats.before.atvr() << " -> " << meshStats.after.atvr() << std::endl;
+		}
+		if (generateMeshlets)
+		{
+			std::cout << "Meshlets: " << meshletStats.meshlets << " for " << meshletStats.primitives << " of " << lists.size() << " primitives, " << meshletStats.cones << " with a normal cone" << std::endl;
+		}
+		if (generateLods)
+		{
+			std::cout << "LODs: " << lodStats.levels << " levels for " << lodStats.primitives << " of " << lists.size() << " primitives, " << lodStats.triangles << " triangles + "
+				<< lodStats.lodTriangles << " in simplified levels" << std::endl;
+		}
+	}
+
 	void Model::getNodeProps(const tinygltf::Node& node, const tinygltf::Model& model, size_t& vertexCount, size_t& indexCount)
 	{
 		if (node.children.size() > 0)
@@ -654,7 +1060,7 @@ namespace vkglTF
 		}
 	}
 
-	void Model::loadSkins(tinygltf::Model& gltfModel)
+	void Model::loadSkins(tinygltf::Model& gltfModel, const LoaderInfo& loaderInfo)
 	{
 		for (tinygltf::Skin& source : gltfModel.skins)
 		{
@@ -682,60 +1088,655 @@ namespace vkglTF
 			{
 				const tinygltf::Accessor& accessor = gltfModel.accessors[source.inverseBindMatrices];
 				const tinygltf::BufferView& bufferView = gltfModel.bufferViews[accessor.bufferView];
-				const tinygltf::Buffer& buffer = gltfModel.buffers[bufferView.buffer];
 				newSkin->inverseBindMatrices.resize(accessor.count);
-				memcpy(newSkin->inverseBindMatrices.data(), &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(glm::mat4));
+				memcpy(newSkin->inverseBindMatrices.data(), loaderInfo.bufferData[bufferView.buffer] + accessor.byteOffset + bufferView.byteOffset, accessor.count * sizeof(glm::mat4));
 			}
 
 			skins.push_back(newSkin);
 		}
 	}
 
-	void Model::loadTextures(tinygltf::Model& gltfModel, vulkan::VulkanDevice* device, VkQueue transferQueue)
+	//An image stored in the BIN chunk of a mapped .glb, see parseMappedGlb
+	struct EmbeddedImage
+	{
+		const unsigned char* data = nullptr;
+		size_t size = 0;
+		int bufferView = -1;
+	};
+
+	//tinygltf image callback keeping the encoded bytes, loadTextures decodes all images in parallel
+	static bool deferImageDecode(tinygltf::Image* image, const int imageIndex, std::string*, std::string*, int, int, const unsigned char* bytes, int size, void* userData)
 	{
-		for (tinygltf::Texture& tex : gltfModel.textures)
+		//tinygltf only saw a stand-in for images in a mapped BIN chunk, those are decoded from the mapping
+		const std::vector<EmbeddedImage>* embeddedImages = static_cast<const std::vector<EmbeddedImage>*>(userData);
+		if (!embeddedImages || imageIndex >= static_cast<int>(embeddedImages->size()) || !(*embeddedImages)[imageIndex].data)
 		{
-			tinygltf::Image image = gltfModel.images[tex.source];
-			TextureSampler textureSampler;
-			if (tex.sampler == -1)
-			{
-				// No sampler specified, use a default one
-				textureSampler.magFilter = VK_FILTER_LINEAR;
-				textureSampler.minFilter = VK_FILTER_LINEAR;
-				textureSampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-				textureSampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-				textureSampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-			}
-			else
-			{
-				textureSampler = textureSamplers[tex.sampler];
-			}
-			Texture texture;
-			texture.LoadFromglTfImage(image, textureSampler, device, transferQueue);
-			textures.push_back(texture);
+			image->image.assign(bytes, bytes + size);
 		}
+		image->as_is = true;
+		return true;
 	}
 
-	VkSamplerAddressMode Model::getVkWrapMode(int32_t wrapMode)
+	//Parse the JSON chunk of a mapped .glb and leave its BIN chunk in the mapping. tinygltf copies that chunk into the buffer
+	//it belongs to, so the buffer is handed a one byte stand-in and bufferData points it at the mapping instead. Images in
+	//the chunk get a stand-in as well and are read from the mapping by deferImageDecode.
+	static bool parseMappedGlb(const vulkan::MappedFile& file, const std::string& baseDir, tinygltf::TinyGLTF& context, tinygltf::Model& model,
+		std::vector<const unsigned char*>& bufferData, std::vector<EmbeddedImage>& embeddedImages, std::string& error, std::string& warning)
 	{
-		switch (wrapMode)
+		const std::string standIn = "data:application/octet-stream;base64,AA==";
+		const unsigned char* bytes = file.data();
+		uint32_t header[5];
+		if (file.length() < sizeof(header))
 		{
-		case -1:
-		case 10497:
-			return VK_SAMPLER_ADDRESS_MODE_REPEAT;
-		case 33071:
-			return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-		case 33648:
-			return VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+			error = "File too small for a glb header";
+			return false;
+		}
+		memcpy(header, bytes, sizeof(header));
+		//"glTF", version 2, total length, then the length and type ("JSON") of the first chunk
+		if (header[0] != 0x46546C67 || header[1] != 2 || header[2] > file.length() || header[4] != 0x4E4F534A || header[3] > header[2] - sizeof(header))
+		{
+			error = "Invalid glb header";
+			return false;
+		}
+		const size_t totalLength = header[2];
+		const unsigned char* json = bytes + sizeof(header);
+		const size_t jsonLength = header[3];
+
+		//The BIN chunk is optional and follows the JSON chunk
+		const unsigned char* bin = nullptr;
+		size_t binLength = 0;
+		const size_t binHeader = sizeof(header) + jsonLength;
+		if (binHeader + 8 <= totalLength)
+		{
+			uint32_t chunk[2];
+			memcpy(chunk, bytes + binHeader, sizeof(chunk));
+			if (chunk[1] == 0x004E4942 && chunk[0] <= totalLength - binHeader - 8)
+			{
+				bin = bytes + binHeader + 8;
+				binLength = chunk[0];
+			}
 		}
 
-		std::cerr << "Unknown wrap mode for getVkWrapMode: " << wrapMode << std::endl;
-		return VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	}
+		nlohmann::json document = nlohmann::json::parse(json, json + jsonLength, nullptr, false);
+		if (document.is_discarded() || !document.is_object())
+		{
+			error = "Invalid glb JSON chunk";
+			return false;
+		}
 
-	VkFilter Model::getVkFilterMode(int32_t filterMode)
-	{
-		switch (filterMode)
+		//Unsigned member of a JSON object, false if it is missing or has another type
+		auto getUnsigned = [](const nlohmann::json& object, const char* key, uint64_t& value)
+		{
+			auto member = object.find(key);
+			if (member == object.end() || !member->is_number_unsigned())
+			{
+				return false;
+			}
+			value = member->get<uint64_t>();
+			return true;
+		};
+
+		auto buffers = document.find("buffers");
+		if (bin && buffers != document.end() && buffers->is_array())
+		{
+			bufferData.assign(buffers->size(), nullptr);
+			for (size_t i = 0; i < buffers->size(); i++)
+			{
+				nlohmann::json& buffer = (*buffers)[i];
+				if (!buffer.is_object() || buffer.contains("uri"))
+				{
+					continue;
+				}
+				uint64_t byteLength;
+				if (!getUnsigned(buffer, "byteLength", byteLength) || byteLength > binLength)
+				{
+					error = "Invalid byteLength of the glb BIN chunk buffer";
+					return false;
+				}
+				buffer["uri"] = standIn;
+				buffer["byteLength"] = 1;
+				bufferData[i] = bin;
+			}
+		}
+
+		auto images = document.find("images");
+		auto bufferViews = document.find("bufferViews");
+		if (!bufferData.empty() && images != document.end() && images->is_array() && bufferViews != document.end() && bufferViews->is_array())
+		{
+			embeddedImages.resize(images->size());
+			for (size_t i = 0; i < images->size(); i++)
+			{
+				nlohmann::json& image = (*images)[i];
+				uint64_t viewIndex;
+				uint64_t buffer;
+				uint64_t offset = 0;
+				uint64_t length;
+				if (!image.is_object() || !getUnsigned(image, "bufferView", viewIndex) || viewIndex >= bufferViews->size())
+				{
+					continue;
+				}
+				const nlohmann::json& view = (*bufferViews)[viewIndex];
+				if (!view.is_object() || !getUnsigned(view, "buffer", buffer) || buffer >= bufferData.size() || !bufferData[buffer])
+				{
+					continue;
+				}
+				getUnsigned(view, "byteOffset", offset);
+				if (!getUnsigned(view, "byteLength", length) || offset > binLength || length > binLength - offset)
+				{
+					error = "Image " + std::to_string(i) + " lies outside of the glb BIN chunk";
+					return false;
+				}
+				embeddedImages[i].data = bin + offset;
+				embeddedImages[i].size = static_cast<size_t>(length);
+				embeddedImages[i].bufferView = static_cast<int>(viewIndex);
+				image.erase("bufferView");
+				image["uri"] = standIn;
+			}
+		}
+
+		const std::string text = document.dump();
+		context.SetImageLoader(deferImageDecode, &embeddedImages);
+		const bool loaded = context.LoadASCIIFromString(&model, &error, &warning, text.c_str(), static_cast<unsigned int>(text.size()), baseDir);
+		context.SetImageLoader(deferImageDecode, nullptr);
+		if (!loaded)
+		{
+			return false;
+		}
+
+		//Put back what the stand-ins replaced, and keep every view of the chunk inside it
+		for (size_t i = 0; i < bufferData.size() && i < model.buffers.size(); i++)
+		{
+			if (bufferData[i])
+			{
+				model.buffers[i].uri.clear();
+				model.buffers[i].data.clear();
+			}
+		}
+		for (size_t i = 0; i < embeddedImages.size() && i < model.images.size(); i++)
+		{
+			if (embeddedImages[i].data)
+			{
+				model.images[i].bufferView = embeddedImages[i].bufferView;
+			}
+		}
+		for (const tinygltf::BufferView& view : model.bufferViews)
+		{
+			if (view.buffer >= 0 && static_cast<size_t>(view.buffer) < bufferData.size() && bufferData[view.buffer] && (view.byteOffset > binLength || view.byteLength > binLength - view.byteOffset))
+			{
+				error = "Buffer view outside of the glb BIN chunk";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//Box filtered RGBA mip chain, levels tightly packed from the largest down. Averages the same texels as the linear blits
+	static std::vector<uint8_t> generateMipChain(const unsigned char* pixels, uint32_t width, uint32_t height, uint32_t mipLevels)
+	{
+		std::vector<uint8_t> mips(encodedChainSize(TextureEncoding::RGBA8, width, height, mipLevels));
+		memcpy(mips.data(), pixels, size_t(width) * height * 4);
+		size_t srcOffset = 0;
+		size_t dstOffset = size_t(width) * height * 4;
+		for (uint32_t i = 1; i < mipLevels; i++)
+		{
+			const uint32_t srcWidth = std::max(1u, width >> (i - 1));
+			const uint32_t srcHeight = std::max(1u, height >> (i - 1));
+			const uint32_t dstWidth = std::max(1u, width >> i);
+			const uint32_t dstHeight = std::max(1u, height >> i);
+			const uint8_t* src = &mips[srcOffset];
+			uint8_t* dst = &mips[dstOffset];
+			for (uint32_t y = 0; y < dstHeight; y++)
+			{
+				const uint32_t y0 = std::min(y * 2, srcHeight - 1);
+				const uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+				for (uint32_t x = 0; x < dstWidth; x++)
+				{
+					const uint32_t x0 = std::min(x * 2, srcWidth - 1);
+					const uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+					for (uint32_t c = 0; c < 4; c++)
+					{
+						const uint32_t sum = src[(y0 * srcWidth + x0) * 4 + c] + src[(y0 * srcWidth + x1) * 4 + c] + src[(y1 * srcWidth + x0) * 4 + c] + src[(y1 * srcWidth + x1) * 4 + c];
+						dst[(y * dstWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+					}
+				}
+			}
+			srcOffset = dstOffset;
+			dstOffset += size_t(dstWidth) * dstHeight * 4;
+		}
+		return mips;
+	}
+
+	//What materials sample from an image, decides the block format it is encoded to
+	enum TextureRole : uint32_t
+	{
+		TEXTURE_ROLE_COLOR = 1,
+		TEXTURE_ROLE_NORMAL = 2,
+		TEXTURE_ROLE_OCCLUSION = 4,
+		TEXTURE_ROLE_DATA = 8
+	};
+
+	//Normals keep the two channels the shader rebuilds z from and occlusion its single one. Colors take BC7, other
+	//data BC1 unless its alpha is used. A normal map that doubles as anything else stays RGBA
+	static TextureEncoding chooseEncoding(uint32_t roles, const unsigned char* pixels, size_t texelCount)
+	{
+		if (roles == TEXTURE_ROLE_NORMAL)
+		{
+			return TextureEncoding::BC5;
+		}
+		if (roles == TEXTURE_ROLE_OCCLUSION)
+		{
+			return TextureEncoding::BC4;
+		}
+		if (roles & TEXTURE_ROLE_NORMAL)
+		{
+			return TextureEncoding::RGBA8;
+		}
+		if (roles & TEXTURE_ROLE_COLOR)
+		{
+			return TextureEncoding::BC7;
+		}
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			if (pixels[i * 4 + 3] != 255)
+			{
+				return TextureEncoding::BC7;
+			}
+		}
+		return TextureEncoding::BC1;
+	}
+
+	void Model::loadTextures(tinygltf::Model& gltfModel, vulkan::VulkanDevice* device, LoaderInfo& loaderInfo)
+	{
+		struct DecodedImage
+		{
+			stbi_uc* pixels = nullptr;
+			int width = 0;
+			int height = 0;
+		};
+		const size_t imageCount = gltfModel.images.size();
+		std::vector<DecodedImage> decodedImages(imageCount);
+		//A cooked scene stores finished mip chains, they are built on the decode workers and uploaded as they are.
+		//Compressed textures are built the same way, without cooking their chains are released once uploaded
+		std::vector<LoaderInfo::CookedImage>& cookedImages = loaderInfo.cookedImages;
+		if (loaderInfo.cookTextures || loaderInfo.compressTextures)
+		{
+			cookedImages.resize(imageCount);
+			loaderInfo.cookedTextures.resize(gltfModel.textures.size());
+		}
+		//Encoded bytes, in the mapped file or in the copy tinygltf made
+		auto encodedImage = [&](size_t i, const unsigned char*& data, size_t& size)
+		{
+			if (i < loaderInfo.encodedImages.size() && loaderInfo.encodedImages[i].data)
+			{
+				data = loaderInfo.encodedImages[i].data;
+				size = loaderInfo.encodedImages[i].size;
+				return;
+			}
+			data = gltfModel.images[i].image.data();
+			size = gltfModel.images[i].image.size();
+		};
+
+		//Images with the same encoded bytes are decoded and uploaded once. The hash covers the size and both ends of the
+		//data, candidates are compared in full
+		std::vector<size_t> canonicalImages(imageCount);
+		std::vector<size_t> uniqueImages;
+		{
+			const size_t sampleSize = 4096;
+			std::unordered_map<uint64_t, std::vector<size_t>> candidates;
+			for (size_t i = 0; i < imageCount; i++)
+			{
+				const unsigned char* data;
+				size_t size;
+				encodedImage(i, data, size);
+				canonicalImages[i] = i;
+				if (size > 0)
+				{
+					uint64_t hash = hashBytes(&size, sizeof(size));
+					hash = hashBytes(data, std::min(size, sampleSize), hash);
+					hash = hashBytes(data + size - std::min(size, sampleSize), std::min(size, sampleSize), hash);
+					std::vector<size_t>& matches = candidates[hash];
+					for (size_t match : matches)
+					{
+						const unsigned char* matchData;
+						size_t matchSize;
+						encodedImage(match, matchData, matchSize);
+						if (matchSize == size && memcmp(matchData, data, size) == 0)
+						{
+							canonicalImages[i] = match;
+							break;
+						}
+					}
+					if (canonicalImages[i] == i)
+					{
+						matches.push_back(i);
+					}
+				}
+				if (canonicalImages[i] == i)
+				{
+					uniqueImages.push_back(i);
+				}
+			}
+			for (size_t i = 0; i < imageCount; i++)
+			{
+				if (canonicalImages[i] != i)
+				{
+					std::vector<unsigned char>().swap(gltfModel.images[i].image);
+				}
+			}
+		}
+
+		//Textures in the order of the file, each is created as soon as its image is decoded. The first texture of an
+		//image owns the GPU image, later ones only add their sampler
+		textures.resize(gltfModel.textures.size());
+		std::vector<TextureSampler> samplers(gltfModel.textures.size());
+		std::vector<std::vector<size_t>> imageTextures(imageCount);
+		std::vector<int64_t> imageOwners(imageCount, -1);
+		for (size_t i = 0; i < gltfModel.textures.size(); i++)
+		{
+			const tinygltf::Texture& tex = gltfModel.textures[i];
+			TextureSampler& textureSampler = samplers[i];
+			if (tex.sampler == -1)
+			{
+				// No sampler specified, use a default one
+				textureSampler.magFilter = VK_FILTER_LINEAR;
+				textureSampler.minFilter = VK_FILTER_LINEAR;
+				textureSampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+				textureSampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+				textureSampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+			}
+			else
+			{
+				textureSampler = textureSamplers[tex.sampler];
+			}
+			if (tex.source > -1 && static_cast<size_t>(tex.source) < imageCount)
+			{
+				imageTextures[canonicalImages[tex.source]].push_back(i);
+			}
+		}
+		auto createTexture = [&](size_t i)
+		{
+			const int source = gltfModel.textures[i].source > -1 && static_cast<size_t>(gltfModel.textures[i].source) < imageCount ? static_cast<int>(canonicalImages[gltfModel.textures[i].source]) : -1;
+			Texture& texture = textures[i];
+			if (source > -1 && imageOwners[source] > -1)
+			{
+				texture.shareImage(textures[imageOwners[source]], samplers[i]);
+				if (loaderInfo.cookTextures)
+				{
+					loaderInfo.cookedTextures[i] = { source, samplers[i] };
+				}
+			}
+			else if (source > -1 && !cookedImages.empty() && !cookedImages[source].mips.empty())
+			{
+				const LoaderInfo::CookedImage& cooked = cookedImages[source];
+				texture.createFromMipChain(cooked.mips.data(), cooked.width, cooked.height, cooked.mipLevels, samplers[i], device, cooked.encoding);
+				loaderInfo.cookedTextures[i] = { source, samplers[i] };
+				imageOwners[source] = static_cast<int64_t>(i);
+			}
+			else if (source > -1 && decodedImages[source].pixels)
+			{
+				const DecodedImage& decoded = decodedImages[source];
+				texture.createFromPixels(decoded.pixels, decoded.width, decoded.height, samplers[i], device);
+				imageOwners[source] = static_cast<int64_t>(i);
+			}
+			else
+			{
+				std::cerr << "Could not decode the image of texture " << i << ", using a white texture" << std::endl;
+				const unsigned char white[4] = { 255, 255, 255, 255 };
+				texture.createFromPixels(white, 1, 1, samplers[i], device);
+				if (loaderInfo.cookTextures)
+				{
+					loaderInfo.cookedTextures[i] = { -1, samplers[i] };
+				}
+			}
+		};
+		for (size_t i = 0; i < gltfModel.textures.size(); i++)
+		{
+			const int source = gltfModel.textures[i].source;
+			if (source < 0 || static_cast<size_t>(source) >= imageCount)
+			{
+				createTexture(i);
+			}
+		}
+
+		std::vector<uint32_t> imageRoles(imageCount, 0);
+		if (loaderInfo.compressTextures)
+		{
+			auto addRole = [&](int texture, uint32_t role)
+			{
+				if (texture > -1 && static_cast<size_t>(texture) < gltfModel.textures.size())
+				{
+					const int source = gltfModel.textures[texture].source;
+					if (source > -1 && static_cast<size_t>(source) < imageCount)
+					{
+						imageRoles[canonicalImages[source]] |= role;
+					}
+				}
+			};
+			for (const tinygltf::Material& mat : gltfModel.materials)
+			{
+				addRole(mat.pbrMetallicRoughness.baseColorTexture.index, TEXTURE_ROLE_COLOR);
+				addRole(mat.pbrMetallicRoughness.metallicRoughnessTexture.index, TEXTURE_ROLE_DATA);
+				addRole(mat.normalTexture.index, TEXTURE_ROLE_NORMAL);
+				addRole(mat.occlusionTexture.index, TEXTURE_ROLE_OCCLUSION);
+				addRole(mat.emissiveTexture.index, TEXTURE_ROLE_DATA);
+				auto ext = mat.extensions.find("KHR_materials_pbrSpecularGlossiness");
+				if (ext != mat.extensions.end())
+				{
+					//Glossiness lives in the alpha channel
+					if (ext->second.Has("specularGlossinessTexture"))
+					{
+						addRole(ext->second.Get("specularGlossinessTexture").Get("index").Get<int>(), TEXTURE_ROLE_COLOR);
+					}
+					if (ext->second.Has("diffuseTexture"))
+					{
+						addRole(ext->second.Get("diffuseTexture").Get("index").Get<int>(), TEXTURE_ROLE_COLOR);
+					}
+				}
+			}
+		}
+
+		//Images are decoded in waves whose memory fits the budget, a wave is uploaded and released before the next one is
+		//decoded. Without a budget all images form one wave. A single image larger than the budget still gets its own wave.
+		//An image counts its RGBA pixels and, when its chain is built on the worker, the RGBA chain and the encoded chain
+		//that exist together while it is encoded. The BC1 or BC7 choice depends on the pixels, the larger BC7 is planned
+		std::vector<size_t> decodedSizes(uniqueImages.size(), 0);
+		for (size_t k = 0; k < uniqueImages.size(); k++)
+		{
+			const unsigned char* data;
+			size_t size;
+			encodedImage(uniqueImages[k], data, size);
+			int width = 0;
+			int height = 0;
+			int components = 0;
+			if (stbi_info_from_memory(data, static_cast<int>(size), &width, &height, &components))
+			{
+				decodedSizes[k] = size_t(width) * height * 4;
+				if (!cookedImages.empty())
+				{
+					const uint32_t levelWidth = static_cast<uint32_t>(width);
+					const uint32_t levelHeight = static_cast<uint32_t>(height);
+					const uint32_t mipLevels = static_cast<uint32_t>(floor(log2(std::max(levelWidth, levelHeight))) + 1.0f);
+					decodedSizes[k] += encodedChainSize(TextureEncoding::RGBA8, levelWidth, levelHeight, mipLevels);
+					TextureEncoding encoding = loaderInfo.compressTextures ? chooseEncoding(imageRoles[uniqueImages[k]], nullptr, 0) : TextureEncoding::RGBA8;
+					if (encoding == TextureEncoding::BC1)
+					{
+						encoding = TextureEncoding::BC7;
+					}
+					if (encoding != TextureEncoding::RGBA8)
+					{
+						decodedSizes[k] += encodedChainSize(encoding, levelWidth, levelHeight, mipLevels);
+					}
+				}
+			}
+		}
+
+		const uint32_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		size_t resident = 0;
+		double decodeTime = 0.0;
+		double uploadTime = 0.0;
+		for (size_t first = 0; first < uniqueImages.size();)
+		{
+			size_t last = first + 1;
+			size_t waveSize = decodedSizes[first];
+			while (last < uniqueImages.size() && (textureMemoryBudget == 0 || waveSize + decodedSizes[last] <= textureMemoryBudget))
+			{
+				waveSize += decodedSizes[last++];
+			}
+
+			//Decode, each worker takes every threadCount-th image of the wave
+			auto tStart = std::chrono::high_resolution_clock::now();
+			const uint32_t threadCount = std::min(maxThreads, static_cast<uint32_t>(last - first));
+			loadTimings.decodeThreads = std::max(loadTimings.decodeThreads, threadCount);
+			ThreadPool decodePool;
+			decodePool.setThreadCount(threadCount);
+			for (uint32_t t = 0; t < threadCount; t++)
+			{
+				decodePool.threads[t]->addJob([&gltfModel, &loaderInfo, &decodedImages, &cookedImages, &imageRoles, &encodedImage, &uniqueImages, first, last, t, threadCount]
+				{
+					for (size_t k = first + t; k < last; k += threadCount)
+					{
+						const size_t i = uniqueImages[k];
+						DecodedImage& decoded = decodedImages[i];
+						const unsigned char* data;
+						size_t size;
+						encodedImage(i, data, size);
+						int components;
+						//Always expand to RGBA, 16 bit images are reduced to 8 bit
+						decoded.pixels = stbi_load_from_memory(data, static_cast<int>(size), &decoded.width, &decoded.height, &components, STBI_rgb_alpha);
+						//The encoded bytes are not needed anymore
+						std::vector<unsigned char>().swap(gltfModel.images[i].image);
+						if (decoded.pixels && !cookedImages.empty())
+						{
+							LoaderInfo::CookedImage& cooked = cookedImages[i];
+							cooked.width = static_cast<uint32_t>(decoded.width);
+							cooked.height = static_cast<uint32_t>(decoded.height);
+							cooked.mipLevels = static_cast<uint32_t>(floor(log2(std::max(cooked.width, cooked.height))) + 1.0f);
+							cooked.mips = generateMipChain(decoded.pixels, cooked.width, cooked.height, cooked.mipLevels);
+							if (loaderInfo.compressTextures)
+							{
+								cooked.encoding = chooseEncoding(imageRoles[i], decoded.pixels, size_t(cooked.width) * cooked.height);
+								if (cooked.encoding != TextureEncoding::RGBA8)
+								{
+									cooked.mips = encodeMipChain(cooked.mips.data(), cooked.width, cooked.height, cooked.mipLevels, cooked.encoding);
+								}
+							}
+							//The chain is all the upload needs
+							stbi_image_free(decoded.pixels);
+							decoded.pixels = nullptr;
+						}
+					}
+				});
+			}
+			decodePool.wait();
+			decodeTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+			//The workers held at most the planned size of the wave, the pixels or chains are left until the upload
+			loadMemory.texturePeak = std::max(loadMemory.texturePeak, resident + waveSize);
+			for (size_t k = first; k < last; k++)
+			{
+				const DecodedImage& decoded = decodedImages[uniqueImages[k]];
+				resident += decoded.pixels ? size_t(decoded.width) * decoded.height * 4 : 0;
+				resident += cookedImages.empty() ? 0 : cookedImages[uniqueImages[k]].mips.size();
+			}
+
+			//Create the images of the wave and record their uploads, the staging ring holds on to the pixels from here
+			tStart = std::chrono::high_resolution_clock::now();
+			for (size_t k = first; k < last; k++)
+			{
+				DecodedImage& decoded = decodedImages[uniqueImages[k]];
+				for (size_t texture : imageTextures[uniqueImages[k]])
+				{
+					createTexture(texture);
+				}
+				if (decoded.pixels)
+				{
+					resident -= size_t(decoded.width) * decoded.height * 4;
+				}
+				stbi_image_free(decoded.pixels);
+				decoded.pixels = nullptr;
+				if (!cookedImages.empty())
+				{
+					std::vector<uint8_t>& mips = cookedImages[uniqueImages[k]].mips;
+					resident -= mips.size();
+					if (!loaderInfo.cookTextures)
+					{
+						std::vector<uint8_t>().swap(mips);
+					}
+				}
+			}
+			uploadTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+			loadMemory.textureWaves++;
+			first = last;
+		}
+		loadTimings.decode = decodeTime;
+		loadTimings.textures = uploadTime;
+		countTextureSharing();
+	}
+
+	void Model::countTextureSharing()
+	{
+		textureStats = {};
+		std::vector<VkSampler> samplers;
+		for (const Texture& texture : textures)
+		{
+			if (texture.sharedImage)
+			{
+				textureStats.sharedImages++;
+				textureStats.savedBytes += texture.deviceMemory.size;
+			}
+			else
+			{
+				textureStats.images++;
+				if (texture.encoding != TextureEncoding::RGBA8)
+				{
+					textureStats.compressedImages++;
+					for (uint32_t i = 0; i < texture.mipLevels; i++)
+					{
+						const uint32_t levelWidth = std::max(1u, texture.width >> i);
+						const uint32_t levelHeight = std::max(1u, texture.height >> i);
+						textureStats.compressedBytes += encodedSize(texture.encoding, levelWidth, levelHeight);
+						textureStats.uncompressedBytes += encodedSize(TextureEncoding::RGBA8, levelWidth, levelHeight);
+					}
+				}
+			}
+			if (std::find(samplers.begin(), samplers.end(), texture.sampler) == samplers.end())
+			{
+				samplers.push_back(texture.sampler);
+			}
+		}
+		textureStats.samplers = static_cast<uint32_t>(samplers.size());
+		if (!textures.empty())
+		{
+			std::cout << "Textures: " << textures.size() << " on " << textureStats.images << " images (" << textureStats.sharedImages << " shared, " << textureStats.savedBytes / 1024
+				<< " KB of device memory saved), " << textureStats.samplers << " samplers (" << textures.size() - textureStats.samplers << " saved)" << std::endl;
+		}
+		if (textureStats.compressedImages > 0)
+		{
+			std::cout << "Texture compression: " << textureStats.compressedImages << " of " << textureStats.images << " images block compressed, "
+				<< textureStats.compressedBytes / 1024 << " KB instead of " << textureStats.uncompressedBytes / 1024 << " KB" << std::endl;
+		}
+	}
+
+	VkSamplerAddressMode Model::getVkWrapMode(int32_t wrapMode)
+	{
+		switch (wrapMode)
+		{
+		case -1:
+		case 10497:
+			return VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		case 33071:
+			return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		case 33648:
+			return VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+		}
+
+		std::cerr << "Unknown wrap mode for getVkWrapMode: " << wrapMode << std::endl;
+		return VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	}
+
+	VkFilter Model::getVkFilterMode(int32_t filterMode)
+	{
+		switch (filterMode)
 		{
 		case -1:
 		case 9728:
@@ -879,7 +1880,7 @@ namespace vkglTF
 		materials.push_back(Material());
 	}
 
-	void Model::loadAnimations(tinygltf::Model& gltfModel)
+	void Model::loadAnimations(tinygltf::Model& gltfModel, const LoaderInfo& loaderInfo)
 	{
 		for (tinygltf::Animation& anim : gltfModel.animations)
 		{
@@ -912,11 +1913,10 @@ namespace vkglTF
 				{
 					const tinygltf::Accessor& accessor = gltfModel.accessors[samp.input];
 					const tinygltf::BufferView& bufferView = gltfModel.bufferViews[accessor.bufferView];
-					const tinygltf::Buffer& buffer = gltfModel.buffers[bufferView.buffer];
 
 					assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
 
-					const void* dataPtr = &buffer.data[accessor.byteOffset + bufferView.byteOffset];
+					const void* dataPtr = loaderInfo.bufferData[bufferView.buffer] + accessor.byteOffset + bufferView.byteOffset;
 					const float* buf = static_cast<const float*>(dataPtr);
 					for (size_t index = 0; index < accessor.count; index++)
 					{
@@ -940,11 +1940,10 @@ namespace vkglTF
 				{
 					const tinygltf::Accessor& accessor = gltfModel.accessors[samp.output];
 					const tinygltf::BufferView& bufferView = gltfModel.bufferViews[accessor.bufferView];
-					const tinygltf::Buffer& buffer = gltfModel.buffers[bufferView.buffer];
 
 					assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
 
-					const void* dataPtr = &buffer.data[accessor.byteOffset + bufferView.byteOffset];
+					const void* dataPtr = loaderInfo.bufferData[bufferView.buffer] + accessor.byteOffset + bufferView.byteOffset;
 
 					switch (accessor.type)
 					{
@@ -1010,7 +2009,7 @@ namespace vkglTF
 		}
 	}
 
-	void Model::loadFromFile(std::string filename, vulkan::VulkanDevice* device, VkQueue transferQueue, float scale)
+	void Model::loadFromFile(std::string filename, vulkan::VulkanDevice* device, float scale)
 	{
 		tinygltf::Model gltfModel;
 		tinygltf::TinyGLTF gltfContext;
@@ -1019,6 +2018,24 @@ namespace vkglTF
 		std::string warning;
 
 		this->device = device;
+		loadTimings = {};
+		loadMemory = {};
+		const uint32_t submitsBefore = device->staging->getStats().submits;
+		const VkDeviceSize stagedBefore = device->staging->getStats().uploadedBytes;
+
+		//Everything that changes what gets cooked is part of the cache key
+		const std::string cacheFilename = filename + ".scenecache";
+		uint64_t cacheOptions = hashBytes(&scale, sizeof(scale));
+		const bool compress = compressTextures && device->enabledFeatures.textureCompressionBC;
+		const uint8_t cacheFlags[5] = { optimizeMeshes, generateLods, generateMeshlets, compress, floatTexCoords };
+		cacheOptions = hashBytes(cacheFlags, sizeof(cacheFlags), cacheOptions);
+		if (useSceneCache && loadSceneCache(cacheFilename, cacheOptions))
+		{
+			return;
+		}
+
+		//Images are only read here, decoding happens in parallel in loadTextures
+		gltfContext.SetImageLoader(deferImageDecode, nullptr);
 
 		bool binary = false;
 		size_t extpos = filename.rfind('.', filename.length());
@@ -1027,28 +2044,72 @@ namespace vkglTF
 			binary = (filename.substr(extpos + 1, filename.length() - extpos) == "glb");
 		}
 
-		bool fileLoaded = binary ? gltfContext.LoadBinaryFromFile(&gltfModel, &error, &warning, filename.c_str()) : gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename.c_str());
-
 		LoaderInfo loaderInfo{};
+		//Cooking keeps every mip chain until the cache is written, which a texture budget rules out
+		const bool cookScene = useSceneCache && textureMemoryBudget == 0;
+		loaderInfo.cookTextures = cookScene;
+		loaderInfo.compressTextures = compress;
 		size_t vertexCount = 0;
 		size_t indexCount = 0;
 
-		if (fileLoaded)
+		// A .glb stays mapped until its accessors are converted, only the JSON chunk is parsed
+		vulkan::MappedFile mappedFile;
+		std::vector<EmbeddedImage> embeddedImages;
+		auto tStart = std::chrono::high_resolution_clock::now();
+		bool fileLoaded = false;
+		if (binary)
 		{
-			loadTextureSamplers(gltfModel);
-			loadTextures(gltfModel, device, transferQueue);
-			loadMaterials(gltfModel);
-
-			const tinygltf::Scene& scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
-
-			// Get vertex and index buffer sizes up-front
-			for (size_t i = 0; i < scene.nodes.size(); i++)
+			fileLoaded = mappedFile.open(filename);
+			if (!fileLoaded)
 			{
-				getNodeProps(gltfModel.nodes[scene.nodes[i]], gltfModel, vertexCount, indexCount);
+				error = "Could not map " + filename;
 			}
-			loaderInfo.vertexBuffer = new Vertex[vertexCount];
-			loaderInfo.indexBuffer = new uint32_t[indexCount];
-
+			fileLoaded = fileLoaded && parseMappedGlb(mappedFile, std::filesystem::path(filename).parent_path().string(), gltfContext, gltfModel, loaderInfo.bufferData, embeddedImages, error, warning);
+		}
+		else
+		{
+			fileLoaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename.c_str());
+		}
+		loadTimings.parse = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+		if (fileLoaded)
+		{
+			// Buffers tinygltf loaded itself are read from their copy
+			loaderInfo.bufferData.resize(gltfModel.buffers.size(), nullptr);
+			for (size_t i = 0; i < gltfModel.buffers.size(); i++)
+			{
+				if (!loaderInfo.bufferData[i])
+				{
+					loaderInfo.bufferData[i] = gltfModel.buffers[i].data.data();
+					loadMemory.buffers += gltfModel.buffers[i].data.size();
+				}
+			}
+			loaderInfo.encodedImages.resize(gltfModel.images.size());
+			for (size_t i = 0; i < gltfModel.images.size(); i++)
+			{
+				if (i < embeddedImages.size() && embeddedImages[i].data)
+				{
+					loaderInfo.encodedImages[i] = { embeddedImages[i].data, embeddedImages[i].size };
+				}
+				loadMemory.images += gltfModel.images[i].image.size();
+			}
+			loadTextureSamplers(gltfModel);
+			loadTextures(gltfModel, device, loaderInfo);
+			loadMaterials(gltfModel);
+			tStart = std::chrono::high_resolution_clock::now();
+
+			const tinygltf::Scene& scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
+
+			// Get vertex and index buffer sizes up-front
+			for (size_t i = 0; i < scene.nodes.size(); i++)
+			{
+				getNodeProps(gltfModel.nodes[scene.nodes[i]], gltfModel, vertexCount, indexCount);
+			}
+			loaderInfo.vertexBuffer = new Vertex[vertexCount];
+			loaderInfo.indexBuffer = new uint32_t[indexCount];
+			loadMemory.vertices += vertexCount * sizeof(Vertex);
+			loadMemory.indices += indexCount * sizeof(uint32_t);
+
 			// TODO: scene handling with no default scene
 			for (size_t i = 0; i < scene.nodes.size(); i++)
 			{
@@ -1057,9 +2118,13 @@ namespace vkglTF
 			}
 			if (gltfModel.animations.size() > 0)
 			{
-				loadAnimations(gltfModel);
+				loadAnimations(gltfModel, loaderInfo);
+			}
+			loadSkins(gltfModel, loaderInfo);
+			if (optimizeMeshes || generateLods || generateMeshlets)
+			{
+				optimizePrimitives(loaderInfo);
 			}
-			loadSkins(gltfModel);
 
 			for (auto node : linearNodes)
 			{
@@ -1068,12 +2133,27 @@ namespace vkglTF
 				{
 					node->skin = skins[node->skinIndex];
 				}
+				// Palette slots, sized to the joints the skin actually has
+				if (node->mesh)
+				{
+					node->mesh->matrixOffset = matrixCount;
+					matrixCount += 1 + (node->skin ? static_cast<uint32_t>(node->skin->joints.size()) : 0);
+				}
 				// Initial pose
 				if (node->mesh)
 				{
 					node->update();
 				}
 			}
+
+			// Every accessor is converted, neither the buffers nor the mapping are read again
+			for (tinygltf::Buffer& buffer : gltfModel.buffers)
+			{
+				std::vector<unsigned char>().swap(buffer.data);
+			}
+			loaderInfo.bufferData.clear();
+			loaderInfo.encodedImages.clear();
+			mappedFile.close();
 		}
 		else
 		{
@@ -1084,37 +2164,81 @@ namespace vkglTF
 
 		extensions = gltfModel.extensionsUsed;
 
-		size_t vertexBufferSize = vertexCount * sizeof(Vertex);
-		size_t indexBufferSize = indexCount * sizeof(uint32_t);
-
-		assert(vertexBufferSize > 0);
-
-		struct StagingBuffer
+		// Quantize the vertices into the layout of the attributes this model has. Only the scene cache needs them packed
+		// in memory, otherwise they are packed straight into the staging ring
+		const bool unormTexCoords[2] = { !floatTexCoords && loaderInfo.unitTexCoords[0], !floatTexCoords && loaderInfo.unitTexCoords[1] };
+		vertices.layout = VertexLayout(loaderInfo.usedAttributes, loaderInfo.maxJoint, unormTexCoords);
+		size_t vertexBufferSize = vertices.layout.streamOffsets(vertexCount, vertices.streamOffsets);
+		std::vector<uint8_t> packedVertices;
+		if (cookScene)
 		{
-			VkBuffer buffer;
-			VkDeviceMemory memory;
-		} vertexStaging, indexStaging;
+			packedVertices.resize(vertexBufferSize);
+			vertices.layout.pack(loaderInfo.vertexBuffer, vertexCount, packedVertices.data());
+			loadMemory.vertices += vertexBufferSize;
+		}
 
-		// Create staging buffers
-		// Vertex data
-		VK_CHECK_RESULT(device->createBuffer(
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			vertexBufferSize,
-			&vertexStaging.buffer,
-			&vertexStaging.memory,
-			loaderInfo.vertexBuffer));
-		// Index data
-		if (indexBufferSize > 0)
+		// Indices are relative to their primitive's first vertex, so most primitives fit 16 bit indices.
+		// Simplified levels follow their primitive in the same pool
+		std::unordered_map<const Primitive*, const std::vector<uint32_t>*> lodIndices;
+		for (const LoaderInfo::TriangleList& list : loaderInfo.triangleLists)
 		{
-			VK_CHECK_RESULT(device->createBuffer(
-				VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				indexBufferSize,
-				&indexStaging.buffer,
-				&indexStaging.memory,
-				loaderInfo.indexBuffer));
+			if (!list.lodIndices.empty())
+			{
+				lodIndices[list.primitive] = &list.lodIndices;
+			}
+		}
+		std::vector<uint16_t> narrowIndices;
+		std::vector<uint32_t> wideIndices;
+		for (auto node : linearNodes)
+		{
+			if (!node->mesh)
+			{
+				continue;
+			}
+			for (Primitive* primitive : node->mesh->primitives)
+			{
+				if (!primitive->hasIndices)
+				{
+					continue;
+				}
+				const uint32_t* source = loaderInfo.indexBuffer + primitive->firstIndex;
+				primitive->wideIndices = primitive->vertexCount > std::numeric_limits<uint16_t>::max();
+				if (primitive->wideIndices)
+				{
+					primitive->firstIndex = static_cast<uint32_t>(wideIndices.size());
+					wideIndices.insert(wideIndices.end(), source, source + primitive->indexCount);
+				}
+				else
+				{
+					primitive->firstIndex = static_cast<uint32_t>(narrowIndices.size());
+					narrowIndices.insert(narrowIndices.end(), source, source + primitive->indexCount);
+				}
+				auto lodSource = lodIndices.find(primitive);
+				if (lodSource != lodIndices.end())
+				{
+					const uint32_t lodStart = static_cast<uint32_t>(primitive->wideIndices ? wideIndices.size() : narrowIndices.size());
+					for (Primitive::Lod& lod : primitive->lods)
+					{
+						lod.firstIndex += lodStart;
+					}
+					if (primitive->wideIndices)
+					{
+						wideIndices.insert(wideIndices.end(), lodSource->second->begin(), lodSource->second->end());
+					}
+					else
+					{
+						narrowIndices.insert(narrowIndices.end(), lodSource->second->begin(), lodSource->second->end());
+					}
+				}
+			}
 		}
+		indices.narrowCount = static_cast<uint32_t>(narrowIndices.size());
+		indices.wideCount = static_cast<uint32_t>(wideIndices.size());
+		loadMemory.indices += narrowIndices.size() * sizeof(uint16_t) + wideIndices.size() * sizeof(uint32_t);
+		indices.wideOffset = (narrowIndices.size() * sizeof(uint16_t) + sizeof(uint32_t) - 1) & ~static_cast<VkDeviceSize>(sizeof(uint32_t) - 1);
+		size_t indexBufferSize = wideIndices.empty() ? narrowIndices.size() * sizeof(uint16_t) : indices.wideOffset + wideIndices.size() * sizeof(uint32_t);
+
+		assert(vertexCount > 0);
 
 		// Create device local buffers
 		// Vertex buffer
@@ -1135,35 +2259,675 @@ namespace vkglTF
 				&indices.memory));
 		}
 
-		// Copy from staging buffers
-		VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
-		device->beginCommandBuffer(copyCmd);
+		// Stream the geometry through the staging ring, a full ring submits what is pending
+		if (!packedVertices.empty())
+		{
+			device->staging->uploadBuffer(vertices.buffer, 0, packedVertices.data(), vertexBufferSize);
+		}
+		else
+		{
+			const VertexLayout& layout = vertices.layout;
+			const Vertex* source = loaderInfo.vertexBuffer;
+			for (uint32_t i = 0; i < VertexLayout::STREAM_COUNT; i++)
+			{
+				const VkDeviceSize stride = i == VertexLayout::STREAM_CONSTANTS ? VertexLayout::CONSTANT_BLOCK_SIZE : layout.strides[i];
+				const VkDeviceSize size = i == VertexLayout::STREAM_CONSTANTS ? stride : vertexCount * stride;
+				if (size == 0)
+				{
+					continue;
+				}
+				device->staging->uploadBuffer(vertices.buffer, vertices.streamOffsets[i], size, stride, [&](void* mapped, VkDeviceSize offset, VkDeviceSize chunk)
+				{
+					layout.packStream(i, source + offset / stride, static_cast<size_t>(chunk / stride), static_cast<uint8_t*>(mapped));
+				});
+			}
+		}
+		if (!narrowIndices.empty())
+		{
+			device->staging->uploadBuffer(indices.buffer, 0, narrowIndices.data(), narrowIndices.size() * sizeof(uint16_t));
+		}
+		if (!wideIndices.empty())
+		{
+			device->staging->uploadBuffer(indices.buffer, indices.wideOffset, wideIndices.data(), wideIndices.size() * sizeof(uint32_t));
+		}
+		loadTimings.geometry = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+		// Whatever is still pending goes out now, the model is only handed over once all of it arrived
+		tStart = std::chrono::high_resolution_clock::now();
+		device->staging->flush();
+		loadTimings.submit = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		loadTimings.submits = device->staging->getStats().submits - submitsBefore;
+		std::cout << "Load stages: parse " << loadTimings.parse << " ms, decode " << loadTimings.decode << " ms (" << gltfModel.images.size() << " images on " << loadTimings.decodeThreads << " threads), textures "
+			<< loadTimings.textures << " ms, geometry " << loadTimings.geometry << " ms, upload " << loadTimings.submit << " ms (" << loadTimings.submits << " submits)" << std::endl;
+		std::cout << "Vertices: " << vertexCount << " x " << vertices.layout.stride() << " bytes (" << sizeof(Vertex) << " unpacked), streams " << vertices.layout.strides[VertexLayout::STREAM_POSITION] << " position + "
+			<< vertices.layout.strides[VertexLayout::STREAM_ATTRIBUTES] << " attributes + " << vertices.layout.strides[VertexLayout::STREAM_SKINNING] << " skinning, " << vertexBufferSize / 1024 << " KB" << std::endl;
+		std::cout << "Indices: " << indices.narrowCount << " 16 bit + " << indices.wideCount << " 32 bit, " << indexBufferSize / 1024 << " KB (" << indexCount * sizeof(uint32_t) / 1024 << " KB as 32 bit)" << std::endl;
+		loadMemory.staged = device->staging->getStats().uploadedBytes - stagedBefore;
+		loadMemory.peakResident = vulkan::peakResidentBytes();
+		std::cout << "Load memory: copied " << (loadMemory.buffers + loadMemory.images + loadMemory.vertices + loadMemory.indices) / 1024 << " KB before staging (buffers " << loadMemory.buffers / 1024
+			<< " KB, images " << loadMemory.images / 1024 << " KB, vertices " << loadMemory.vertices / 1024 << " KB, indices " << loadMemory.indices / 1024 << " KB), staged "
+			<< loadMemory.staged / 1024 << " KB, peak resident " << loadMemory.peakResident / (1024 * 1024) << " MB" << (binary ? ", mapped glb" : "") << std::endl;
+		std::cout << "Texture memory: peak " << loadMemory.texturePeak / 1024 << " KB of decoded images in " << loadMemory.textureWaves << " waves";
+		if (textureMemoryBudget > 0)
+		{
+			std::cout << ", budget " << textureMemoryBudget / 1024 << " KB" << (useSceneCache ? ", scene cache not written" : "");
+		}
+		std::cout << std::endl;
+
+		delete[] loaderInfo.vertexBuffer;
+		delete[] loaderInfo.indexBuffer;
 
-		VkBufferCopy copyRegion = {};
+		if (cookScene)
+		{
+			//The source and every external buffer and image it references
+			std::vector<SceneCacheDependency> dependencies(1);
+			SceneCacheDependency::stamp(filename, dependencies[0]);
+			const std::string directory = std::filesystem::path(filename).parent_path().string();
+			auto addDependency = [&](const std::string& uri)
+			{
+				SceneCacheDependency dependency;
+				if (!uri.empty() && uri.compare(0, 5, "data:") != 0 && SceneCacheDependency::stamp((std::filesystem::path(directory) / uri).string(), dependency))
+				{
+					dependencies.push_back(dependency);
+				}
+			};
+			for (const tinygltf::Buffer& buffer : gltfModel.buffers)
+			{
+				addDependency(buffer.uri);
+			}
+			for (const tinygltf::Image& image : gltfModel.images)
+			{
+				addDependency(image.uri);
+			}
+			writeSceneCache(cacheFilename, cacheOptions, dependencies, loaderInfo, packedVertices, vertexCount, narrowIndices, wideIndices);
+		}
 
-		copyRegion.size = vertexBufferSize;
-		vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
+		getSceneDimensions();
+		buildDrawList();
+	}
 
-		if (indexBufferSize > 0)
+	void Model::writeSceneCache(const std::string& filename, uint64_t options, const std::vector<SceneCacheDependency>& dependencies, const LoaderInfo& loaderInfo,
+		const std::vector<uint8_t>& packedVertices, size_t vertexCount, const std::vector<uint16_t>& narrowIndices, const std::vector<uint32_t>& wideIndices) const
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+		SceneCacheWriter writer;
+		writer.write(SCENE_CACHE_MAGIC);
+		writer.write(SCENE_CACHE_VERSION);
+		writer.write(options);
+		writer.write(static_cast<uint64_t>(dependencies.size()));
+		for (const SceneCacheDependency& dependency : dependencies)
+		{
+			writer.writeString(dependency.path);
+			writer.write(dependency.size);
+			writer.write(dependency.modified);
+		}
+		writer.write(meshStats);
+		writer.write(lodStats);
+		writer.write(meshletStats);
+
+		// Geometry, exactly as uploaded
+		writer.write(static_cast<uint64_t>(vertexCount));
+		writer.write(vertices.layout);
+		writer.write(vertices.streamOffsets);
+		writer.writeVector(packedVertices);
+		writer.write(indices.wideOffset);
+		writer.writeVector(narrowIndices);
+		writer.writeVector(wideIndices);
+
+		// Textures
+		writer.writeVector(textureSamplers);
+		writer.write(static_cast<uint64_t>(loaderInfo.cookedImages.size()));
+		for (const LoaderInfo::CookedImage& image : loaderInfo.cookedImages)
+		{
+			writer.write(image.width);
+			writer.write(image.height);
+			writer.write(image.mipLevels);
+			writer.write(image.encoding);
+			writer.writeVector(image.mips);
+		}
+		writer.writeVector(loaderInfo.cookedTextures);
+
+		// Materials, textures are referenced by index
+		auto textureIndex = [this](const Texture* texture) { return texture ? static_cast<int32_t>(texture - textures.data()) : -1; };
+		writer.write(static_cast<uint64_t>(materials.size()));
+		for (const Material& material : materials)
 		{
-			copyRegion.size = indexBufferSize;
-			vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
+			writer.write(material.alphaMode);
+			writer.write(material.alphaCutoff);
+			writer.write(material.metallicFactor);
+			writer.write(material.roughnessFactor);
+			writer.write(material.baseColorFactor);
+			writer.write(material.emissiveFactor);
+			writer.write(textureIndex(material.baseColorTexture));
+			writer.write(textureIndex(material.metallicRoughnessTexture));
+			writer.write(textureIndex(material.normalTexture));
+			writer.write(textureIndex(material.occlusionTexture));
+			writer.write(textureIndex(material.emissiveTexture));
+			writer.write(material.doubleSided);
+			writer.write(material.texCoordSets);
+			writer.write(textureIndex(material.extension.specularGlossinessTexture));
+			writer.write(textureIndex(material.extension.diffuseTexture));
+			writer.write(material.extension.diffuseFactor);
+			writer.write(material.extension.specularFactor);
+			writer.write(material.pbrWorkflows);
 		}
 
-		device->flushCommandBuffer(copyCmd, transferQueue, true);
+		// Nodes in linearNodes order, links are indices into it
+		std::unordered_map<const Node*, int32_t> nodeIndices;
+		for (size_t i = 0; i < linearNodes.size(); i++)
+		{
+			nodeIndices[linearNodes[i]] = static_cast<int32_t>(i);
+		}
+		auto nodeIndex = [&nodeIndices](const Node* node) { return node ? nodeIndices.at(node) : -1; };
+		writer.write(static_cast<uint64_t>(linearNodes.size()));
+		for (const Node* node : linearNodes)
+		{
+			writer.write(nodeIndex(node->parent));
+			writer.write(node->index);
+			writer.writeString(node->name);
+			writer.write(node->skinIndex);
+			writer.write(node->matrix);
+			writer.write(node->translation);
+			writer.write(node->scale);
+			writer.write(node->rotation);
+			std::vector<int32_t> children;
+			for (const Node* child : node->children)
+			{
+				children.push_back(nodeIndex(child));
+			}
+			writer.writeVector(children);
+			writer.write(static_cast<uint8_t>(node->mesh ? 1 : 0));
+			if (node->mesh)
+			{
+				writer.write(node->mesh->bb);
+				writer.write(static_cast<uint64_t>(node->mesh->primitives.size()));
+				for (const Primitive* primitive : node->mesh->primitives)
+				{
+					writer.write(primitive->firstIndex);
+					writer.write(primitive->indexCount);
+					writer.write(primitive->firstVertex);
+					writer.write(primitive->vertexCount);
+					writer.write(primitive->wideIndices);
+					writer.write(static_cast<uint32_t>(&primitive->material - materials.data()));
+					writer.write(primitive->hasIndices);
+					writer.write(primitive->bb);
+					writer.writeVector(primitive->lods);
+					writer.writeVector(primitive->meshlets);
+				}
+			}
+		}
+		std::vector<int32_t> roots;
+		for (const Node* node : nodes)
+		{
+			roots.push_back(nodeIndex(node));
+		}
+		writer.writeVector(roots);
+
+		writer.write(static_cast<uint64_t>(skins.size()));
+		for (const Skin* skin : skins)
+		{
+			writer.writeString(skin->name);
+			writer.write(nodeIndex(skin->skeletonRoot));
+			writer.writeVector(skin->inverseBindMatrices);
+			std::vector<int32_t> joints;
+			for (const Node* joint : skin->joints)
+			{
+				joints.push_back(nodeIndex(joint));
+			}
+			writer.writeVector(joints);
+		}
+
+		writer.write(static_cast<uint64_t>(animations.size()));
+		for (const Animation& animation : animations)
+		{
+			writer.writeString(animation.name);
+			writer.write(animation.start);
+			writer.write(animation.end);
+			writer.write(static_cast<uint64_t>(animation.samplers.size()));
+			for (const AnimationSampler& sampler : animation.samplers)
+			{
+				writer.write(sampler.interpolation);
+				writer.writeVector(sampler.inputs);
+				writer.writeVector(sampler.outputsVec4);
+			}
+			writer.write(static_cast<uint64_t>(animation.channels.size()));
+			for (const AnimationChannel& channel : animation.channels)
+			{
+				writer.write(channel.path);
+				writer.write(nodeIndex(channel.node));
+				writer.write(channel.samplerIndex);
+			}
+		}
+
+		writer.write(static_cast<uint64_t>(extensions.size()));
+		for (const std::string& extension : extensions)
+		{
+			writer.writeString(extension);
+		}
 
-		vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
-		vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
+		if (writer.save(filename))
+		{
+			std::cout << "Scene cache: wrote " << filename << " (" << writer.data.size() / 1024 << " KB) in "
+				<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count() << " ms" << std::endl;
+		}
+		else
+		{
+			std::cerr << "Could not write scene cache " << filename << std::endl;
+		}
+	}
+
+	bool Model::loadSceneCache(const std::string& filename, uint64_t options)
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+		vulkan::MappedFile file;
+		if (!file.open(filename))
+		{
+			return false;
+		}
+		SceneCacheReader reader(file.data(), file.length());
+		if (reader.read<uint32_t>() != SCENE_CACHE_MAGIC || reader.read<uint32_t>() != SCENE_CACHE_VERSION || reader.read<uint64_t>() != options)
+		{
+			std::cout << "Scene cache " << filename << " was cooked with other settings, cooking again" << std::endl;
+			return false;
+		}
+		const size_t dependencyCount = reader.readCount(sizeof(uint64_t) * 3);
+		for (size_t i = 0; i < dependencyCount && reader.ok(); i++)
+		{
+			SceneCacheDependency dependency;
+			dependency.path = reader.readString();
+			dependency.size = reader.read<uint64_t>();
+			dependency.modified = reader.read<int64_t>();
+			if (!dependency.current())
+			{
+				std::cout << "Scene cache " << filename << " is older than " << dependency.path << ", cooking again" << std::endl;
+				return false;
+			}
+		}
+		meshStats = reader.read<MeshStats>();
+		lodStats = reader.read<LodStats>();
+		meshletStats = reader.read<MeshletStats>();
+
+		// Geometry stays in the mapping until it is copied into the staging ring
+		const size_t vertexCount = static_cast<size_t>(reader.read<uint64_t>());
+		vertices.layout = reader.read<VertexLayout>();
+		const uint8_t* streamOffsets = reader.readBytes(sizeof(vertices.streamOffsets));
+		if (streamOffsets)
+		{
+			memcpy(vertices.streamOffsets, streamOffsets, sizeof(vertices.streamOffsets));
+		}
+		size_t vertexBufferSize;
+		const uint8_t* packedVertices = reader.readArray<uint8_t>(vertexBufferSize);
+		indices.wideOffset = reader.read<VkDeviceSize>();
+		size_t narrowCount;
+		const uint16_t* narrowIndices = reader.readArray<uint16_t>(narrowCount);
+		size_t wideCount;
+		const uint32_t* wideIndices = reader.readArray<uint32_t>(wideCount);
+		indices.narrowCount = static_cast<uint32_t>(narrowCount);
+		indices.wideCount = static_cast<uint32_t>(wideCount);
+
+		struct MappedImage
+		{
+			uint32_t width;
+			uint32_t height;
+			uint32_t mipLevels;
+			TextureEncoding encoding;
+			const uint8_t* mips;
+		};
+		textureSamplers = reader.readVector<TextureSampler>();
+		std::vector<MappedImage> images(reader.readCount(sizeof(uint32_t) * 3 + sizeof(TextureEncoding) + sizeof(uint64_t)));
+		for (MappedImage& image : images)
+		{
+			image.width = reader.read<uint32_t>();
+			image.height = reader.read<uint32_t>();
+			image.mipLevels = reader.read<uint32_t>();
+			image.encoding = reader.read<TextureEncoding>();
+			size_t size;
+			image.mips = reader.readArray<uint8_t>(size);
+			//A chain that does not match its header falls back to a white texture
+			size_t expected = 0;
+			if (image.width > 0 && image.height > 0 && image.mipLevels <= 32 && image.encoding <= TextureEncoding::BC7)
+			{
+				for (uint32_t i = 0; i < image.mipLevels; i++)
+				{
+					expected += encodedSize(image.encoding, std::max(1u, image.width >> i), std::max(1u, image.height >> i));
+				}
+			}
+			if (expected == 0 || size != expected)
+			{
+				image.mips = nullptr;
+			}
+		}
+		const std::vector<LoaderInfo::CookedTexture> cookedTextures = reader.readVector<LoaderInfo::CookedTexture>();
+		//Materials point into textures, it must not reallocate once they are read
+		textures.resize(cookedTextures.size());
+
+		auto texture = [this](int32_t index) { return index >= 0 && index < static_cast<int32_t>(textures.size()) ? &textures[index] : nullptr; };
+		materials.resize(reader.readCount(sizeof(Material::AlphaMode)));
+		for (Material& material : materials)
+		{
+			material.alphaMode = reader.read<Material::AlphaMode>();
+			material.alphaCutoff = reader.read<float>();
+			material.metallicFactor = reader.read<float>();
+			material.roughnessFactor = reader.read<float>();
+			material.baseColorFactor = reader.read<glm::vec4>();
+			material.emissiveFactor = reader.read<glm::vec4>();
+			material.baseColorTexture = texture(reader.read<int32_t>());
+			material.metallicRoughnessTexture = texture(reader.read<int32_t>());
+			material.normalTexture = texture(reader.read<int32_t>());
+			material.occlusionTexture = texture(reader.read<int32_t>());
+			material.emissiveTexture = texture(reader.read<int32_t>());
+			material.doubleSided = reader.read<bool>();
+			material.texCoordSets = reader.read<Material::TexCoordSets>();
+			material.extension.specularGlossinessTexture = texture(reader.read<int32_t>());
+			material.extension.diffuseTexture = texture(reader.read<int32_t>());
+			material.extension.diffuseFactor = reader.read<glm::vec4>();
+			material.extension.specularFactor = reader.read<glm::vec3>();
+			material.pbrWorkflows = reader.read<Material::PbrWorkflows>();
+		}
+		//Primitives reference materials, the default one is always there
+		if (!reader.ok() || materials.empty())
+		{
+			std::cerr << "Scene cache " << filename << " is damaged, cooking again" << std::endl;
+			textures.clear();
+			textureSamplers.clear();
+			materials.clear();
+			return false;
+		}
+
+		// Every node exists before any link between them is resolved
+		linearNodes.resize(reader.readCount(sizeof(glm::mat4)));
+		for (Node*& node : linearNodes)
+		{
+			node = new Node{};
+		}
+		auto node = [this](int32_t index) { return index >= 0 && index < static_cast<int32_t>(linearNodes.size()) ? linearNodes[index] : nullptr; };
+		for (Node* newNode : linearNodes)
+		{
+			newNode->parent = node(reader.read<int32_t>());
+			newNode->index = reader.read<uint32_t>();
+			newNode->name = reader.readString();
+			newNode->skinIndex = reader.read<int32_t>();
+			newNode->matrix = reader.read<glm::mat4>();
+			newNode->translation = reader.read<glm::vec3>();
+			newNode->scale = reader.read<glm::vec3>();
+			newNode->rotation = reader.read<glm::quat>();
+			for (int32_t child : reader.readVector<int32_t>())
+			{
+				if (node(child))
+				{
+					newNode->children.push_back(node(child));
+				}
+			}
+			if (reader.read<uint8_t>())
+			{
+				newNode->mesh = new Mesh(newNode->matrix);
+				newNode->mesh->bb = reader.read<BoundingBox>();
+				const size_t primitiveCount = reader.readCount(sizeof(uint32_t) * 4);
+				for (size_t p = 0; p < primitiveCount && reader.ok(); p++)
+				{
+					const uint32_t firstIndex = reader.read<uint32_t>();
+					const uint32_t indexCount = reader.read<uint32_t>();
+					const uint32_t firstVertex = reader.read<uint32_t>();
+					const uint32_t primitiveVertexCount = reader.read<uint32_t>();
+					const bool wide = reader.read<bool>();
+					const uint32_t material = reader.read<uint32_t>();
+					Primitive* primitive = new Primitive(firstIndex, indexCount, primitiveVertexCount, materials[std::min<size_t>(material, materials.size() - 1)]);
+					primitive->firstVertex = firstVertex;
+					primitive->wideIndices = wide;
+					primitive->hasIndices = reader.read<bool>();
+					primitive->bb = reader.read<BoundingBox>();
+					primitive->lods = reader.readVector<Primitive::Lod>();
+					primitive->meshlets = reader.readVector<Meshlet>();
+					newNode->mesh->primitives.push_back(primitive);
+				}
+			}
+		}
+		for (int32_t root : reader.readVector<int32_t>())
+		{
+			if (node(root))
+			{
+				nodes.push_back(node(root));
+			}
+		}
+
+		skins.resize(reader.readCount(sizeof(uint64_t)));
+		for (Skin*& skin : skins)
+		{
+			skin = new Skin{};
+			skin->name = reader.readString();
+			skin->skeletonRoot = node(reader.read<int32_t>());
+			skin->inverseBindMatrices = reader.readVector<glm::mat4>();
+			for (int32_t joint : reader.readVector<int32_t>())
+			{
+				if (node(joint))
+				{
+					skin->joints.push_back(node(joint));
+				}
+			}
+		}
+
+		animations.resize(reader.readCount(sizeof(uint64_t)));
+		for (Animation& animation : animations)
+		{
+			animation.name = reader.readString();
+			animation.start = reader.read<float>();
+			animation.end = reader.read<float>();
+			animation.samplers.resize(reader.readCount(sizeof(AnimationSampler::InterpolationType)));
+			for (AnimationSampler& sampler : animation.samplers)
+			{
+				sampler.interpolation = reader.read<AnimationSampler::InterpolationType>();
+				sampler.inputs = reader.readVector<float>();
+				sampler.outputsVec4 = reader.readVector<glm::vec4>();
+			}
+			animation.channels.resize(reader.readCount(sizeof(AnimationChannel::PathType)));
+			for (AnimationChannel& channel : animation.channels)
+			{
+				channel.path = reader.read<AnimationChannel::PathType>();
+				channel.node = node(reader.read<int32_t>());
+				channel.samplerIndex = reader.read<uint32_t>();
+			}
+		}
+
+		extensions.resize(reader.readCount(sizeof(uint64_t)));
+		for (std::string& extension : extensions)
+		{
+			extension = reader.readString();
+		}
+
+		//Only a cache that read through completely creates GPU resources
+		if (!reader.ok() || vertexBufferSize == 0)
+		{
+			std::cerr << "Scene cache " << filename << " is damaged, cooking again" << std::endl;
+			for (Node* root : nodes)
+			{
+				delete root;
+			}
+			//Nodes that never made it into the hierarchy
+			for (Node* orphan : linearNodes)
+			{
+				if (!orphan->parent && std::find(nodes.begin(), nodes.end(), orphan) == nodes.end())
+				{
+					orphan->children.clear();
+					delete orphan;
+				}
+			}
+			for (Skin* skin : skins)
+			{
+				delete skin;
+			}
+			nodes.clear();
+			linearNodes.clear();
+			skins.clear();
+			textures.clear();
+			textureSamplers.clear();
+			materials.clear();
+			animations.clear();
+			extensions.clear();
+			return false;
+		}
+		loadTimings.parse = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+		// Textures upload their finished mip chains straight from the mapping, the first texture of an image owns it
+		tStart = std::chrono::high_resolution_clock::now();
+		std::vector<int64_t> imageOwners(images.size(), -1);
+		for (size_t i = 0; i < cookedTextures.size(); i++)
+		{
+			const LoaderInfo::CookedTexture& cooked = cookedTextures[i];
+			if (cooked.image >= 0 && cooked.image < static_cast<int32_t>(images.size()) && imageOwners[cooked.image] > -1)
+			{
+				textures[i].shareImage(textures[imageOwners[cooked.image]], cooked.sampler);
+			}
+			else if (cooked.image >= 0 && cooked.image < static_cast<int32_t>(images.size()) && images[cooked.image].mips && images[cooked.image].mipLevels > 0)
+			{
+				const MappedImage& image = images[cooked.image];
+				textures[i].createFromMipChain(image.mips, image.width, image.height, image.mipLevels, cooked.sampler, device, image.encoding);
+				imageOwners[cooked.image] = static_cast<int64_t>(i);
+			}
+			else
+			{
+				const unsigned char white[4] = { 255, 255, 255, 255 };
+				textures[i].createFromPixels(white, 1, 1, cooked.sampler, device);
+			}
+		}
+		countTextureSharing();
+		loadTimings.textures = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+		tStart = std::chrono::high_resolution_clock::now();
+		for (Node* cachedNode : linearNodes)
+		{
+			if (cachedNode->skinIndex > -1 && cachedNode->skinIndex < static_cast<int32_t>(skins.size()))
+			{
+				cachedNode->skin = skins[cachedNode->skinIndex];
+			}
+			if (cachedNode->mesh)
+			{
+				cachedNode->mesh->matrixOffset = matrixCount;
+				matrixCount += 1 + (cachedNode->skin ? static_cast<uint32_t>(cachedNode->skin->joints.size()) : 0);
+				cachedNode->update();
+			}
+		}
+
+		const size_t indexBufferSize = wideCount == 0 ? narrowCount * sizeof(uint16_t) : indices.wideOffset + wideCount * sizeof(uint32_t);
+		VK_CHECK_RESULT(device->createBuffer(
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			vertexBufferSize,
+			&vertices.buffer,
+			&vertices.memory));
 		if (indexBufferSize > 0)
 		{
-			vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
-			vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
+			VK_CHECK_RESULT(device->createBuffer(
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				indexBufferSize,
+				&indices.buffer,
+				&indices.memory));
+		}
+		device->staging->uploadBuffer(vertices.buffer, 0, packedVertices, vertexBufferSize);
+		if (narrowCount > 0)
+		{
+			device->staging->uploadBuffer(indices.buffer, 0, narrowIndices, narrowCount * sizeof(uint16_t));
 		}
+		if (wideCount > 0)
+		{
+			device->staging->uploadBuffer(indices.buffer, indices.wideOffset, wideIndices, wideCount * sizeof(uint32_t));
+		}
+		loadTimings.geometry = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
 
-		delete[] loaderInfo.vertexBuffer;
-		delete[] loaderInfo.indexBuffer;
+		// The mapping has to outlive the copies out of it
+		const uint32_t submitsBefore = device->staging->getStats().submits;
+		tStart = std::chrono::high_resolution_clock::now();
+		device->staging->flush();
+		loadTimings.submit = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		loadTimings.submits = device->staging->getStats().submits - submitsBefore;
+		std::cout << "Scene cache: loaded " << filename << " (" << file.length() / 1024 << " KB), read " << loadTimings.parse << " ms, textures " << loadTimings.textures
+			<< " ms, geometry " << loadTimings.geometry << " ms, upload " << loadTimings.submit << " ms (" << loadTimings.submits << " submits), " << vertexCount << " vertices" << std::endl;
 
 		getSceneDimensions();
+		buildDrawList();
+		return true;
+	}
+
+	void DrawList::clear()
+	{
+		alphaModes.clear();
+		pipelines.clear();
+		materials.clear();
+		nodes.clear();
+		firstIndices.clear();
+		indexCounts.clear();
+		firstVertices.clear();
+		vertexCounts.clear();
+		indexed.clear();
+		wideIndices.clear();
+		bounds.clear();
+		firstLods.clear();
+		lodCounts.clear();
+		lods.clear();
+		firstMeshlets.clear();
+		meshletCounts.clear();
+		meshlets.clear();
+	}
+
+	void Model::buildDrawList()
+	{
+		struct DrawItem
+		{
+			uint64_t key;
+			uint32_t node;
+			Primitive* primitive;
+		};
+		std::vector<DrawItem> items;
+		for (uint32_t nodeIndex = 0; nodeIndex < linearNodes.size(); nodeIndex++)
+		{
+			Node* node = linearNodes[nodeIndex];
+			if (!node->mesh)
+			{
+				continue;
+			}
+			for (Primitive* primitive : node->mesh->primitives)
+			{
+				const Material& material = primitive->material;
+				uint64_t pipeline = DrawList::PIPELINE_OPAQUE;
+				if (material.alphaMode == Material::ALPHAMODE_BLEND)
+				{
+					pipeline = DrawList::PIPELINE_BLEND;
+				}
+				else if (material.doubleSided)
+				{
+					pipeline = DrawList::PIPELINE_DOUBLE_SIDED;
+				}
+				uint64_t materialIndex = static_cast<uint64_t>(&material - materials.data());
+				//Draws sharing an index type stay together so the index buffer is rarely rebound
+				uint64_t wide = primitive->wideIndices ? 1 : 0;
+				uint64_t key = (static_cast<uint64_t>(material.alphaMode) << 62) | (pipeline << 60) | (wide << 59) | (materialIndex << 32) | nodeIndex;
+				items.push_back({ key, nodeIndex, primitive });
+			}
+		}
+		std::stable_sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+
+		drawList.clear();
+		for (const DrawItem& item : items)
+		{
+			const Primitive* primitive = item.primitive;
+			drawList.alphaModes.push_back(static_cast<uint8_t>(item.key >> 62));
+			drawList.pipelines.push_back(static_cast<uint8_t>((item.key >> 60) & 0x3));
+			drawList.materials.push_back(static_cast<uint32_t>((item.key >> 32) & 0x07FFFFFF));
+			drawList.nodes.push_back(item.node);
+			drawList.firstIndices.push_back(primitive->firstIndex);
+			drawList.indexCounts.push_back(primitive->indexCount);
+			drawList.firstVertices.push_back(static_cast<int32_t>(primitive->firstVertex));
+			drawList.vertexCounts.push_back(primitive->vertexCount);
+			drawList.indexed.push_back(primitive->hasIndices ? 1 : 0);
+			drawList.wideIndices.push_back(primitive->wideIndices ? 1 : 0);
+			drawList.bounds.push_back(primitive->bb);
+			drawList.firstLods.push_back(static_cast<uint32_t>(drawList.lods.size()));
+			drawList.lodCounts.push_back(static_cast<uint8_t>(primitive->lods.size()));
+			drawList.lods.insert(drawList.lods.end(), primitive->lods.begin(), primitive->lods.end());
+			drawList.firstMeshlets.push_back(static_cast<uint32_t>(drawList.meshlets.size()));
+			drawList.meshletCounts.push_back(static_cast<uint32_t>(primitive->meshlets.size()));
+			drawList.meshlets.insert(drawList.meshlets.end(), primitive->meshlets.begin(), primitive->meshlets.end());
+		}
 	}
 
 	void Model::drawNode(Node* node, VkCommandBuffer commandBuffer)
@@ -1172,7 +2936,8 @@ namespace vkglTF
 		{
 			for (Primitive* primitive : node->mesh->primitives)
 			{
-				vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, 0, 0);
+				bindIndexBuffer(commandBuffer, primitive->wideIndices);
+				vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, static_cast<int32_t>(primitive->firstVertex), 0);
 			}
 		}
 		for (auto& child : node->children)
@@ -1181,17 +2946,43 @@ namespace vkglTF
 		}
 	}
 
+	void Model::bindVertexBuffers(VkCommandBuffer commandBuffer) const
+	{
+		const VkBuffer buffers[VertexLayout::STREAM_COUNT] = { vertices.buffer, vertices.buffer, vertices.buffer, vertices.buffer };
+		vkCmdBindVertexBuffers(commandBuffer, 0, VertexLayout::STREAM_COUNT, buffers, vertices.streamOffsets);
+	}
+
+	void Model::bindIndexBuffer(VkCommandBuffer commandBuffer, bool wide) const
+	{
+		vkCmdBindIndexBuffer(commandBuffer, indices.buffer, wide ? indices.wideOffset : 0, wide ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16);
+	}
+
 	void Model::draw(VkCommandBuffer commandBuffer)
 	{
-		const VkDeviceSize offsets[1] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+		bindVertexBuffers(commandBuffer);
 		for (auto& node : nodes)
 		{
 			drawNode(node, commandBuffer);
 		}
 	}
 
+	//Copy every mesh's node and joint matrices into a palette of matrixCount entries
+	void Model::writeMatrices(glm::mat4* palette) const
+	{
+		for (auto node : linearNodes)
+		{
+			if (node->mesh)
+			{
+				const Mesh* mesh = node->mesh;
+				palette[mesh->matrixOffset] = mesh->matrix;
+				if (!mesh->jointMatrices.empty())
+				{
+					memcpy(&palette[mesh->matrixOffset + 1], mesh->jointMatrices.data(), mesh->jointMatrices.size() * sizeof(glm::mat4));
+				}
+			}
+		}
+	}
+
 	void Model::calculateBoundingBox(Node* node, Node* parent)
 	{
 		BoundingBox parentBvh = parent ? parent->bvh : BoundingBox(dimensions.min, dimensions.max);
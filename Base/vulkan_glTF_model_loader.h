@@ -1,12 +1,18 @@
 #pragma once
 
 #include "vulkan_device.h"
+#include "thread_pool.h"
+#include "mesh_optimizer.h"
+#include "mapped_file.h"
+#include "scene_cache.h"
+#include "texture_compressor.h"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 #include <gli/gli.hpp>
 #include <glm/gtx/string_cast.hpp>
 
@@ -20,7 +26,6 @@
 
 #include "tiny_gltf.h"
 
-#define MAX_NUM_JOINTS 128u
 
 namespace vkglTF
 {
@@ -33,7 +38,7 @@ namespace vkglTF
 		bool valid = false;
 		BoundingBox();
 		BoundingBox(glm::vec3 min, glm::vec3 max);
-		BoundingBox getAABB(glm::mat4 m);
+		BoundingBox getAABB(glm::mat4 m) const;
 	};
 
 	struct TextureSampler
@@ -50,17 +55,29 @@ namespace vkglTF
 		vulkan::VulkanDevice* device;
 		VkImage image;
 		VkImageLayout imageLayout;
-		VkDeviceMemory deviceMemory;
+		vulkan::Allocation deviceMemory;
 		VkImageView imageView;
 		uint32_t width, height;
 		uint32_t mipLevels;
 		uint32_t layerCount;
 		VkDescriptorImageInfo descriptor;
+		//Comes from the device's sampler cache and is not destroyed with the texture
 		VkSampler sampler;
+		//Image, view and memory belong to another texture, see shareImage
+		bool sharedImage = false;
+		TextureEncoding encoding = TextureEncoding::RGBA8;
 		void updateDescriptor();
 		void destroy();
-		//Load a texture from a glTF image (stored as a vector of chars loaded via stb_iamge) and generate a full mip chaing for it
-		void LoadFromglTfImage(tinygltf::Image& gltfimage, TextureSampler textureSampler, vulkan::VulkanDevice* device, VkQueue copyQueue);
+		//Create a texture from decoded RGBA pixels, the copy and the full mip chain go through the device's staging ring
+		void createFromPixels(const unsigned char* pixels, uint32_t width, uint32_t height, TextureSampler textureSampler, vulkan::VulkanDevice* device);
+		//Create a texture from a complete mip chain in the given encoding, levels tightly packed from the largest down
+		void createFromMipChain(const unsigned char* mips, uint32_t width, uint32_t height, uint32_t mipLevels, TextureSampler textureSampler, vulkan::VulkanDevice* device,
+			TextureEncoding encoding = TextureEncoding::RGBA8);
+		//Sample the image of owner with another sampler, owner has to outlive this texture
+		void shareImage(const Texture& owner, TextureSampler textureSampler);
+	private:
+		void createSampler(TextureSampler textureSampler);
+		void createSamplerAndView(TextureSampler textureSampler, VkFormat format);
 	};
 
 	struct Material
@@ -103,37 +120,42 @@ namespace vkglTF
 	};
 	struct Primitive
 	{
+		//First index in the model's narrow or wide index pool, indices are relative to firstVertex
 		uint32_t firstIndex;
 		uint32_t indexCount;
+		uint32_t firstVertex = 0;
 		uint32_t vertexCount;
+		//32 bit indices, only for primitives with more vertices than a 16 bit index reaches
+		bool wideIndices = false;
 		Material& material;
 		bool hasIndices;
 		BoundingBox bb;
+		//Simplified index ranges in the same pool, finest first. Error is the largest surface deviation relative to
+		//the primitive's extent, so a level can be drawn once error times the projected size is below a pixel threshold
+		struct Lod
+		{
+			uint32_t firstIndex;
+			uint32_t indexCount;
+			float error;
+		};
+		std::vector<Lod> lods;
+		//Contiguous parts of the full index range, culled one by one on the GPU-driven path
+		std::vector<Meshlet> meshlets;
 		Primitive(uint32_t firstIndex, uint32_t indexCount, uint32_t vertexCount, Material& material);
 		void setBoundingBox(glm::vec3 min, glm::vec3 max);
 	};
 
 	struct Mesh
 	{
-		vulkan::VulkanDevice* device;
 		std::vector<Primitive*> primitives;
 		BoundingBox bb;
 		BoundingBox aabb;
-		struct UniformBuffer
-		{
-			VkBuffer buffer;
-			VkDeviceMemory memory;
-			VkDescriptorBufferInfo descriptor;
-			VkDescriptorSet descriptorSet;
-			void* mapped;
-		} uniformBuffer;
-		struct UniformBlock
-		{
-			glm::mat4 matrix;
-			glm::mat4 jointMatrix[MAX_NUM_JOINTS]{};
-			float jointcount{ 0 };
-		} uniformBlock;
-		Mesh(vulkan::VulkanDevice* device, glm::mat4 matrix);
+		//World matrix and, for skinned meshes, one matrix per joint, written to the model's matrix palette
+		glm::mat4 matrix;
+		std::vector<glm::mat4> jointMatrices;
+		//First palette slot, the joint matrices follow the node matrix
+		uint32_t matrixOffset = 0;
+		Mesh(glm::mat4 matrix);
 		~Mesh();
 		void setBoundingBox(glm::vec3 min, glm::vec3 max);
 	};
@@ -192,6 +214,40 @@ namespace vkglTF
 		float end = std::numeric_limits<float>::min();
 	};
 
+	//Every primitive of a scene flattened into parallel arrays, sorted by (alphaMode, pipeline, material, node)
+	//so recording is a linear walk that only rebinds state when it actually changes
+	struct DrawList
+	{
+		enum PipelineKey : uint8_t { PIPELINE_OPAQUE = 0, PIPELINE_DOUBLE_SIDED = 1, PIPELINE_BLEND = 2 };
+
+		std::vector<uint8_t> alphaModes;
+		std::vector<uint8_t> pipelines;
+		std::vector<uint32_t> materials;
+		//Index into Model::linearNodes, selects the node uniform buffer
+		std::vector<uint32_t> nodes;
+		std::vector<uint32_t> firstIndices;
+		std::vector<uint32_t> indexCounts;
+		//Vertex offset of indexed draws, first vertex of the others
+		std::vector<int32_t> firstVertices;
+		std::vector<uint32_t> vertexCounts;
+		std::vector<uint8_t> indexed;
+		//Index type of the draw, see Model::bindIndexBuffer
+		std::vector<uint8_t> wideIndices;
+		//Primitive bounds in mesh space
+		std::vector<BoundingBox> bounds;
+		//Simplified levels of the draw, lodCounts[i] entries of lods starting at firstLods[i]
+		std::vector<uint32_t> firstLods;
+		std::vector<uint8_t> lodCounts;
+		std::vector<Primitive::Lod> lods;
+		//Meshlets of the draw, meshletCounts[i] entries of meshlets starting at firstMeshlets[i]
+		std::vector<uint32_t> firstMeshlets;
+		std::vector<uint32_t> meshletCounts;
+		std::vector<Meshlet> meshlets;
+
+		size_t size() const { return materials.size(); }
+		void clear();
+	};
+
 	struct Model
 	{
 
@@ -208,15 +264,65 @@ namespace vkglTF
 			glm::vec4 color;
 		};
 
+		//Vertex layout on the GPU, chosen per model from the attributes its primitives have. Positions stay float,
+		//normals are octahedral snorm16, UVs unorm16 when all of a set lie in [0,1] and float otherwise, joints uint8
+		//(uint16 above 256 joints), weights unorm16 and colors unorm8. The attributes are split into streams so depth-only passes fetch 12 bytes per vertex:
+		//positions, shading attributes and, for skinned models, joints and weights. Attributes no primitive has
+		//take no space, they are read from a constant block through a binding with a stride of 0.
+		//Each stream is bound at the binding of its index.
+		struct VertexLayout
+		{
+			enum Attribute { POSITION, NORMAL, UV0, UV1, JOINT0, WEIGHT0, COLOR0, ATTRIBUTE_COUNT };
+			enum Stream { STREAM_POSITION, STREAM_ATTRIBUTES, STREAM_SKINNING, STREAM_CONSTANTS, STREAM_COUNT };
+			static constexpr uint32_t ALL_ATTRIBUTES = (1u << ATTRIBUTE_COUNT) - 1;
+			//What a depth or shadow pass reads, unskinned models take joints and weights from the constant block
+			static constexpr uint32_t DEPTH_ATTRIBUTES = (1u << POSITION) | (1u << JOINT0) | (1u << WEIGHT0);
+			static constexpr uint32_t CONSTANT_BLOCK_SIZE = 32;
+			static constexpr VkDeviceSize STREAM_ALIGNMENT = 16;
+
+			bool present[ATTRIBUTE_COUNT] = {};
+			VkFormat formats[ATTRIBUTE_COUNT] = {};
+			//Stream the attribute is read from, STREAM_CONSTANTS for attributes that are not present
+			uint32_t streams[ATTRIBUTE_COUNT] = {};
+			//Offset in a vertex of its stream, or in the constant block
+			uint32_t offsets[ATTRIBUTE_COUNT] = {};
+			//Bytes per vertex in each stream, the constant stream has a stride of 0
+			uint32_t strides[STREAM_COUNT] = {};
+
+			VertexLayout() = default;
+			VertexLayout(const bool used[ATTRIBUTE_COUNT], uint32_t maxJoint, const bool unormTexCoords[2]);
+			//Bytes per vertex over all streams
+			uint32_t stride() const;
+			//Start of every stream in a buffer of count vertices, returns the size of the whole buffer
+			VkDeviceSize streamOffsets(size_t count, VkDeviceSize offsets[STREAM_COUNT]) const;
+			//Write count vertices into their streams followed by the constant block, dst holds streamOffsets(count) bytes
+			void pack(const Vertex* vertices, size_t count, uint8_t* dst) const;
+			//Write count vertices of one stream tightly at its stride, or the constant block for STREAM_CONSTANTS
+			void packStream(uint32_t stream, const Vertex* vertices, size_t count, uint8_t* dst) const;
+			//Locations match the attribute enum, bindings match the stream enum
+			std::vector<VkVertexInputAttributeDescription> attributeDescriptions(uint32_t attributeMask = ALL_ATTRIBUTES) const;
+			//Bindings of the streams the attributes in the mask are read from
+			std::vector<VkVertexInputBindingDescription> bindingDescriptions(uint32_t attributeMask = ALL_ATTRIBUTES) const;
+			bool operator==(const VertexLayout& other) const;
+			bool operator!=(const VertexLayout& other) const { return !(*this == other); }
+		};
+
 		struct Vertices
 		{
 			VkBuffer buffer = VK_NULL_HANDLE;
-			VkDeviceMemory memory;
+			vulkan::Allocation memory;
+			VertexLayout layout;
+			//All streams live in the one buffer, empty streams point at the constant block
+			VkDeviceSize streamOffsets[VertexLayout::STREAM_COUNT] = {};
 		} vertices;
+		//16 bit indices at the start of the buffer, 32 bit indices behind them at wideOffset
 		struct Indices
 		{
 			VkBuffer buffer = VK_NULL_HANDLE;
-			VkDeviceMemory memory;
+			vulkan::Allocation memory;
+			VkDeviceSize wideOffset = 0;
+			uint32_t narrowCount = 0;
+			uint32_t wideCount = 0;
 		} indices;
 
 		glm::mat4 aabb;
@@ -231,6 +337,94 @@ namespace vkglTF
 		std::vector<Material> materials;
 		std::vector<Animation> animations;
 		std::vector<std::string> extensions;
+		DrawList drawList;
+		//Palette slots used by all meshes, see Mesh::matrixOffset
+		uint32_t matrixCount = 0;
+		//Milliseconds spent in each stage of the last loadFromFile
+		struct LoadTimings
+		{
+			double parse = 0.0;
+			double decode = 0.0;
+			double textures = 0.0;
+			double geometry = 0.0;
+			double submit = 0.0;
+			double optimize = 0.0;
+			uint32_t decodeThreads = 0;
+			uint32_t submits = 0;
+		} loadTimings;
+		//Bytes the last loadFromFile copied on the CPU before they reached the staging ring, and the process peak after it
+		struct LoadMemory
+		{
+			size_t buffers = 0;
+			size_t images = 0;
+			size_t vertices = 0;
+			size_t indices = 0;
+			VkDeviceSize staged = 0;
+			size_t peakResident = 0;
+			//Most RGBA pixels and mip chains held at once while loading textures, and the waves they were decoded in
+			size_t texturePeak = 0;
+			uint32_t textureWaves = 0;
+		} loadMemory;
+		//GPU images and samplers the textures of the last load share
+		struct TextureStats
+		{
+			uint32_t images = 0;
+			uint32_t sharedImages = 0;
+			//Device memory the shared images would have taken on their own
+			VkDeviceSize savedBytes = 0;
+			//Distinct sampler handles, identical samplers come from the device's sampler cache
+			uint32_t samplers = 0;
+			//Block compressed images, their mip chains and what the same chains take as RGBA
+			uint32_t compressedImages = 0;
+			VkDeviceSize compressedBytes = 0;
+			VkDeviceSize uncompressedBytes = 0;
+		} textureStats;
+		//Bytes of decoded pixels and mip chains loadFromFile may hold at once, images are decoded and uploaded in waves that fit.
+		//0 decodes all images together. With a budget the scene cache is read but not written.
+		size_t textureMemoryBudget = 0;
+		//Encode textures to the BC format their material role needs, on devices with textureCompressionBC.
+		//Mip chains are built and encoded on the decode workers and cooked into the scene cache as they are
+		bool compressTextures = false;
+		//Keep texture coordinates as 32 bit floats even where they fit the unorm16 layout
+		bool floatTexCoords = false;
+		//Reorder the triangles and vertices of every indexed triangle list for the vertex cache, overdraw and fetch locality
+		bool optimizeMeshes = false;
+		//Simulated vertex cache behaviour of the optimized primitives before and after optimization
+		struct MeshStats
+		{
+			uint32_t primitives = 0;
+			VertexCacheStats before;
+			VertexCacheStats after;
+		} meshStats;
+		//Build a chain of simplified index ranges for every indexed triangle list, see Primitive::lods
+		bool generateLods = false;
+		//Simplified levels below the full primitive
+		static constexpr uint32_t MAX_LODS = 4;
+		//Primitives below twice this many triangles are not simplified, and no level goes below it
+		static constexpr uint32_t LOD_MIN_TRIANGLES = 64;
+		//Largest deviation a single level may add, relative to the primitive's extent
+		static constexpr float LOD_MAX_ERROR = 0.05f;
+		struct LodStats
+		{
+			uint32_t primitives = 0;
+			uint32_t levels = 0;
+			//Triangles of the full primitives and of all their simplified levels together
+			size_t triangles = 0;
+			size_t lodTriangles = 0;
+		} lodStats;
+		//Load from <file>.scenecache while the source files are unchanged, cook it after loading the source otherwise
+		bool useSceneCache = false;
+		//Split dense triangle lists into meshlets, see Primitive::meshlets
+		bool generateMeshlets = false;
+		//Primitives with fewer triangles are cheaper to cull as a whole
+		static constexpr uint32_t MESHLET_MIN_TRIANGLES = 4 * MESHLET_MAX_TRIANGLES;
+		struct MeshletStats
+		{
+			uint32_t primitives = 0;
+			uint32_t meshlets = 0;
+			//Meshlets whose normals are close enough to be culled as back facing
+			uint32_t cones = 0;
+		} meshletStats;
 
 		struct Dimensions
 		{
@@ -244,23 +438,81 @@ namespace vkglTF
 			Vertex* vertexBuffer;
 			size_t indexPos = 0;
 			size_t vertexPos = 0;
+			//Attributes any primitive has, selects the vertex layout
+			bool usedAttributes[VertexLayout::ATTRIBUTE_COUNT] = {};
+			uint32_t maxJoint = 0;
+			//Whether every coordinate of UV0 and UV1 lies in [0,1], tiled ones need the float layout
+			bool unitTexCoords[2] = { true, true };
+			//Indexed triangle lists, each owns its vertices and indices
+			struct TriangleList
+			{
+				uint32_t firstIndex;
+				uint32_t indexCount;
+				uint32_t firstVertex;
+				uint32_t vertexCount;
+				Primitive* primitive;
+				//Indices of the simplified levels, Primitive::lods index into this until the index pools are built
+				std::vector<uint32_t> lodIndices;
+			};
+			std::vector<TriangleList> triangleLists;
+			//Start of every glTF buffer, the BIN chunk of a mapped .glb is read in place
+			std::vector<const unsigned char*> bufferData;
+			//Encoded images read in place from the mapped .glb, the others are in tinygltf::Image::image
+			struct EncodedImage
+			{
+				const unsigned char* data = nullptr;
+				size_t size = 0;
+			};
+			std::vector<EncodedImage> encodedImages;
+			//Written to the scene cache: the mip chain of every image, and the image (-1 for none) and sampler of every texture
+			bool cookTextures = false;
+			//Encode the mip chains, Model::compressTextures on a device that can sample BC formats
+			bool compressTextures = false;
+			struct CookedImage
+			{
+				uint32_t width = 0;
+				uint32_t height = 0;
+				uint32_t mipLevels = 0;
+				TextureEncoding encoding = TextureEncoding::RGBA8;
+				std::vector<uint8_t> mips;
+			};
+			std::vector<CookedImage> cookedImages;
+			struct CookedTexture
+			{
+				int32_t image;
+				TextureSampler sampler;
+			};
+			std::vector<CookedTexture> cookedTextures;
 		};
 
 		void destroy(VkDevice device);
 		void loadNode(vkglTF::Node* parent, const tinygltf::Node& node, uint32_t nodeIndex, const tinygltf::Model& model, LoaderInfo& loaderInfo, float globalscale);
 		void getNodeProps(const tinygltf::Node& node, const tinygltf::Model& model, size_t& vertexCount, size_t& indexCount);
-		void loadSkins(tinygltf::Model& gltfModel);
-		void loadTextures(tinygltf::Model& gltfModel, vulkan::VulkanDevice* device, VkQueue transferQueue);
+		void loadSkins(tinygltf::Model& gltfModel, const LoaderInfo& loaderInfo);
+		void loadTextures(tinygltf::Model& gltfModel, vulkan::VulkanDevice* device, LoaderInfo& loaderInfo);
+		//Fill textureStats and print it
+		void countTextureSharing();
 		VkSamplerAddressMode getVkWrapMode(int32_t wrapMode);
 		VkFilter getVkFilterMode(int32_t filterMode);
 		void loadTextureSamplers(tinygltf::Model& gltfModel);
 		void loadMaterials(tinygltf::Model& gltfModel);
-		void loadAnimations(tinygltf::Model& gltfModel);
-		void loadFromFile(std::string filename, vulkan::VulkanDevice* device, VkQueue transferQueue, float scale = 1.0f);
+		void loadAnimations(tinygltf::Model& gltfModel, const LoaderInfo& loaderInfo);
+		void optimizePrimitives(LoaderInfo& loaderInfo);
+		void loadFromFile(std::string filename, vulkan::VulkanDevice* device, float scale = 1.0f);
+		//Rebuild the scene from a cache written by writeSceneCache, false if it is missing, stale or damaged
+		bool loadSceneCache(const std::string& filename, uint64_t options);
+		void writeSceneCache(const std::string& filename, uint64_t options, const std::vector<SceneCacheDependency>& dependencies, const LoaderInfo& loaderInfo,
+			const std::vector<uint8_t>& packedVertices, size_t vertexCount, const std::vector<uint16_t>& narrowIndices, const std::vector<uint32_t>& wideIndices) const;
 		void drawNode(Node* node, VkCommandBuffer commandBuffer);
+		//Bind every vertex stream at the binding of its index
+		void bindVertexBuffers(VkCommandBuffer commandBuffer) const;
+		//Bind the 16 or 32 bit index pool, firstIndex of a primitive is relative to the pool it uses
+		void bindIndexBuffer(VkCommandBuffer commandBuffer, bool wide) const;
 		void draw(VkCommandBuffer commandBuffer);
+		void writeMatrices(glm::mat4* palette) const;
 		void calculateBoundingBox(Node* node, Node* parent);
 		void getSceneDimensions();
+		void buildDrawList();
 		void updateAnimation(uint32_t index, float time);
 		Node* findNode(Node* parent, uint32_t index);
 		Node* nodeFromIndex(uint32_t index);
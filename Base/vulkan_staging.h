@@ -0,0 +1,513 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <cstring>
+
+#include "vulkan_base.h"
+#include "vulkan_allocator.h"
+
+namespace vulkan
+{
+	//One persistently mapped staging buffer used as a ring by every upload of a device.
+	//Uploads reserve space, write straight into the mapping and record their copies into the pending
+	//command buffer. The pending batch is submitted with a fence when the ring runs out of space or on
+	//submit()/flush(), and its space is reclaimed once that fence signals, so staging memory stays at the
+	//ring size no matter how much is uploaded.
+	//With a dedicated transfer queue family the copies run there, overlapping with rendering. Resources are
+	//then handed to the graphics family with transferOwnership(), whose acquire half and any graphics only
+	//work (blits) go into a second command buffer submitted after the copies.
+	class StagingRing
+	{
+	public:
+		//Space reserved for one upload, copies out of buffer at offset are recorded into commandBuffer.
+		//graphicsCommandBuffer runs after it on the graphics queue, it is the same buffer without a transfer queue.
+		struct Region
+		{
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceSize offset = 0;
+			void* mapped = nullptr;
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+		};
+
+		struct Stats
+		{
+			VkDeviceSize uploadedBytes = 0;
+			uint32_t submits = 0;
+			//Uploads that had to wait for the GPU to free ring space
+			uint32_t stalls = 0;
+			//Uploads larger than the ring, staged through a temporary buffer
+			uint32_t oversized = 0;
+		};
+
+		static constexpr VkDeviceSize DEFAULT_SIZE = 64ull * 1024 * 1024;
+
+		StagingRing(VkDevice device, MemoryAllocator* allocator, const VkPhysicalDeviceMemoryProperties& memoryProperties, const VkPhysicalDeviceLimits& limits,
+			uint32_t transferFamily, VkQueue transferQueue, uint32_t graphicsFamily, VkQueue graphicsQueue, std::mutex& queueMutex, VkDeviceSize size = DEFAULT_SIZE)
+			: device(device), allocator(allocator), memoryProperties(memoryProperties), transferFamily(transferFamily), transferQueue(transferQueue),
+			graphicsFamily(graphicsFamily), graphicsQueue(graphicsQueue), queueMutex(queueMutex)
+		{
+			//Offsets satisfy the texel and block size of every format used with vkCmdCopyBufferToImage
+			alignment = std::max<VkDeviceSize>(16, limits.optimalBufferCopyOffsetAlignment);
+			createBuffer(size, buffer, memory);
+			this->size = size;
+
+			transferPool = createCommandPool(transferFamily);
+			if (hasTransferQueue())
+			{
+				graphicsPool = createCommandPool(graphicsFamily);
+			}
+		}
+
+		~StagingRing()
+		{
+			flush();
+			for (VkFence fence : freeFences)
+			{
+				vkDestroyFence(device, fence, nullptr);
+			}
+			for (VkSemaphore semaphore : freeSemaphores)
+			{
+				vkDestroySemaphore(device, semaphore, nullptr);
+			}
+			vkDestroyCommandPool(device, transferPool, nullptr);
+			if (graphicsPool)
+			{
+				vkDestroyCommandPool(device, graphicsPool, nullptr);
+			}
+			vkDestroyBuffer(device, buffer, nullptr);
+			allocator->free(memory);
+		}
+
+		//Copies run on a queue family of their own
+		bool hasTransferQueue() const
+		{
+			return transferFamily != graphicsFamily;
+		}
+
+		//Reserve size bytes and let record fill them and record the transfer commands while the ring is held.
+		//Nothing recorded is executed before the next submit() or flush().
+		void upload(VkDeviceSize size, const std::function<void(const Region&)>& record)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			Region region{};
+			if (size > this->size)
+			{
+				//Too large for the ring, stage through a buffer released with the batch
+				Temporary temporary;
+				createBuffer(size, temporary.buffer, temporary.memory);
+				pending.temporaries.push_back(temporary);
+				region.buffer = temporary.buffer;
+				region.mapped = temporary.memory.mapped;
+				stats.oversized++;
+			}
+			else
+			{
+				region.buffer = buffer;
+				region.offset = reserve(size);
+				region.mapped = static_cast<uint8_t*>(memory.mapped) + region.offset;
+			}
+			begin();
+			region.commandBuffer = pending.transferCommandBuffer;
+			region.graphicsCommandBuffer = hasTransferQueue() ? pending.graphicsCommandBuffer : pending.transferCommandBuffer;
+			record(region);
+			stats.uploadedBytes += size;
+		}
+
+		//Copy data into dst, large copies are split so they never need more than a part of the ring.
+		//dstAccessMask and dstStageMask describe the first use of the data on the graphics queue.
+		void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size,
+			VkAccessFlags dstAccessMask = VK_ACCESS_MEMORY_READ_BIT, VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
+		{
+			uploadBuffer(dst, dstOffset, size, 1, [data](void* mapped, VkDeviceSize offset, VkDeviceSize chunk)
+			{
+				memcpy(mapped, static_cast<const uint8_t*>(data) + offset, chunk);
+			}, dstAccessMask, dstStageMask);
+		}
+
+		//Same for data that is produced while uploading: fill(mapped, offset, size) writes the bytes at offset of the
+		//range straight into the ring. Chunks are a multiple of granularity, so whole elements never straddle two of them.
+		void uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, VkDeviceSize granularity, const std::function<void(void*, VkDeviceSize, VkDeviceSize)>& fill,
+			VkAccessFlags dstAccessMask = VK_ACCESS_MEMORY_READ_BIT, VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT)
+		{
+			const VkDeviceSize chunkSize = std::max(granularity, this->size / 4 / granularity * granularity);
+			for (VkDeviceSize done = 0; done < size; done += chunkSize)
+			{
+				const VkDeviceSize chunk = std::min(chunkSize, size - done);
+				upload(chunk, [&](const Region& region)
+				{
+					fill(region.mapped, done, chunk);
+					VkBufferCopy copyRegion{ region.offset, dstOffset + done, chunk };
+					vkCmdCopyBuffer(region.commandBuffer, region.buffer, dst, 1, &copyRegion);
+					transferOwnership(region, dst, dstOffset + done, chunk, dstAccessMask, dstStageMask);
+				});
+			}
+		}
+
+		//Make a range written by the copies of region available to the graphics queue.
+		//Releases it from the transfer family and acquires it in graphicsCommandBuffer, or is a plain barrier without a transfer queue.
+		void transferOwnership(const Region& region, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask)
+		{
+			VkBufferMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = dstAccessMask;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = buffer;
+			barrier.offset = offset;
+			barrier.size = size;
+			if (!hasTransferQueue())
+			{
+				vkCmdPipelineBarrier(region.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+				return;
+			}
+			barrier.srcQueueFamilyIndex = transferFamily;
+			barrier.dstQueueFamilyIndex = graphicsFamily;
+			//Release, the access masks of the other queue are ignored
+			barrier.dstAccessMask = 0;
+			vkCmdPipelineBarrier(region.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+			//Acquire
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = dstAccessMask;
+			vkCmdPipelineBarrier(region.graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStageMask, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		}
+
+		//Image version, moves the subresources from oldLayout to newLayout on the way
+		void transferOwnership(const Region& region, VkImage image, VkImageSubresourceRange range, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags dstAccessMask, VkPipelineStageFlags dstStageMask)
+		{
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = dstAccessMask;
+			barrier.oldLayout = oldLayout;
+			barrier.newLayout = newLayout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange = range;
+			if (!hasTransferQueue())
+			{
+				vkCmdPipelineBarrier(region.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+				return;
+			}
+			barrier.srcQueueFamilyIndex = transferFamily;
+			barrier.dstQueueFamilyIndex = graphicsFamily;
+			barrier.dstAccessMask = 0;
+			vkCmdPipelineBarrier(region.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = dstAccessMask;
+			vkCmdPipelineBarrier(region.graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+
+		//Submit the pending copies without waiting for them
+		void submit()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			submitPending();
+		}
+
+		//Submit the pending copies and wait until everything uploaded so far is on the device
+		void flush()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			submitPending();
+			while (!inFlight.empty())
+			{
+				retireOldest();
+			}
+		}
+
+		Stats getStats()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return stats;
+		}
+
+		VkDeviceSize getSize() const { return size; }
+
+	private:
+		struct Temporary
+		{
+			VkBuffer buffer = VK_NULL_HANDLE;
+			Allocation memory;
+		};
+
+		struct Batch
+		{
+			VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+			VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+			//Orders the graphics half after the copies
+			VkSemaphore semaphore = VK_NULL_HANDLE;
+			VkFence fence = VK_NULL_HANDLE;
+			//Ring head after the batch's last reservation, the tail moves here once the fence signals
+			VkDeviceSize end = 0;
+			bool used = false;
+			std::vector<Temporary> temporaries;
+		};
+
+		VkDevice device;
+		MemoryAllocator* allocator;
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		uint32_t transferFamily;
+		VkQueue transferQueue;
+		uint32_t graphicsFamily;
+		VkQueue graphicsQueue;
+		std::mutex& queueMutex;
+		VkCommandPool transferPool = VK_NULL_HANDLE;
+		VkCommandPool graphicsPool = VK_NULL_HANDLE;
+
+		VkBuffer buffer = VK_NULL_HANDLE;
+		Allocation memory;
+		VkDeviceSize size = 0;
+		VkDeviceSize alignment = 16;
+		//Reserved space runs from tail to head, wrapping at the end of the buffer
+		VkDeviceSize head = 0;
+		VkDeviceSize tail = 0;
+
+		Batch pending;
+		std::deque<Batch> inFlight;
+		std::vector<VkCommandBuffer> freeTransferCommandBuffers;
+		std::vector<VkCommandBuffer> freeGraphicsCommandBuffers;
+		std::vector<VkFence> freeFences;
+		std::vector<VkSemaphore> freeSemaphores;
+		Stats stats;
+		std::mutex mutex;
+
+		void createBuffer(VkDeviceSize size, VkBuffer& buffer, Allocation& memory)
+		{
+			VkBufferCreateInfo bufferInfo{};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = size;
+			bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &buffer));
+
+			VkMemoryRequirements memReqs;
+			vkGetBufferMemoryRequirements(device, buffer, &memReqs);
+			const VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			uint32_t memoryType = UINT32_MAX;
+			for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+			{
+				if ((memReqs.memoryTypeBits & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+				{
+					memoryType = i;
+					break;
+				}
+			}
+			if (memoryType == UINT32_MAX)
+			{
+				throw std::runtime_error("failed to find host visible memory for the staging ring!");
+			}
+			memory = allocator->allocate(memReqs, memoryType, false);
+			VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, memory.memory, memory.offset));
+		}
+
+		bool empty() const
+		{
+			return !pending.used && inFlight.empty();
+		}
+
+		//Offset of size free bytes, submitting and waiting for older batches until they fit
+		VkDeviceSize reserve(VkDeviceSize size)
+		{
+			bool stalled = false;
+			while (true)
+			{
+				if (empty())
+				{
+					head = tail = 0;
+				}
+				VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+				bool fits;
+				if (empty())
+				{
+					fits = true;
+				}
+				else if (head > tail)
+				{
+					//Used space is [tail, head), try after it and then at the start of the ring
+					if (offset + size > this->size)
+					{
+						offset = 0;
+						fits = size <= tail;
+					}
+					else
+					{
+						fits = true;
+					}
+				}
+				else
+				{
+					//Used space wraps around (or covers the whole ring when head == tail), the gap is [head, tail)
+					fits = head < tail && offset + size <= tail;
+				}
+
+				if (fits)
+				{
+					head = offset + size;
+					pending.used = true;
+					return offset;
+				}
+
+				if (pending.used)
+				{
+					submitPending();
+				}
+				else
+				{
+					retireOldest();
+					if (!stalled)
+					{
+						stats.stalls++;
+						stalled = true;
+					}
+				}
+			}
+		}
+
+		VkCommandPool createCommandPool(uint32_t queueFamily)
+		{
+			VkCommandPoolCreateInfo poolInfo{};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.queueFamilyIndex = queueFamily;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			VkCommandPool pool;
+			VK_CHECK_RESULT(vkCreateCommandPool(device, &poolInfo, nullptr, &pool));
+			return pool;
+		}
+
+		VkCommandBuffer beginCommandBuffer(VkCommandPool pool, std::vector<VkCommandBuffer>& freeList)
+		{
+			VkCommandBuffer commandBuffer;
+			if (!freeList.empty())
+			{
+				commandBuffer = freeList.back();
+				freeList.pop_back();
+			}
+			else
+			{
+				VkCommandBufferAllocateInfo allocateInfo{};
+				allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+				allocateInfo.commandPool = pool;
+				allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+				allocateInfo.commandBufferCount = 1;
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+			}
+			VkCommandBufferBeginInfo beginInfo{};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+			return commandBuffer;
+		}
+
+		void begin()
+		{
+			if (pending.transferCommandBuffer)
+			{
+				return;
+			}
+			pending.transferCommandBuffer = beginCommandBuffer(transferPool, freeTransferCommandBuffers);
+			if (hasTransferQueue())
+			{
+				pending.graphicsCommandBuffer = beginCommandBuffer(graphicsPool, freeGraphicsCommandBuffers);
+			}
+		}
+
+		void submitPending()
+		{
+			if (!pending.transferCommandBuffer)
+			{
+				return;
+			}
+			VK_CHECK_RESULT(vkEndCommandBuffer(pending.transferCommandBuffer));
+
+			if (!freeFences.empty())
+			{
+				pending.fence = freeFences.back();
+				freeFences.pop_back();
+			}
+			else
+			{
+				VkFenceCreateInfo fenceInfo{};
+				fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+				VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &pending.fence));
+			}
+
+			VkSubmitInfo submitInfo{};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &pending.transferCommandBuffer;
+			if (!hasTransferQueue())
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &submitInfo, pending.fence));
+			}
+			else
+			{
+				VK_CHECK_RESULT(vkEndCommandBuffer(pending.graphicsCommandBuffer));
+				if (!freeSemaphores.empty())
+				{
+					pending.semaphore = freeSemaphores.back();
+					freeSemaphores.pop_back();
+				}
+				else
+				{
+					VkSemaphoreCreateInfo semaphoreInfo{};
+					semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+					VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &pending.semaphore));
+				}
+				submitInfo.signalSemaphoreCount = 1;
+				submitInfo.pSignalSemaphores = &pending.semaphore;
+
+				const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+				VkSubmitInfo graphicsSubmitInfo{};
+				graphicsSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+				graphicsSubmitInfo.waitSemaphoreCount = 1;
+				graphicsSubmitInfo.pWaitSemaphores = &pending.semaphore;
+				graphicsSubmitInfo.pWaitDstStageMask = &waitStage;
+				graphicsSubmitInfo.commandBufferCount = 1;
+				graphicsSubmitInfo.pCommandBuffers = &pending.graphicsCommandBuffer;
+
+				std::lock_guard<std::mutex> lock(queueMutex);
+				VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+				//The fence of the graphics half covers the copies too, it waits for them
+				VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &graphicsSubmitInfo, pending.fence));
+			}
+			stats.submits++;
+
+			pending.end = head;
+			inFlight.push_back(std::move(pending));
+			pending = Batch();
+		}
+
+		void retireOldest()
+		{
+			Batch& batch = inFlight.front();
+			VK_CHECK_RESULT(vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX));
+			VK_CHECK_RESULT(vkResetFences(device, 1, &batch.fence));
+			freeFences.push_back(batch.fence);
+			VK_CHECK_RESULT(vkResetCommandBuffer(batch.transferCommandBuffer, 0));
+			freeTransferCommandBuffers.push_back(batch.transferCommandBuffer);
+			if (batch.graphicsCommandBuffer)
+			{
+				VK_CHECK_RESULT(vkResetCommandBuffer(batch.graphicsCommandBuffer, 0));
+				freeGraphicsCommandBuffers.push_back(batch.graphicsCommandBuffer);
+				freeSemaphores.push_back(batch.semaphore);
+			}
+			for (auto& temporary : batch.temporaries)
+			{
+				vkDestroyBuffer(device, temporary.buffer, nullptr);
+				allocator->free(temporary.memory);
+			}
+			if (batch.used)
+			{
+				tail = batch.end;
+			}
+			inFlight.pop_front();
+		}
+	};
+}
@@ -34,6 +34,10 @@ public:
 	VkExtent2D extent = {};
 	uint32_t queueNodeIndex = UINT32_MAX;
 	VkPresentModeKHR presentMode;
+	//Headless mode renders into plain device images instead of presentable ones
+	bool headless = false;
+	uint32_t headlessIndex = 0;
+	std::vector<vulkan::Allocation> headlessMemory;
 
 	struct SwapChainSupportDetail
 	{
@@ -127,6 +131,56 @@ public:
 		}
 	}
 
+	//Create offscreen color targets standing in for the swapchain images, no surface or presentation engine required
+	void createHeadless(vulkan::VulkanDevice* device, uint32_t width, uint32_t height, VkFormat format, uint32_t count)
+	{
+		assert(device);
+
+		this->device = device;
+		headless = true;
+		headlessIndex = count - 1;
+		colorFormat = format;
+		imageCount = count;
+		extent = { width, height };
+		queueNodeIndex = device->queueFamilyIndices.graphicsFamily.value();
+
+		images.resize(imageCount);
+		buffers.resize(imageCount);
+		headlessMemory.resize(imageCount);
+		for (uint32_t i = 0; i < imageCount; i++)
+		{
+			VkImageCreateInfo imageCI{};
+			imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageCI.imageType = VK_IMAGE_TYPE_2D;
+			imageCI.format = colorFormat;
+			imageCI.extent = { width, height, 1 };
+			imageCI.mipLevels = 1;
+			imageCI.arrayLayers = 1;
+			imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			imageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			device->createImage(imageCI, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, images[i], headlessMemory[i]);
+
+			VkImageViewCreateInfo colorAttachmentView = {};
+			colorAttachmentView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			colorAttachmentView.format = colorFormat;
+			colorAttachmentView.components = {
+				VK_COMPONENT_SWIZZLE_R,
+				VK_COMPONENT_SWIZZLE_G,
+				VK_COMPONENT_SWIZZLE_B,
+				VK_COMPONENT_SWIZZLE_A
+			};
+			colorAttachmentView.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			colorAttachmentView.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			colorAttachmentView.image = images[i];
+
+			buffers[i].image = images[i];
+			VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &colorAttachmentView, nullptr, &buffers[i].view));
+		}
+	}
+
 	void connect(VkInstance instance, vulkan::VulkanDevice* device)
 	{
 		assert(device);
@@ -269,6 +323,13 @@ public:
 
 	VkResult acquireNextImage(VkSemaphore semaphore, uint32_t* imageIndex)
 	{
+		//Offscreen images are handed out round robin, the caller must not wait on the semaphore
+		if (headless)
+		{
+			headlessIndex = (headlessIndex + 1) % imageCount;
+			*imageIndex = headlessIndex;
+			return VK_SUCCESS;
+		}
 		if (VK_NULL_HANDLE == swapchain)
 		{
 			return VK_ERROR_OUT_OF_DATE_KHR;
@@ -282,6 +343,10 @@ public:
 	//Queue an image for presentation
 	VkResult queuePresent(VkQueue queue, uint32_t imageIndex, VkSemaphore waitSemaphore = VK_NULL_HANDLE)
 	{
+		if (headless)
+		{
+			return VK_SUCCESS;
+		}
 		VkPresentInfoKHR presentInfo = {};
 		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 		presentInfo.pNext = NULL;
@@ -299,6 +364,18 @@ public:
 
 	void cleanup()
 	{
+		if (headless)
+		{
+			for (uint32_t i = 0; i < imageCount; i++)
+			{
+				vkDestroyImageView(device->logicalDevice, buffers[i].view, nullptr);
+				vkDestroyImage(device->logicalDevice, images[i], nullptr);
+				device->freeMemory(headlessMemory[i]);
+			}
+			headlessMemory.clear();
+			imageCount = 0;
+			headless = false;
+		}
 		if (swapchain != VK_NULL_HANDLE)
 		{
 			for (uint32_t i = 0; i < imageCount; i++)
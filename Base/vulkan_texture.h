@@ -14,7 +14,7 @@ namespace vulkan
 		VulkanDevice* device;
 		VkImage image = VK_NULL_HANDLE;
 		VkImageLayout imageLayout;
-		VkDeviceMemory deviceMemory;
+		Allocation deviceMemory;
 		VkImageView imageView;
 		uint32_t width, height;
 		uint32_t mipLevels;
@@ -36,7 +36,7 @@ namespace vulkan
 			{
 				vkDestroySampler(device->logicalDevice, sampler, nullptr);
 			}
-			vkFreeMemory(device->logicalDevice, deviceMemory, nullptr);
+			device->freeMemory(deviceMemory);
 		}
 
 		void createSampler(VkFilter filter, VkSamplerAddressMode addressMode)
@@ -85,7 +85,7 @@ namespace vulkan
 	class Texture2D :public Texture
 	{
 	public:
-		void loadFromFile(std::string filename, VkFormat format, VulkanDevice* device, VkQueue copyQueue, VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+		void loadFromFile(std::string filename, VkFormat format, VulkanDevice* device, VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT, VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 		{
 			assert(device);
 
@@ -102,21 +102,7 @@ namespace vulkan
 			//VkFormatProperties formatProperties;
 			//vkGetPhysicalDeviceFormatProperties(device->physicalDevice, format, &formatProperties);
 
-			//Create a host-visible staging buffer that contains the raw image data.
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-			
-			device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, tex2D.size(), &stagingBuffer, &stagingMemory);
-
-			//Copy texture data into staging buffer.
-			VkMemoryRequirements memReqs;
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-			uint8_t* data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-			memcpy(data, tex2D.data(), tex2D.size());
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
-
-			//Setup buffer copy regions for each miplevel
+			//Setup buffer copy regions for each miplevel, relative to the staging region
 			std::vector<VkBufferImageCopy> bufferCopyRegions;
 			uint32_t offset = 0;
 			
@@ -158,33 +144,34 @@ namespace vulkan
 
 			//subresourceRange
 			VkImageSubresourceRange resourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
-			//Use a separate command buffer for texture loading
-			VkCommandBuffer copyCmdBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
-			//begin record command
-			device->beginCommandBuffer(copyCmdBuffer);
-
-			//Image barrier for optimal image(target)
-			device->recordTransitionImageLayout(copyCmdBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, resourceRange);
-			
-			//Copy miplevels from staging buffer
-			vkCmdCopyBufferToImage(
-				copyCmdBuffer,
-				stagingBuffer,
-				image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				static_cast<uint32_t>(bufferCopyRegions.size()),
-				bufferCopyRegions.data()
-			);
-
-			//Change texture image layout to shader read after all miplevels have been copied.
 			this->imageLayout = imageLayout;
-			device->recordTransitionImageLayout(copyCmdBuffer, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, imageLayout, resourceRange);
-			//Flush
-			device->flushCommandBuffer(copyCmdBuffer, copyQueue);
+			//Write the texture data straight into the device's staging ring and record the copy there
+			device->staging->upload(tex2D.size(), [&](const StagingRing::Region& region)
+			{
+				memcpy(region.mapped, tex2D.data(), tex2D.size());
+				for (auto& bufferCopyRegion : bufferCopyRegions)
+				{
+					bufferCopyRegion.bufferOffset += region.offset;
+				}
 
-			//Clean up
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
+				//Image barrier for optimal image(target)
+				device->recordTransitionImageLayout(region.commandBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, resourceRange);
+
+				//Copy miplevels from staging buffer
+				vkCmdCopyBufferToImage(
+					region.commandBuffer,
+					region.buffer,
+					image,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					static_cast<uint32_t>(bufferCopyRegions.size()),
+					bufferCopyRegions.data()
+				);
+
+				//Change texture image layout to shader read after all miplevels have been copied, handing it to the graphics queue.
+				device->staging->transferOwnership(region, image, resourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, imageLayout, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+			});
+			//Callers use the texture right away
+			device->staging->flush();
 
 			createSampler(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT);
 			createImageView(VK_IMAGE_VIEW_TYPE_2D, format, resourceRange);
@@ -199,7 +186,6 @@ namespace vulkan
 			uint32_t width,
 			uint32_t height,
 			VulkanDevice* device,
-			VkQueue copyQueue,
 			VkFilter filter = VK_FILTER_LINEAR,
 			VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
 			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
@@ -212,19 +198,6 @@ namespace vulkan
 			height = height;
 			mipLevels = 1;
 
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-
-			device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, bufferSize, &stagingBuffer, &stagingMemory);
-
-			//Copy texture data into staging buffer.
-			VkMemoryRequirements memReqs;
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-			uint8_t* data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-			memcpy(data, buffer, bufferSize);
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
-
 			VkBufferImageCopy bufferCopyRegion = {};
 			bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			bufferCopyRegion.imageSubresource.mipLevel = 0;
@@ -255,36 +228,34 @@ namespace vulkan
 			device->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, deviceMemory);
 
 			VkImageSubresourceRange resourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
-			// Use a separate command buffer for texture loading
-			VkCommandBuffer copyCmdBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
-			device->beginCommandBuffer(copyCmdBuffer);
-
-			//Image barrier for optimal image(target)
-			device->recordTransitionImageLayout(copyCmdBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, resourceRange);
-
-			//Copy miplevels from staging buffer
-			vkCmdCopyBufferToImage(
-				copyCmdBuffer,
-				stagingBuffer,
-				image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1,
-				&bufferCopyRegion
-			);
-
-			//Change texture image layout to shader read after all miplevels have been copied.
 			this->imageLayout = imageLayout;
-			device->recordTransitionImageLayout(copyCmdBuffer, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, imageLayout, resourceRange);
-			//Flush
-			device->flushCommandBuffer(copyCmdBuffer, copyQueue);
+			device->staging->upload(bufferSize, [&](const StagingRing::Region& region)
+			{
+				memcpy(region.mapped, buffer, bufferSize);
+				bufferCopyRegion.bufferOffset = region.offset;
+
+				//Image barrier for optimal image(target)
+				device->recordTransitionImageLayout(region.commandBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, resourceRange);
+
+				//Copy miplevels from staging buffer
+				vkCmdCopyBufferToImage(
+					region.commandBuffer,
+					region.buffer,
+					image,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					1,
+					&bufferCopyRegion
+				);
+
+				//Change texture image layout to shader read after all miplevels have been copied, handing it to the graphics queue.
+				device->staging->transferOwnership(region, image, resourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, imageLayout, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+			});
+			device->staging->flush();
 
 			//Create sampler
 			createSampler(filter, VK_SAMPLER_ADDRESS_MODE_REPEAT);
 			//Create view
 			createImageView(VK_IMAGE_VIEW_TYPE_2D, format, resourceRange);
-			//Clean up
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
 
 			updateDescriptor();
  		}
@@ -297,7 +268,6 @@ namespace vulkan
 			std::string filename,
 			VkFormat format,
 			VulkanDevice* device,
-			VkQueue copyQueue,
 			VkImageUsageFlags imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
 			VkImageLayout imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
 		{
@@ -310,19 +280,6 @@ namespace vulkan
 			height = static_cast<uint32_t>(texCube.extent().y);
 			mipLevels = static_cast<uint32_t>(texCube.levels());
 
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingMemory;
-
-			device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, texCube.size(), &stagingBuffer, &stagingMemory);
-
-			VkMemoryRequirements memReqs;
-			vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
-
-			uint8_t* data;
-			VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-			memcpy(data, texCube.data(), texCube.size());
-			vkUnmapMemory(device->logicalDevice, stagingMemory);
-
 			std::vector<VkBufferImageCopy> bufferCopyRegions;
 			size_t offset = 0;
 
@@ -371,36 +328,37 @@ namespace vulkan
 			device->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, deviceMemory);
 
 			VkImageSubresourceRange resourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 6 };
-			// Use a separate command buffer for texture loading
-			VkCommandBuffer copyCmdBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY);
-			device->beginCommandBuffer(copyCmdBuffer);
-
-			//Image barrier for optimal image(target)
-			device->recordTransitionImageLayout(copyCmdBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, resourceRange);
-
-			//Copy miplevels from staging buffer
-			vkCmdCopyBufferToImage(
-				copyCmdBuffer,
-				stagingBuffer,
-				image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				static_cast<uint32_t>(bufferCopyRegions.size()),
-				bufferCopyRegions.data()
-			);
-
-			//Change texture image layout to shader read after all miplevels have been copied.
 			this->imageLayout = imageLayout;
-			device->recordTransitionImageLayout(copyCmdBuffer, image, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, imageLayout, resourceRange);
-			//Flush
-			device->flushCommandBuffer(copyCmdBuffer, copyQueue);
+			device->staging->upload(texCube.size(), [&](const StagingRing::Region& region)
+			{
+				memcpy(region.mapped, texCube.data(), texCube.size());
+				for (auto& bufferCopyRegion : bufferCopyRegions)
+				{
+					bufferCopyRegion.bufferOffset += region.offset;
+				}
+
+				//Image barrier for optimal image(target)
+				device->recordTransitionImageLayout(region.commandBuffer, image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, resourceRange);
+
+				//Copy miplevels from staging buffer
+				vkCmdCopyBufferToImage(
+					region.commandBuffer,
+					region.buffer,
+					image,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					static_cast<uint32_t>(bufferCopyRegions.size()),
+					bufferCopyRegions.data()
+				);
+
+				//Change texture image layout to shader read after all miplevels have been copied, handing it to the graphics queue.
+				device->staging->transferOwnership(region, image, resourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, imageLayout, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+			});
+			device->staging->flush();
 
 			//Create sampler
 			createSampler(VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
 			//Create view
 			createImageView(VK_IMAGE_VIEW_TYPE_CUBE, format, resourceRange);
-			//Clean up
-			vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
-			vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
 			updateDescriptor();
 		}
 
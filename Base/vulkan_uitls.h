@@ -9,12 +9,19 @@
 
 #include "vulkan_device.h"
 
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#endif
+
 
 struct Buffer
 {
 	VkDevice device;
+	vulkan::VulkanDevice* vulkanDevice = nullptr;
 	VkBuffer buffer = VK_NULL_HANDLE;
-	VkDeviceMemory memory = VK_NULL_HANDLE;
+	vulkan::Allocation memory;
 	VkDescriptorBufferInfo descriptor;
 	int32_t count = 0;
 	void* mapped = nullptr;
@@ -23,6 +30,7 @@ struct Buffer
 	void create(vulkan::VulkanDevice* device, VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, bool mapping = true)
 	{
 		this->device = device->logicalDevice;
+		vulkanDevice = device;
 		limitedSize = device->properties.limits.nonCoherentAtomSize;
 		device->createBuffer(usageFlags, memoryPropertyFlags, size, &buffer, &memory);
 		descriptor = { buffer, 0, size };
@@ -38,9 +46,8 @@ struct Buffer
 			unmap();
 		}
 		vkDestroyBuffer(device, buffer, nullptr);
-		vkFreeMemory(device, memory, nullptr);
+		vulkanDevice->freeMemory(memory);
 		buffer = VK_NULL_HANDLE;
-		memory = VK_NULL_HANDLE;
 	}
 
 	void map()
@@ -49,7 +56,12 @@ struct Buffer
 		{
 			throw std::runtime_error("fail to map buffer memory, device was not initialized.");
 		}
-		VK_CHECK_RESULT(vkMapMemory(device, memory, 0, descriptor.range, 0, &mapped));
+		//Host visible allocations are persistently mapped by the allocator
+		mapped = memory.mapped;
+		if (!mapped)
+		{
+			throw std::runtime_error("fail to map buffer memory, memory is not host visible.");
+		}
 	}
 
 	void unmap()
@@ -58,19 +70,17 @@ struct Buffer
 		{
 			throw std::runtime_error("fail to unmap buffer memory, device was not initialized.");
 		}
-		if (mapped)
-		{
-			vkUnmapMemory(device, memory);
-			mapped = nullptr;
-		}
+		mapped = nullptr;
 	}
 
 	void flush(VkDeviceSize size = VK_WHOLE_SIZE)
 	{
 		VkMappedMemoryRange mappedRange{};
 		mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		mappedRange.memory = memory;
-		mappedRange.size = (size + limitedSize - 1) & ~(limitedSize - 1);
+		mappedRange.memory = memory.memory;
+		mappedRange.offset = memory.offset;
+		//Stay inside this allocation, the rest of the block belongs to other resources
+		mappedRange.size = size == VK_WHOLE_SIZE ? memory.size : std::min((size + limitedSize - 1) & ~(limitedSize - 1), memory.size);
 		VK_CHECK_RESULT(vkFlushMappedMemoryRanges(device, 1, &mappedRange));
 	}
 };
@@ -107,6 +117,7 @@ inline VkPipelineShaderStageCreateInfo loadShader(VkDevice device, std::string f
 	return stageCreateInfo;
 }
 
+#if defined(_WIN32)
 inline void readDirectory(const std::string& directory, const std::string& pattern, std::map<std::string, std::string>& filelist, bool recursive)
 {
 	std::string searchpattern(directory + "/" + pattern);
@@ -149,3 +160,42 @@ inline void readDirectory(const std::string& directory, const std::string& patte
 		}
 	}
 }
+#else
+inline void readDirectory(const std::string& directory, const std::string& pattern, std::map<std::string, std::string>& filelist, bool recursive)
+{
+	DIR* dir = opendir(directory.c_str());
+	if (!dir)
+	{
+		return;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		std::string cFileName(entry->d_name);
+		if ((cFileName == ".") || (cFileName == ".."))
+		{
+			continue;
+		}
+		std::string path = directory + "/" + cFileName;
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+		{
+			continue;
+		}
+		if (S_ISDIR(info.st_mode))
+		{
+			if (recursive)
+			{
+				readDirectory(path, pattern, filelist, recursive);
+			}
+		}
+		else if (fnmatch(pattern.c_str(), cFileName.c_str(), 0) == 0)
+		{
+			std::string filename(cFileName);
+			filename.erase(filename.find_last_of("."), std::string::npos);
+			filelist[filename] = path;
+		}
+	}
+	closedir(dir);
+}
+#endif
\ No newline at end of file
@@ -1 +1,8 @@
-D:/VulkanSDK/Bin/glslc.exe ./pbr_khr.frag -o pbr_khr.frag.spv
\ No newline at end of file
+D:/VulkanSDK/Bin/glslc.exe ./pbr.vert -o pbr.vert.spv
+D:/VulkanSDK/Bin/glslc.exe ./pbr_khr.frag -o pbr_khr.frag.spv
+D:/VulkanSDK/Bin/glslc.exe ./skybox.vert -o skybox.vert.spv
+D:/VulkanSDK/Bin/glslc.exe ./pbr_indirect.vert -o pbr_indirect.vert.spv
+D:/VulkanSDK/Bin/glslc.exe ./cull.comp -o cull.comp.spv
+D:/VulkanSDK/Bin/glslc.exe -DBINDLESS ./pbr.vert -o pbr_bindless.vert.spv
+D:/VulkanSDK/Bin/glslc.exe -DBINDLESS ./pbr_khr.frag -o pbr_khr_bindless.frag.spv
+D:/VulkanSDK/Bin/glslc.exe ./depth.vert -o depth.vert.spv
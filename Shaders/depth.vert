@@ -0,0 +1,47 @@
+#version 450
+
+// Depth prepass, only reads the position stream and for skinned meshes the skinning stream
+layout (location = 0) in vec3 inPos;
+layout (location = 4) in uvec4 inJoint0;
+layout (location = 5) in vec4 inWeight0;
+
+layout (set = 0, binding = 0) uniform UBO 
+{
+	mat4 projection;
+	mat4 model;
+	mat4 view;
+	vec3 camPos;
+} ubo;
+
+layout (std430, set = 2, binding = 0) readonly buffer NodeMatrices {
+	mat4 nodeMatrices[];
+};
+
+layout (push_constant) uniform PushConsts {
+	uint matrixOffset;
+	uint jointCount;
+	uint materialIndex;
+} pushConsts;
+
+// Same transform as pbr.vert, so the shading pass matches the depth exactly
+invariant gl_Position;
+
+void main() 
+{
+	vec4 locPos;
+	mat4 nodeMatrix = nodeMatrices[pushConsts.matrixOffset];
+	if (pushConsts.jointCount > 0) {
+		uint joints = pushConsts.matrixOffset + 1;
+		mat4 skinMat = 
+			inWeight0.x * nodeMatrices[joints + inJoint0.x] +
+			inWeight0.y * nodeMatrices[joints + inJoint0.y] +
+			inWeight0.z * nodeMatrices[joints + inJoint0.z] +
+			inWeight0.w * nodeMatrices[joints + inJoint0.w];
+		locPos = ubo.model * nodeMatrix * skinMat * vec4(inPos, 1.0);
+	} else {
+		locPos = ubo.model * nodeMatrix * vec4(inPos, 1.0);
+	}
+	locPos.y = -locPos.y;
+	vec3 worldPos = locPos.xyz / locPos.w;
+	gl_Position =  ubo.projection * ubo.view * vec4(worldPos, 1.0);
+}
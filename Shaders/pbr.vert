@@ -1,10 +1,10 @@
 #version 450
 
 layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec3 inNormal;
+layout (location = 1) in vec2 inNormal;
 layout (location = 2) in vec2 inUV0;
 layout (location = 3) in vec2 inUV1;
-layout (location = 4) in vec4 inJoint0;
+layout (location = 4) in uvec4 inJoint0;
 layout (location = 5) in vec4 inWeight0;
 layout (location = 6) in vec4 inColor0;
 
@@ -16,13 +16,16 @@ layout (set = 0, binding = 0) uniform UBO
 	vec3 camPos;
 } ubo;
 
-#define MAX_NUM_JOINTS 128
+// Node matrices of the whole scene, skinned meshes keep their joint matrices right after the node matrix
+layout (std430, set = 2, binding = 0) readonly buffer NodeMatrices {
+	mat4 nodeMatrices[];
+};
 
-layout (set = 2, binding = 0) uniform UBONode {
-	mat4 matrix;
-	mat4 jointMatrix[MAX_NUM_JOINTS];
-	float jointCount;
-} node;
+layout (push_constant) uniform PushConsts {
+	uint matrixOffset;
+	uint jointCount;
+	uint materialIndex;
+} pushConsts;
 
 layout (location = 0) out vec3 outWorldPos;
 layout (location = 1) out vec3 outNormal;
@@ -30,28 +33,51 @@ layout (location = 2) out vec2 outUV0;
 layout (location = 3) out vec2 outUV1;
 layout (location = 4) out vec4 outColor0;
 
+#ifdef BINDLESS
+layout (location = 5) flat out uint outMaterialIndex;
+#endif
+
+// Matches depth.vert for the depth prepass
+invariant gl_Position;
+
+// Normals are stored octahedral encoded in two snorm components
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
 void main() 
 {
 	outColor0 = inColor0;
+	vec3 normal = octDecode(inNormal);
 
 	vec4 locPos;
-	if (node.jointCount > 0.0) {
+	mat4 nodeMatrix = nodeMatrices[pushConsts.matrixOffset];
+	if (pushConsts.jointCount > 0) {
 		// Mesh is skinned
+		uint joints = pushConsts.matrixOffset + 1;
 		mat4 skinMat = 
-			inWeight0.x * node.jointMatrix[int(inJoint0.x)] +
-			inWeight0.y * node.jointMatrix[int(inJoint0.y)] +
-			inWeight0.z * node.jointMatrix[int(inJoint0.z)] +
-			inWeight0.w * node.jointMatrix[int(inJoint0.w)];
+			inWeight0.x * nodeMatrices[joints + inJoint0.x] +
+			inWeight0.y * nodeMatrices[joints + inJoint0.y] +
+			inWeight0.z * nodeMatrices[joints + inJoint0.z] +
+			inWeight0.w * nodeMatrices[joints + inJoint0.w];
 
-		locPos = ubo.model * node.matrix * skinMat * vec4(inPos, 1.0);
-		outNormal = normalize(transpose(inverse(mat3(ubo.model * node.matrix * skinMat))) * inNormal);
+		locPos = ubo.model * nodeMatrix * skinMat * vec4(inPos, 1.0);
+		outNormal = normalize(transpose(inverse(mat3(ubo.model * nodeMatrix * skinMat))) * normal);
 	} else {
-		locPos = ubo.model * node.matrix * vec4(inPos, 1.0);
-		outNormal = normalize(transpose(inverse(mat3(ubo.model * node.matrix))) * inNormal);
+		locPos = ubo.model * nodeMatrix * vec4(inPos, 1.0);
+		outNormal = normalize(transpose(inverse(mat3(ubo.model * nodeMatrix))) * normal);
 	}
 	locPos.y = -locPos.y;
 	outWorldPos = locPos.xyz / locPos.w;
 	outUV0 = inUV0;
 	outUV1 = inUV1;
+#ifdef BINDLESS
+	outMaterialIndex = pushConsts.materialIndex;
+#endif
 	gl_Position =  ubo.projection * ubo.view * vec4(outWorldPos, 1.0);
 }
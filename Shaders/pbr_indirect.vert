@@ -0,0 +1,82 @@
+#version 450
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec2 inNormal;
+layout (location = 2) in vec2 inUV0;
+layout (location = 3) in vec2 inUV1;
+layout (location = 4) in uvec4 inJoint0;
+layout (location = 5) in vec4 inWeight0;
+layout (location = 6) in vec4 inColor0;
+
+layout (set = 0, binding = 0) uniform UBO 
+{
+	mat4 projection;
+	mat4 model;
+	mat4 view;
+	vec3 camPos;
+} ubo;
+
+// Written once per scene, firstInstance of each indirect command is the draw index
+struct DrawData
+{
+	uint firstIndex;
+	uint indexCount;
+	// Palette slot of the node matrix
+	uint node;
+	uint batch;
+	uint commandOffset;
+	uint material;
+	int vertexOffset;
+	uint padding;
+	vec4 bbMin;
+	vec4 bbMax;
+	// Meshlet bounding sphere, w is negative for whole primitives
+	vec4 sphere;
+	// Meshlet normal cone, w is 1 when it can not be back facing as a whole
+	vec4 cone;
+};
+
+layout (std430, set = 2, binding = 0) readonly buffer Draws {
+	DrawData draws[];
+};
+
+layout (std430, set = 2, binding = 1) readonly buffer NodeMatrices {
+	mat4 nodeMatrices[];
+};
+
+layout (location = 0) out vec3 outWorldPos;
+layout (location = 1) out vec3 outNormal;
+layout (location = 2) out vec2 outUV0;
+layout (location = 3) out vec2 outUV1;
+layout (location = 4) out vec4 outColor0;
+layout (location = 5) flat out uint outMaterialIndex;
+
+// Matches depth.vert for the depth prepass
+invariant gl_Position;
+
+// Normals are stored octahedral encoded in two snorm components
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
+void main() 
+{
+	outColor0 = inColor0;
+	vec3 normal = octDecode(inNormal);
+
+	// Skinned primitives are never drawn indirectly
+	mat4 nodeMatrix = nodeMatrices[draws[gl_InstanceIndex].node];
+	vec4 locPos = ubo.model * nodeMatrix * vec4(inPos, 1.0);
+	outNormal = normalize(transpose(inverse(mat3(ubo.model * nodeMatrix))) * normal);
+	locPos.y = -locPos.y;
+	outWorldPos = locPos.xyz / locPos.w;
+	outUV0 = inUV0;
+	outUV1 = inUV1;
+	outMaterialIndex = draws[gl_InstanceIndex].material;
+	gl_Position =  ubo.projection * ubo.view * vec4(outWorldPos, 1.0);
+}
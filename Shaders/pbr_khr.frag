@@ -3,6 +3,10 @@
 
 #version 450
 
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
 layout (location = 0) in vec3 inWorldPos;
 layout (location = 1) in vec3 inNormal;
 layout (location = 2) in vec2 inUV0;
@@ -26,6 +30,7 @@ layout (set = 0, binding = 1) uniform UBOParams {
 	float scaleIBLAmbient;
 	float debugViewInputs;
 	float debugViewEquation;
+	float forceSpecularGlossiness;
 } uboParams;
 
 layout (set = 0, binding = 2) uniform samplerCube samplerIrradiance;
@@ -34,14 +39,54 @@ layout (set = 0, binding = 4) uniform sampler2D samplerBRDFLUT;
 
 // Material bindings
 
+#ifdef BINDLESS
+layout (location = 5) flat in uint inMaterialIndex;
+
+// Texture members index the textures array, 0 is an empty texture
+struct MaterialData {
+	vec4 baseColorFactor;
+	vec4 emissiveFactor;
+	vec4 diffuseFactor;
+	vec4 specularFactor;
+	float workflow;
+	int baseColorTextureSet;
+	int physicalDescriptorTextureSet;
+	int normalTextureSet;	
+	int occlusionTextureSet;
+	int emissiveTextureSet;
+	float metallicFactor;	
+	float roughnessFactor;	
+	float alphaMask;	
+	float alphaMaskCutoff;
+	int baseColorTexture;
+	int physicalDescriptorTexture;
+	int normalTexture;
+	int occlusionTexture;
+	int emissiveTexture;
+};
+
+layout (std430, set = 1, binding = 0) readonly buffer Materials {
+	MaterialData materials[];
+};
+
+layout (set = 1, binding = 1) uniform sampler2D textures[];
+
+#define material materials[inMaterialIndex]
+#define colorMap textures[nonuniformEXT(material.baseColorTexture)]
+#define physicalDescriptorMap textures[nonuniformEXT(material.physicalDescriptorTexture)]
+#define normalMap textures[nonuniformEXT(material.normalTexture)]
+#define aoMap textures[nonuniformEXT(material.occlusionTexture)]
+#define emissiveMap textures[nonuniformEXT(material.emissiveTexture)]
+#else
 layout (set = 1, binding = 0) uniform sampler2D colorMap;
 layout (set = 1, binding = 1) uniform sampler2D physicalDescriptorMap;
 layout (set = 1, binding = 2) uniform sampler2D normalMap;
 layout (set = 1, binding = 3) uniform sampler2D aoMap;
 layout (set = 1, binding = 4) uniform sampler2D emissiveMap;
 
+// The first 16 bytes belong to the vertex stage
 layout (push_constant) uniform Material {
-	vec4 baseColorFactor;
+	layout (offset = 16) vec4 baseColorFactor;
 	vec4 emissiveFactor;
 	vec4 diffuseFactor;
 	vec4 specularFactor;
@@ -56,6 +101,7 @@ layout (push_constant) uniform Material {
 	float alphaMask;	
 	float alphaMaskCutoff;
 } material;
+#endif
 
 layout (location = 0) out vec4 outColor;
 
@@ -118,11 +164,21 @@ vec4 SRGBtoLINEAR(vec4 srgbIn)
 	#endif //MANUAL_SRGB
 }
 
+// Tangent space normal from the normal map
+// Only x and y are read, z is rebuilt so two channel (BC5) normal maps work as well
+vec3 getTangentNormal()
+{
+	vec3 tangentNormal;
+	tangentNormal.xy = texture(normalMap, material.normalTextureSet == 0 ? inUV0 : inUV1).xy * 2.0 - 1.0;
+	tangentNormal.z = sqrt(max(0.0, 1.0 - dot(tangentNormal.xy, tangentNormal.xy)));
+	return tangentNormal;
+}
+
 // Find the normal for this fragment, pulling either from a predefined normal map
 vec3 getNormal()
 {
 	// Perturb normal, see http://www.thetenthplanet.de/archives/1180
-	vec3 tangentNormal = texture(normalMap, material.normalTextureSet == 0 ? inUV0 : inUV1).xyz * 2.0 - 1.0;
+	vec3 tangentNormal = getTangentNormal();
 
 	vec3 q1 = dFdx(inWorldPos);
 	vec3 q2 = dFdy(inWorldPos);
@@ -213,9 +269,15 @@ void main()
 
 	vec3 f0 = vec3(0.04);
 
+	// The debug view can force the specular glossiness workflow, materials authored without it have no textures for it
+	bool forceSpecularGlossiness = uboParams.forceSpecularGlossiness > 0.0 && material.workflow != PBR_WORKFLOW_SPECULAR_GLOSINESS;
+	float workflow = forceSpecularGlossiness ? PBR_WORKFLOW_SPECULAR_GLOSINESS : material.workflow;
+	int baseColorTextureSet = forceSpecularGlossiness ? -1 : material.baseColorTextureSet;
+	int physicalDescriptorTextureSet = forceSpecularGlossiness ? -1 : material.physicalDescriptorTextureSet;
+
 	if (material.alphaMask == 1.0f) {
-		if (material.baseColorTextureSet > -1) {
-			baseColor = SRGBtoLINEAR(texture(colorMap, material.baseColorTextureSet == 0 ? inUV0 : inUV1)) * material.baseColorFactor;
+		if (baseColorTextureSet > -1) {
+			baseColor = SRGBtoLINEAR(texture(colorMap, baseColorTextureSet == 0 ? inUV0 : inUV1)) * material.baseColorFactor;
 		} else {
 			baseColor = material.baseColorFactor;
 		}
@@ -224,7 +286,7 @@ void main()
 		}
 	}
 
-	if (material.workflow == PBR_WORKFLOW_METALLIC_ROUGHNESS) {
+	if (workflow == PBR_WORKFLOW_METALLIC_ROUGHNESS) {
 		// Metallic and Roughness material properties are packed together
 		// In glTF, these factors can be specified by fixed scalar values
 		// or from a metallic-roughness map
@@ -251,10 +313,10 @@ void main()
 		}
 	}
 
-	if (material.workflow == PBR_WORKFLOW_SPECULAR_GLOSINESS) {
+	if (workflow == PBR_WORKFLOW_SPECULAR_GLOSINESS) {
 		// Values from specular glossiness workflow are converted to metallic roughness
-		if (material.physicalDescriptorTextureSet > -1) {
-			perceptualRoughness = 1.0 - texture(physicalDescriptorMap, material.physicalDescriptorTextureSet == 0 ? inUV0 : inUV1).a;
+		if (physicalDescriptorTextureSet > -1) {
+			perceptualRoughness = 1.0 - texture(physicalDescriptorMap, physicalDescriptorTextureSet == 0 ? inUV0 : inUV1).a;
 		} else {
 			perceptualRoughness = 0.0;
 		}
@@ -397,7 +459,7 @@ void main()
 		int index = int(uboParams.debugViewInputs);
 		switch (index) {
 			case 2:
-				outColor.rgb = (material.normalTextureSet > -1) ? texture(normalMap, material.normalTextureSet == 0 ? inUV0 : inUV1).rgb : normalize(inNormal);
+				outColor.rgb = (material.normalTextureSet > -1) ? getTangentNormal() * 0.5 + 0.5 : normalize(inNormal);
 				break;
 			case 3:
 				outColor.rgb = (material.occlusionTextureSet > -1) ? texture(aoMap, material.occlusionTextureSet == 0 ? inUV0 : inUV1).rrr : vec3(0.0f);
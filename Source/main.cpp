@@ -39,4 +39,16 @@ int main(const int argc, const char* argv[])
 	}
 	return 0;
 }
+#else
+//Headless only, see VulkanExampleBase::renderLoop
+int main(const int argc, const char* argv[])
+{
+	for (int32_t i = 0; i < argc; i++) { Renderer::args.push_back(argv[i]); };
+	vulkanExample = new Renderer();
+	vulkanExample->initVulkan();
+	vulkanExample->prepare();
+	vulkanExample->renderLoop();
+	delete(vulkanExample);
+	return 0;
+}
 #endif
\ No newline at end of file
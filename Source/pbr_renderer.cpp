@@ -1,100 +1,398 @@
 
 #include "pbr_renderer.h"
 
-void Renderer::renderNode(vkglTF::Node* node, uint32_t cbIndex, vkglTF::Material::AlphaMode alphaMode)
+//Pack the material parameters into push constant blocks once, the draw list only refers to them by index
+void Renderer::updateMaterialPushConstants()
 {
-	if (node->mesh)
+	const std::vector<vkglTF::Material>& materials = modelSet.scene.materials;
+	materialPushConstants.resize(materials.size());
+	for (size_t i = 0; i < materials.size(); i++)
 	{
-		// Render mesh primitives
-		for (vkglTF::Primitive* primitive : node->mesh->primitives)
+		const vkglTF::Material& material = materials[i];
+		PushConstBlockMaterial& pushConstBlockMaterial = materialPushConstants[i];
+		pushConstBlockMaterial = {};
+		pushConstBlockMaterial.emissiveFactor = material.emissiveFactor;
+		// To save push constant space, availabilty and texture coordiante set are combined
+		// -1 = texture not used for this material, >= 0 texture used and index of texture coordinate set
+		pushConstBlockMaterial.colorTextureSet = material.baseColorTexture != nullptr ? material.texCoordSets.baseColor : -1;
+		pushConstBlockMaterial.normalTextureSet = material.normalTexture != nullptr ? material.texCoordSets.normal : -1;
+		pushConstBlockMaterial.occlusionTextureSet = material.occlusionTexture != nullptr ? material.texCoordSets.occlusion : -1;
+		pushConstBlockMaterial.emissiveTextureSet = material.emissiveTexture != nullptr ? material.texCoordSets.emissive : -1;
+		pushConstBlockMaterial.alphaMask = static_cast<float>(material.alphaMode == vkglTF::Material::ALPHAMODE_MASK);
+		pushConstBlockMaterial.alphaMaskCutoff = material.alphaCutoff;
+		//Set for every workflow, the debug view can force specular glossiness in the shader
+		pushConstBlockMaterial.diffuseFactor = material.extension.diffuseFactor;
+		pushConstBlockMaterial.specularFactor = glm::vec4(material.extension.specularFactor, 1.0f);
+
+		// TODO: glTF specs states that metallic roughness should be preferred, even if specular glosiness is present
+
+		if (material.pbrWorkflows.metallicRoughness)
 		{
-			if (primitive->material.alphaMode == alphaMode)
-			{
+			// Metallic roughness workflow
+			pushConstBlockMaterial.workflow = static_cast<float>(PBR_WORKFLOW_METALLIC_ROUGHNESS);
+			pushConstBlockMaterial.baseColorFactor = material.baseColorFactor;
+			pushConstBlockMaterial.metallicFactor = material.metallicFactor;
+			pushConstBlockMaterial.roughnessFactor = material.roughnessFactor;
+			pushConstBlockMaterial.PhysicalDescriptorTextureSet = material.metallicRoughnessTexture != nullptr ? material.texCoordSets.metallicRoughness : -1;
+			pushConstBlockMaterial.colorTextureSet = material.baseColorTexture != nullptr ? material.texCoordSets.baseColor : -1;
+		}
 
-				VkPipeline pipeline = VK_NULL_HANDLE;
-				switch (alphaMode)
-				{
-				case vkglTF::Material::ALPHAMODE_OPAQUE:
-				case vkglTF::Material::ALPHAMODE_MASK:
-					pipeline = primitive->material.doubleSided ? pipelineSet.pbrDoubleSided : pipelineSet.pbr;
-					break;
-				case vkglTF::Material::ALPHAMODE_BLEND:
-					pipeline = pipelineSet.pbrAlphaBlend;
-					break;
-				}
+		if (material.pbrWorkflows.specularGlossiness)
+		{
+			// Specular glossiness workflow
+			pushConstBlockMaterial.workflow = static_cast<float>(PBR_WORKFLOW_SPECULAR_GLOSINESS);
+			pushConstBlockMaterial.PhysicalDescriptorTextureSet = material.extension.specularGlossinessTexture != nullptr ? material.texCoordSets.specularGlossiness : -1;
+			pushConstBlockMaterial.colorTextureSet = material.extension.diffuseTexture != nullptr ? material.texCoordSets.baseColor : -1;
+		}
+	}
+}
 
-				if (pipeline != boundPipeline)
-				{
-					vkCmdBindPipeline(commandBuffers[cbIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-					boundPipeline = pipeline;
-				}
+//Walk the sorted draw list, only binding pipelines, descriptor sets and push constants when they change
+void Renderer::recordDrawList(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool cull, size_t first, size_t last, DrawStats& stats)
+{
+	vkglTF::Model& model = modelSet.scene;
+	const vkglTF::DrawList& drawList = model.drawList;
+	VkPipeline pipelines[3] = { pipelineSet.pbr, pipelineSet.pbrDoubleSided, pipelineSet.pbrAlphaBlend };
+	VkPipelineLayout layout = pipelineLayout;
+	if (bindless.active)
+	{
+		pipelines[0] = bindless.pbr;
+		pipelines[1] = bindless.pbrDoubleSided;
+		pipelines[2] = bindless.pbrAlphaBlend;
+		layout = bindless.pipelineLayout;
+	}
 
-				const std::vector<VkDescriptorSet> descriptorsets = {
-					descriptorSets[cbIndex].scene,
-					primitive->material.descriptorSet,
-					node->mesh->uniformBuffer.descriptorSet,
-				};
-				vkCmdBindDescriptorSets(commandBuffers[cbIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorsets.size()), descriptorsets.data(), 0, NULL);
-
-				// Pass material parameters as push constants
-				PushConstBlockMaterial pushConstBlockMaterial{};
-				pushConstBlockMaterial.emissiveFactor = primitive->material.emissiveFactor;
-				// To save push constant space, availabilty and texture coordiante set are combined
-				// -1 = texture not used for this material, >= 0 texture used and index of texture coordinate set
-				pushConstBlockMaterial.colorTextureSet = primitive->material.baseColorTexture != nullptr ? primitive->material.texCoordSets.baseColor : -1;
-				pushConstBlockMaterial.normalTextureSet = primitive->material.normalTexture != nullptr ? primitive->material.texCoordSets.normal : -1;
-				pushConstBlockMaterial.occlusionTextureSet = primitive->material.occlusionTexture != nullptr ? primitive->material.texCoordSets.occlusion : -1;
-				pushConstBlockMaterial.emissiveTextureSet = primitive->material.emissiveTexture != nullptr ? primitive->material.texCoordSets.emissive : -1;
-				pushConstBlockMaterial.alphaMask = static_cast<float>(primitive->material.alphaMode == vkglTF::Material::ALPHAMODE_MASK);
-				pushConstBlockMaterial.alphaMaskCutoff = primitive->material.alphaCutoff;
-
-				// TODO: glTF specs states that metallic roughness should be preferred, even if specular glosiness is present
-
-				if (primitive->material.pbrWorkflows.metallicRoughness)
-				{
-					// Metallic roughness workflow
-					pushConstBlockMaterial.workflow = static_cast<float>(PBR_WORKFLOW_METALLIC_ROUGHNESS);
-					pushConstBlockMaterial.baseColorFactor = primitive->material.baseColorFactor;
-					pushConstBlockMaterial.metallicFactor = primitive->material.metallicFactor;
-					pushConstBlockMaterial.roughnessFactor = primitive->material.roughnessFactor;
-					pushConstBlockMaterial.PhysicalDescriptorTextureSet = primitive->material.metallicRoughnessTexture != nullptr ? primitive->material.texCoordSets.metallicRoughness : -1;
-					pushConstBlockMaterial.colorTextureSet = primitive->material.baseColorTexture != nullptr ? primitive->material.texCoordSets.baseColor : -1;
-				}
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &descriptorSets[imageIndex].scene, 0, nullptr);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &descriptorSets[imageIndex].node, 0, nullptr);
+	if (bindless.active)
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &bindless.descriptorSet, 0, nullptr);
+	}
 
-				if (primitive->material.pbrWorkflows.specularGlossiness || settings.SpecularGlossiness)
-				{
-					// Specular glossiness workflow
-					pushConstBlockMaterial.workflow = static_cast<float>(PBR_WORKFLOW_SPECULAR_GLOSINESS);
-					pushConstBlockMaterial.PhysicalDescriptorTextureSet = primitive->material.extension.specularGlossinessTexture != nullptr ? primitive->material.texCoordSets.specularGlossiness : -1;
-					pushConstBlockMaterial.colorTextureSet = primitive->material.extension.diffuseTexture != nullptr ? primitive->material.texCoordSets.baseColor : -1;
-					pushConstBlockMaterial.diffuseFactor = primitive->material.extension.diffuseFactor;
-					pushConstBlockMaterial.specularFactor = glm::vec4(primitive->material.extension.specularFactor, 1.0f);
-				}
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	uint32_t boundMaterial = UINT32_MAX;
+	uint32_t boundNode = UINT32_MAX;
+	//Narrow or wide index pool, nothing bound yet
+	int32_t boundIndexType = -1;
+	const bool skipIndirect = useIndirect();
+	for (size_t i = first; i < last; i++)
+	{
+		//Culled and drawn by the GPU-driven pass
+		if (skipIndirect && indirect.drawFlags[i])
+		{
+			continue;
+		}
+		const uint32_t nodeIndex = drawList.nodes[i];
+		vkglTF::Node* node = model.linearNodes[nodeIndex];
+		//Skinned vertices are moved by the joints, their bind pose bounds say nothing about the current frame
+		if (cull && !node->skin && drawList.bounds[i].valid)
+		{
+			vkglTF::BoundingBox aabb = drawList.bounds[i].getAABB(node->mesh->matrix);
+			if (!frustum.checkBox(aabb.min, aabb.max))
+			{
+				stats.culled++;
+				continue;
+			}
+		}
+		stats.drawn++;
 
-				vkCmdPushConstants(commandBuffers[cbIndex], pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstBlockMaterial), &pushConstBlockMaterial);
+		const VkPipeline pipeline = pipelines[drawList.pipelines[i]];
+		if (pipeline != boundPipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			boundPipeline = pipeline;
+			stats.pipelineBinds++;
+		}
+		const uint32_t material = drawList.materials[i];
+		if (material != boundMaterial)
+		{
+			//With bindless materials a material change is just the index into the material buffer
+			if (bindless.active)
+			{
+				vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT, offsetof(NodePushConstants, materialIndex), sizeof(uint32_t), &material);
+			}
+			else
+			{
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &model.materials[material].descriptorSet, 0, nullptr);
+				vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(NodePushConstants), sizeof(PushConstBlockMaterial), &materialPushConstants[material]);
+			}
+			boundMaterial = material;
+			stats.materialBinds++;
+		}
+		//Nodes only select their slot in the matrix palette
+		if (nodeIndex != boundNode)
+		{
+			const uint32_t nodeConstants[2] = { node->mesh->matrixOffset, static_cast<uint32_t>(node->mesh->jointMatrices.size()) };
+			vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_VERTEX_BIT, offsetof(NodePushConstants, matrixOffset), sizeof(nodeConstants), nodeConstants);
+			boundNode = nodeIndex;
+			stats.nodeBinds++;
+		}
 
-				if (primitive->hasIndices)
+		if (drawList.indexed[i])
+		{
+			if (drawList.wideIndices[i] != boundIndexType)
+			{
+				model.bindIndexBuffer(commandBuffer, drawList.wideIndices[i]);
+				boundIndexType = drawList.wideIndices[i];
+			}
+			uint32_t firstIndex = drawList.firstIndices[i];
+			uint32_t indexCount = drawList.indexCounts[i];
+			//Skinned draws move away from their bounds, they always use the full primitive
+			if (lodSelection.active && drawList.lodCounts[i] > 0 && !node->skin)
+			{
+				const uint32_t level = selectLod(i, node->mesh->matrix);
+				if (level > 0)
 				{
-					vkCmdDrawIndexed(commandBuffers[cbIndex], primitive->indexCount, 1, primitive->firstIndex, 0, 0);
+					const vkglTF::Primitive::Lod& lod = drawList.lods[drawList.firstLods[i] + level - 1];
+					firstIndex = lod.firstIndex;
+					indexCount = lod.indexCount;
 				}
-				else
+			}
+			vkCmdDrawIndexed(commandBuffer, indexCount, 1, firstIndex, drawList.firstVertices[i], 0);
+			stats.triangles += indexCount / 3;
+			stats.fullTriangles += drawList.indexCounts[i] / 3;
+		}
+		else
+		{
+			vkCmdDraw(commandBuffer, drawList.vertexCounts[i], 1, drawList.firstVertices[i], 0);
+			stats.triangles += drawList.vertexCounts[i] / 3;
+			stats.fullTriangles += drawList.vertexCounts[i] / 3;
+		}
+	}
+}
+
+//Depth of every opaque draw from the position (and skinning) stream only, the shading pass then only runs the fragment
+//shader for the visible surface. Masked and blended draws are left to the shading pass
+void Renderer::recordDepthPrepass(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool cull)
+{
+	vkglTF::Model& model = modelSet.scene;
+	const vkglTF::DrawList& drawList = model.drawList;
+	const VkPipeline pipelines[2] = { pipelineSet.depthPrepass, pipelineSet.depthPrepassDoubleSided };
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[imageIndex].scene, 0, nullptr);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2, 1, &descriptorSets[imageIndex].node, 0, nullptr);
+
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	uint32_t boundNode = UINT32_MAX;
+	int32_t boundIndexType = -1;
+	//The list is sorted by alpha mode, opaque draws come first
+	for (size_t i = 0; i < drawList.size() && drawList.alphaModes[i] == vkglTF::Material::ALPHAMODE_OPAQUE; i++)
+	{
+		const uint32_t nodeIndex = drawList.nodes[i];
+		vkglTF::Node* node = model.linearNodes[nodeIndex];
+		if (cull && !node->skin && drawList.bounds[i].valid)
+		{
+			vkglTF::BoundingBox aabb = drawList.bounds[i].getAABB(node->mesh->matrix);
+			if (!frustum.checkBox(aabb.min, aabb.max))
+			{
+				continue;
+			}
+		}
+
+		const VkPipeline pipeline = pipelines[drawList.pipelines[i]];
+		if (pipeline != boundPipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			boundPipeline = pipeline;
+		}
+		if (nodeIndex != boundNode)
+		{
+			const uint32_t nodeConstants[2] = { node->mesh->matrixOffset, static_cast<uint32_t>(node->mesh->jointMatrices.size()) };
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, offsetof(NodePushConstants, matrixOffset), sizeof(nodeConstants), nodeConstants);
+			boundNode = nodeIndex;
+		}
+
+		if (drawList.indexed[i])
+		{
+			if (drawList.wideIndices[i] != boundIndexType)
+			{
+				model.bindIndexBuffer(commandBuffer, drawList.wideIndices[i]);
+				boundIndexType = drawList.wideIndices[i];
+			}
+			uint32_t firstIndex = drawList.firstIndices[i];
+			uint32_t indexCount = drawList.indexCounts[i];
+			//Skinned draws move away from their bounds, they always use the full primitive
+			if (lodSelection.active && drawList.lodCounts[i] > 0 && !node->skin)
+			{
+				const uint32_t level = selectLod(i, node->mesh->matrix);
+				if (level > 0)
 				{
-					vkCmdDraw(commandBuffers[cbIndex], primitive->vertexCount, 1, 0, 0);
+					const vkglTF::Primitive::Lod& lod = drawList.lods[drawList.firstLods[i] + level - 1];
+					firstIndex = lod.firstIndex;
+					indexCount = lod.indexCount;
 				}
 			}
+			vkCmdDrawIndexed(commandBuffer, indexCount, 1, firstIndex, drawList.firstVertices[i], 0);
 		}
+		else
+		{
+			vkCmdDraw(commandBuffer, drawList.vertexCounts[i], 1, drawList.firstVertices[i], 0);
+		}
+	}
+}
 
-	};
-	for (auto child : node->children)
+//Record a range of the draw list into a secondary command buffer targeting the given swapchain image
+//The first range also draws the background and the GPU-driven batches, so they stay in front of everything else
+void Renderer::recordScene(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frame, bool cull, size_t first, size_t last, DrawStats& stats, bool firstRange)
+{
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = frameBuffers[imageIndex];
+
+	VkCommandBufferBeginInfo cmdBufferBeginInfo{};
+	cmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	if (cull)
+	{
+		cmdBufferBeginInfo.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	}
+	cmdBufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufferBeginInfo));
+
+	VkViewport viewport{};
+	viewport.width = (float)width;
+	viewport.height = (float)height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor{};
+	scissor.extent = { width, height };
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	//Per-frame recording leaves the skybox out while the background is hidden, baked passes always draw it
+	if (firstRange && (displayBackground || !settings.perFrameRecording))
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[imageIndex].skybox, 0, nullptr);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineSet.skybox);
+		modelSet.skybox.draw(commandBuffer);
+	}
+
+	vkglTF::Model& model = modelSet.scene;
+
+	//The index pool is bound by each pass as the draws need it
+	model.bindVertexBuffers(commandBuffer);
+
+	if (firstRange && settings.depthPrepass)
+	{
+		recordDepthPrepass(commandBuffer, imageIndex, cull);
+	}
+	if (firstRange && useIndirect())
 	{
-		renderNode(child, cbIndex, alphaMode);
+		recordIndirectDraws(commandBuffer, imageIndex, frame);
 	}
+	recordDrawList(commandBuffer, imageIndex, cull, first, last, stats);
+
+	VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
 }
 
 void Renderer::recordCommandBuffers()
 {
+	//Nothing to bake, the scene pass is recorded with the frame
+	if (settings.perFrameRecording)
+	{
+		return;
+	}
+
+	auto tStart = std::chrono::high_resolution_clock::now();
+
+	//Baked passes are not re-recorded when the camera moves, so they always draw full detail
+	lodSelection.active = false;
+
+	//The scene pass is baked once per swapchain image and only re-recorded when the scene, pipelines or size change
+	for (uint32_t i = 0; i < sceneCommandBuffers.size(); ++i)
+	{
+		drawStats = {};
+		recordScene(sceneCommandBuffers[i], i, 0, false, 0, modelSet.scene.drawList.size(), drawStats, true);
+	}
+
+	if (benchmark.active)
+	{
+		benchmark.addStage("recordCommandBuffers", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count());
+	}
+}
+
+//Record the primary command buffer of a frame: the baked scene pass of the acquired image followed by the user interface
+void Renderer::recordFrameCommandBuffer(uint32_t frame, uint32_t imageIndex)
+{
+	VkCommandBuffer currentCB = commandBuffers[frame];
+	std::vector<VkCommandBuffer> secondaries;
+	if (settings.perFrameRecording)
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+		//pbr.vert flips y after the model transform
+		const glm::mat4 sceneMatrix = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f)) * sceneUBO.model;
+		frustum.update(sceneUBO.projection * sceneUBO.view * sceneMatrix);
+		lodSelection.active = settings.lods;
+		lodSelection.sceneToView = sceneUBO.view * sceneMatrix;
+		lodSelection.scale = glm::length(glm::vec3(lodSelection.sceneToView[0]));
+		lodSelection.pixelsPerUnit = std::abs(sceneUBO.projection[1][1]) * 0.5f * static_cast<float>(height);
+
+		//Split the draw list into contiguous ranges, executing them in order keeps the sorted (and blend) order intact
+		const size_t drawCount = modelSet.scene.drawList.size();
+		const uint32_t threadCount = static_cast<uint32_t>(std::min<size_t>(recordThreads.size(), std::max<size_t>(drawCount / minDrawsPerThread, 1)));
+		const size_t drawsPerThread = (drawCount + threadCount - 1) / threadCount;
+		for (uint32_t t = 0; t < threadCount; t++)
+		{
+			const size_t first = std::min(t * drawsPerThread, drawCount);
+			const size_t last = std::min(first + drawsPerThread, drawCount);
+			threadPool.threads[t]->addJob([=]
+				{
+					RecordThread& thread = recordThreads[t];
+					auto tThreadStart = std::chrono::high_resolution_clock::now();
+					thread.stats = {};
+					recordScene(thread.commandBuffers[frame], imageIndex, frame, true, first, last, thread.stats, t == 0);
+					thread.recordTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tThreadStart).count();
+				});
+		}
+		threadPool.wait();
+
+		drawStats = {};
+		for (uint32_t t = 0; t < threadCount; t++)
+		{
+			const RecordThread& thread = recordThreads[t];
+			drawStats.drawn += thread.stats.drawn;
+			drawStats.culled += thread.stats.culled;
+			drawStats.pipelineBinds += thread.stats.pipelineBinds;
+			drawStats.materialBinds += thread.stats.materialBinds;
+			drawStats.nodeBinds += thread.stats.nodeBinds;
+			drawStats.triangles += thread.stats.triangles;
+			drawStats.fullTriangles += thread.stats.fullTriangles;
+			secondaries.push_back(thread.commandBuffers[frame]);
+			if (benchmark.active)
+			{
+				benchmark.addSample("recordThread" + std::to_string(t), thread.recordTime);
+			}
+		}
+		if (benchmark.active)
+		{
+			benchmark.addSample("recordScene", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count());
+			benchmark.addCounter("drawnPrimitives", drawStats.drawn);
+			benchmark.addCounter("culledPrimitives", drawStats.culled);
+			benchmark.addCounter("savedPipelineBinds", drawStats.drawn - drawStats.pipelineBinds);
+			benchmark.addCounter("savedMaterialBinds", drawStats.drawn - drawStats.materialBinds);
+			benchmark.addCounter("savedNodeBinds", drawStats.drawn - drawStats.nodeBinds);
+			benchmark.addCounter("submittedTriangles", drawStats.triangles);
+			benchmark.addCounter("fullDetailTriangles", drawStats.fullTriangles);
+			if (useIndirect())
+			{
+				benchmark.addCounter("indirectDraws", indirect.drawCount);
+				benchmark.addCounter("indirectBatches", static_cast<double>(indirect.batches.size()));
+			}
+		}
+	}
+	else
+	{
+		secondaries.push_back(sceneCommandBuffers[imageIndex]);
+	}
+	secondaries.push_back(ui->record(frame, width, height));
+
 	VkCommandBufferBeginInfo cmdBufferBeginInfo{};
 	cmdBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
 	VkClearValue clearValues[3];
 	if (settings.multiSampling)
@@ -118,69 +416,502 @@ void Renderer::recordCommandBuffers()
 	renderPassBeginInfo.renderArea.extent.height = height;
 	renderPassBeginInfo.clearValueCount = settings.multiSampling ? 3 : 2;
 	renderPassBeginInfo.pClearValues = clearValues;
+	renderPassBeginInfo.framebuffer = frameBuffers[imageIndex];
 
-	for (uint32_t i = 0; i < commandBuffers.size(); ++i)
+	VK_CHECK_RESULT(vkBeginCommandBuffer(currentCB, &cmdBufferBeginInfo));
+	if (timestampQueryPool)
 	{
-		renderPassBeginInfo.framebuffer = frameBuffers[i];
+		vkCmdResetQueryPool(currentCB, timestampQueryPool, frame * 2, 2);
+		vkCmdWriteTimestamp(currentCB, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, frame * 2);
+	}
+	if (useIndirect())
+	{
+		recordIndirectCulling(currentCB, frame, imageIndex);
+	}
+	vkCmdBeginRenderPass(currentCB, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
-		VkCommandBuffer currentCB = commandBuffers[i];
+	vkCmdExecuteCommands(currentCB, static_cast<uint32_t>(secondaries.size()), secondaries.data());
 
-		VK_CHECK_RESULT(vkBeginCommandBuffer(currentCB, &cmdBufferBeginInfo));
-		vkCmdBeginRenderPass(currentCB, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdEndRenderPass(currentCB);
+	if (timestampQueryPool)
+	{
+		vkCmdWriteTimestamp(currentCB, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, frame * 2 + 1);
+	}
+	VK_CHECK_RESULT(vkEndCommandBuffer(currentCB));
+}
 
-		VkViewport viewport{};
-		viewport.width = (float)width;
-		viewport.height = (float)height;
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-		vkCmdSetViewport(currentCB, 0, 1, &viewport);
+bool Renderer::useIndirect() const
+{
+	return indirect.supported && settings.indirectDrawing && settings.perFrameRecording && indirect.drawCount > 0;
+}
 
-		VkRect2D scissor{};
-		scissor.extent = { width, height };
-		vkCmdSetScissor(currentCB, 0, 1, &scissor);
+//The bounding sphere of the primitive projected to the screen, level errors are relative to its extent so
+//error times the projected diameter approximates the deviation in pixels
+uint32_t Renderer::selectLod(size_t draw, const glm::mat4& matrix) const
+{
+	const vkglTF::DrawList& drawList = modelSet.scene.drawList;
+	const vkglTF::BoundingBox& bounds = drawList.bounds[draw];
+	if (!bounds.valid)
+	{
+		return 0;
+	}
+	const float matrixScale = std::max(glm::length(glm::vec3(matrix[0])), std::max(glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))));
+	const float radius = 0.5f * glm::length(bounds.max - bounds.min) * matrixScale * lodSelection.scale;
+	const glm::vec4 center = lodSelection.sceneToView * matrix * glm::vec4(0.5f * (bounds.min + bounds.max), 1.0f);
+	const float distance = glm::length(glm::vec3(center));
+	if (distance <= radius)
+	{
+		return 0;
+	}
+	const float diameter = 2.0f * radius / distance * lodSelection.pixelsPerUnit;
+	uint32_t level = 0;
+	for (uint32_t i = 0; i < drawList.lodCounts[draw]; i++)
+	{
+		if (drawList.lods[drawList.firstLods[draw] + i].error * diameter > settings.lodThreshold)
+		{
+			break;
+		}
+		level = i + 1;
+	}
+	return level;
+}
 
-		VkDeviceSize offsets[1] = { 0 };
+//Upload the opaque, non-skinned part of the draw list for the GPU-driven path and create the per-frame command and count buffers
+void Renderer::prepareIndirectBuffers()
+{
+	destroyIndirectBuffers();
+
+	vkglTF::Model& model = modelSet.scene;
+	const vkglTF::DrawList& drawList = model.drawList;
 
-		if (displayBackground)
+	std::vector<IndirectDrawData> draws;
+	indirect.drawFlags.assign(drawList.size(), 0);
+	indirect.batches.clear();
+	for (size_t i = 0; i < drawList.size(); i++)
+	{
+		//Blending needs ordered draws, skinned meshes need their joints and everything else here is indexed.
+		//Levels of detail are picked while recording, so draws that have them stay on the CPU path
+		const vkglTF::Node* node = model.linearNodes[drawList.nodes[i]];
+		if (drawList.alphaModes[i] == vkglTF::Material::ALPHAMODE_BLEND || node->skin || !drawList.indexed[i] || drawList.lodCounts[i] > 0)
+		{
+			continue;
+		}
+		//The draw list is sorted, so draws sharing pipeline, index type and material are adjacent
+		if (indirect.batches.empty() || indirect.batches.back().pipeline != drawList.pipelines[i] || indirect.batches.back().wideIndices != drawList.wideIndices[i] ||
+			(!bindless.active && indirect.batches.back().material != drawList.materials[i]))
+		{
+			IndirectBatch batch{};
+			batch.pipeline = drawList.pipelines[i];
+			batch.wideIndices = drawList.wideIndices[i];
+			batch.material = drawList.materials[i];
+			batch.commandOffset = static_cast<uint32_t>(draws.size());
+			indirect.batches.push_back(batch);
+		}
+		IndirectBatch& batch = indirect.batches.back();
+
+		IndirectDrawData draw{};
+		draw.firstIndex = drawList.firstIndices[i];
+		draw.indexCount = drawList.indexCounts[i];
+		draw.vertexOffset = drawList.firstVertices[i];
+		draw.node = node->mesh->matrixOffset;
+		draw.batch = static_cast<uint32_t>(indirect.batches.size() - 1);
+		draw.commandOffset = batch.commandOffset;
+		draw.material = drawList.materials[i];
+		draw.bbMin = glm::vec4(drawList.bounds[i].min, 0.0f);
+		draw.bbMax = glm::vec4(drawList.bounds[i].max, drawList.bounds[i].valid ? 1.0f : 0.0f);
+		draw.sphere = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+		draw.cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		if (drawList.meshletCounts[i] == 0)
 		{
-			vkCmdBindDescriptorSets(currentCB, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i].skybox, 0, nullptr);
-			vkCmdBindPipeline(currentCB, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineSet.skybox);
-			modelSet.skybox.draw(currentCB);
+			draws.push_back(draw);
+			batch.maxDrawCount++;
 		}
+		//Each meshlet is culled and drawn on its own, back facing ones only where back faces are culled
+		for (uint32_t m = 0; m < drawList.meshletCounts[i]; m++)
+		{
+			const vkglTF::Meshlet& meshlet = drawList.meshlets[drawList.firstMeshlets[i] + m];
+			IndirectDrawData meshletDraw = draw;
+			meshletDraw.firstIndex = draw.firstIndex + meshlet.firstIndex;
+			meshletDraw.indexCount = meshlet.indexCount;
+			meshletDraw.sphere = meshlet.sphere;
+			if (drawList.pipelines[i] == vkglTF::DrawList::PIPELINE_OPAQUE)
+			{
+				meshletDraw.cone = meshlet.cone;
+			}
+			draws.push_back(meshletDraw);
+			batch.maxDrawCount++;
+		}
+		indirect.drawFlags[i] = 1;
+	}
+	indirect.drawCount = static_cast<uint32_t>(draws.size());
+	if (indirect.drawCount == 0)
+	{
+		return;
+	}
+
+	//Draw data never changes after loading, keep it in device local memory
+	VkDeviceSize drawsSize = draws.size() * sizeof(IndirectDrawData);
+	indirect.draws.create(device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, drawsSize, false);
+	device->staging->uploadBuffer(indirect.draws.buffer, 0, draws.data(), drawsSize);
+	device->staging->flush();
 
-		vkglTF::Model& model = modelSet.scene;
+	indirect.frames.resize(renderAhead);
+	for (auto& frame : indirect.frames)
+	{
+		frame.commands.create(device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, draws.size() * sizeof(VkDrawIndexedIndirectCommand), false);
+		frame.counts.create(device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirect.batches.size() * sizeof(uint32_t), false);
+	}
 
-		vkCmdBindVertexBuffers(currentCB, 0, 1, &model.vertices.buffer, offsets);
-		if (model.indices.buffer != VK_NULL_HANDLE)
+	//One set per frame and swapchain image, as the node matrices follow the image like the other uniform buffers
+	//Bound as set 0 of the culling pass and set 2 of the indirect pipelines
+	const uint32_t setCount = renderAhead * static_cast<uint32_t>(uniformBuffers.size());
+	VkDescriptorPoolSize poolSize{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * setCount };
+	VkDescriptorPoolCreateInfo descriptorPoolCI{};
+	descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolCI.poolSizeCount = 1;
+	descriptorPoolCI.pPoolSizes = &poolSize;
+	descriptorPoolCI.maxSets = setCount;
+	VK_CHECK_RESULT(vkCreateDescriptorPool(logicalDevice, &descriptorPoolCI, nullptr, &indirect.descriptorPool));
+	for (auto& frame : indirect.frames)
+	{
+		frame.descriptorSets.resize(uniformBuffers.size());
+		for (size_t image = 0; image < uniformBuffers.size(); image++)
 		{
-			vkCmdBindIndexBuffer(currentCB, model.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+			VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+			descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+			descriptorSetAllocInfo.descriptorPool = indirect.descriptorPool;
+			descriptorSetAllocInfo.pSetLayouts = &indirect.descriptorSetLayout;
+			descriptorSetAllocInfo.descriptorSetCount = 1;
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(logicalDevice, &descriptorSetAllocInfo, &frame.descriptorSets[image]));
+
+			const std::array<VkDescriptorBufferInfo*, 4> bufferInfos = { &indirect.draws.descriptor, &uniformBuffers[image].nodeMatrices.descriptor, &frame.commands.descriptor, &frame.counts.descriptor };
+			std::array<VkWriteDescriptorSet, 4> writeDescriptorSets{};
+			for (size_t i = 0; i < writeDescriptorSets.size(); i++)
+			{
+				writeDescriptorSets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writeDescriptorSets[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writeDescriptorSets[i].descriptorCount = 1;
+				writeDescriptorSets[i].dstSet = frame.descriptorSets[image];
+				writeDescriptorSets[i].dstBinding = static_cast<uint32_t>(i);
+				writeDescriptorSets[i].pBufferInfo = bufferInfos[i];
+			}
+			vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
 		}
+	}
+	std::cout << "GPU-driven path: " << indirect.drawCount << " draws in " << indirect.batches.size() << " indirect batches" << std::endl;
+}
 
-		boundPipeline = VK_NULL_HANDLE;
+void Renderer::destroyIndirectBuffers()
+{
+	if (indirect.draws.buffer != VK_NULL_HANDLE)
+	{
+		indirect.draws.destroy();
+	}
+	for (auto& frame : indirect.frames)
+	{
+		frame.commands.destroy();
+		frame.counts.destroy();
+	}
+	indirect.frames.clear();
+	if (indirect.descriptorPool != VK_NULL_HANDLE)
+	{
+		vkDestroyDescriptorPool(logicalDevice, indirect.descriptorPool, nullptr);
+		indirect.descriptorPool = VK_NULL_HANDLE;
+	}
+	indirect.drawCount = 0;
+}
+
+//Cull the GPU-driven draws into indirect commands, recorded ahead of the render pass
+void Renderer::recordIndirectCulling(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t imageIndex)
+{
+	IndirectFrame& indirectFrame = indirect.frames[frame];
+	vkCmdFillBuffer(commandBuffer, indirectFrame.counts.buffer, 0, VK_WHOLE_SIZE, 0);
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = indirectFrame.counts.buffer;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	CullPushConstants pushConstants{};
+	for (size_t i = 0; i < frustum.planes.size(); i++)
+	{
+		pushConstants.planes[i] = frustum.planes[i];
+	}
+	//Node matrices map to the space before the y flip and model transform of the shaders
+	const glm::mat4 sceneToView = sceneUBO.view * glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f)) * sceneUBO.model;
+	pushConstants.cameraPos = glm::inverse(sceneToView) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	pushConstants.drawCount = indirect.drawCount;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, indirect.cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, indirect.cullPipelineLayout, 0, 1, &indirectFrame.descriptorSets[imageIndex], 0, nullptr);
+	vkCmdPushConstants(commandBuffer, indirect.cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+	vkCmdDispatch(commandBuffer, (indirect.drawCount + 63) / 64, 1, 1);
+
+	std::array<VkBufferMemoryBarrier, 2> barriers{ barrier, barrier };
+	barriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barriers[0].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	barriers[0].buffer = indirectFrame.commands.buffer;
+	barriers[1].srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barriers[1].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	barriers[1].buffer = indirectFrame.counts.buffer;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
 
-		// Opaque primitives first
-		for (auto node : model.nodes)
+//One vkCmdDrawIndexedIndirectCount per (pipeline, material) batch, the draw counts come from the culling pass
+void Renderer::recordIndirectDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frame)
+{
+	const IndirectFrame& indirectFrame = indirect.frames[frame];
+	VkPipeline pipelines[2] = { indirect.pbr, indirect.pbrDoubleSided };
+	VkPipelineLayout layout = indirect.pipelineLayout;
+	if (bindless.active)
+	{
+		pipelines[0] = bindless.indirectPbr;
+		pipelines[1] = bindless.indirectPbrDoubleSided;
+		layout = bindless.indirectPipelineLayout;
+	}
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &descriptorSets[imageIndex].scene, 0, nullptr);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &indirectFrame.descriptorSets[imageIndex], 0, nullptr);
+	if (bindless.active)
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &bindless.descriptorSet, 0, nullptr);
+	}
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	int32_t boundIndexType = -1;
+	for (size_t b = 0; b < indirect.batches.size(); b++)
+	{
+		const IndirectBatch& batch = indirect.batches[b];
+		const VkPipeline pipeline = pipelines[batch.pipeline == vkglTF::DrawList::PIPELINE_DOUBLE_SIDED ? 1 : 0];
+		if (pipeline != boundPipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			boundPipeline = pipeline;
+		}
+		if (batch.wideIndices != boundIndexType)
 		{
-			renderNode(node, i, vkglTF::Material::ALPHAMODE_OPAQUE);
+			modelSet.scene.bindIndexBuffer(commandBuffer, batch.wideIndices);
+			boundIndexType = batch.wideIndices;
 		}
-		// Alpha masked primitives
-		for (auto node : model.nodes)
+		//The vertex shader passes each draw's material index on when materials are bindless
+		if (!bindless.active)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &modelSet.scene.materials[batch.material].descriptorSet, 0, nullptr);
+			vkCmdPushConstants(commandBuffer, layout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(NodePushConstants), sizeof(PushConstBlockMaterial), &materialPushConstants[batch.material]);
+		}
+		vkCmdDrawIndexedIndirectCount(commandBuffer, indirectFrame.commands.buffer, batch.commandOffset * sizeof(VkDrawIndexedIndirectCommand), indirectFrame.counts.buffer, b * sizeof(uint32_t), batch.maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
+
+//Put every scene texture into one descriptor array and the material parameters into a storage buffer
+void Renderer::prepareBindlessMaterials()
+{
+	destroyBindlessMaterials();
+	bindless.active = false;
+	if (!bindless.supported)
+	{
+		return;
+	}
+
+	if (bindless.descriptorSetLayout == VK_NULL_HANDLE)
+	{
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			{ 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
+			{ 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, bindless.maxTextures, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
+		};
+		//Only the texture array is variable sized and not every element has to be written
+		std::vector<VkDescriptorBindingFlags> bindingFlags = {
+			0,
+			VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT
+		};
+		VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCI{};
+		bindingFlagsCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+		bindingFlagsCI.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+		bindingFlagsCI.pBindingFlags = bindingFlags.data();
+		VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
+		descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descriptorSetLayoutCI.pNext = &bindingFlagsCI;
+		descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
+		descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCI, nullptr, &bindless.descriptorSetLayout));
+	}
+
+	vkglTF::Model& model = modelSet.scene;
+	//Slot 0 is the empty texture used by materials without a given map
+	const uint32_t textureCount = static_cast<uint32_t>(model.textures.size()) + 1;
+	if (textureCount > bindless.maxTextures)
+	{
+		std::cout << "Scene has " << textureCount << " textures, more than the " << bindless.maxTextures << " the device can index, using per-material descriptor sets" << std::endl;
+		return;
+	}
+	bindless.active = true;
+
+	std::vector<VkDescriptorPoolSize> poolSizes = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureCount }
+	};
+	VkDescriptorPoolCreateInfo descriptorPoolCI{};
+	descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	descriptorPoolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	descriptorPoolCI.pPoolSizes = poolSizes.data();
+	descriptorPoolCI.maxSets = 1;
+	VK_CHECK_RESULT(vkCreateDescriptorPool(logicalDevice, &descriptorPoolCI, nullptr, &bindless.descriptorPool));
+
+	VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountAllocInfo{};
+	variableCountAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+	variableCountAllocInfo.descriptorSetCount = 1;
+	variableCountAllocInfo.pDescriptorCounts = &textureCount;
+	VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+	descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	descriptorSetAllocInfo.pNext = &variableCountAllocInfo;
+	descriptorSetAllocInfo.descriptorPool = bindless.descriptorPool;
+	descriptorSetAllocInfo.pSetLayouts = &bindless.descriptorSetLayout;
+	descriptorSetAllocInfo.descriptorSetCount = 1;
+	VK_CHECK_RESULT(vkAllocateDescriptorSets(logicalDevice, &descriptorSetAllocInfo, &bindless.descriptorSet));
+
+	bindless.materials.create(device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, std::max<size_t>(model.materials.size(), 1) * sizeof(ShaderMaterial));
+	updateBindlessMaterials();
+
+	std::vector<VkDescriptorImageInfo> imageDescriptors;
+	imageDescriptors.reserve(textureCount);
+	imageDescriptors.push_back(textureSet.empty.descriptor);
+	for (auto& texture : model.textures)
+	{
+		imageDescriptors.push_back(texture.descriptor);
+	}
+
+	std::array<VkWriteDescriptorSet, 2> writeDescriptorSets{};
+	writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writeDescriptorSets[0].descriptorCount = 1;
+	writeDescriptorSets[0].dstSet = bindless.descriptorSet;
+	writeDescriptorSets[0].dstBinding = 0;
+	writeDescriptorSets[0].pBufferInfo = &bindless.materials.descriptor;
+
+	writeDescriptorSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writeDescriptorSets[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writeDescriptorSets[1].descriptorCount = textureCount;
+	writeDescriptorSets[1].dstSet = bindless.descriptorSet;
+	writeDescriptorSets[1].dstBinding = 1;
+	writeDescriptorSets[1].pImageInfo = imageDescriptors.data();
+
+	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+}
+
+void Renderer::destroyBindlessMaterials()
+{
+	if (bindless.materials.buffer != VK_NULL_HANDLE)
+	{
+		bindless.materials.destroy();
+	}
+	if (bindless.descriptorPool != VK_NULL_HANDLE)
+	{
+		vkDestroyDescriptorPool(logicalDevice, bindless.descriptorPool, nullptr);
+		bindless.descriptorPool = VK_NULL_HANDLE;
+		bindless.descriptorSet = VK_NULL_HANDLE;
+	}
+}
+
+//Write the material buffer from the push constant blocks, picking textures the same way the per-material sets do
+void Renderer::updateBindlessMaterials()
+{
+	const vkglTF::Model& model = modelSet.scene;
+	auto textureIndex = [&model](const vkglTF::Texture* texture)
+	{
+		return texture ? static_cast<int32_t>(texture - model.textures.data()) + 1 : 0;
+	};
+	ShaderMaterial* shaderMaterials = static_cast<ShaderMaterial*>(bindless.materials.mapped);
+	for (size_t i = 0; i < model.materials.size(); i++)
+	{
+		const vkglTF::Material& material = model.materials[i];
+		ShaderMaterial& shaderMaterial = shaderMaterials[i];
+		shaderMaterial = {};
+		shaderMaterial.params = materialPushConstants[i];
+		shaderMaterial.normalTexture = textureIndex(material.normalTexture);
+		shaderMaterial.occlusionTexture = textureIndex(material.occlusionTexture);
+		shaderMaterial.emissiveTexture = textureIndex(material.emissiveTexture);
+		if (material.pbrWorkflows.metallicRoughness)
 		{
-			renderNode(node, i, vkglTF::Material::ALPHAMODE_MASK);
+			shaderMaterial.colorTexture = textureIndex(material.baseColorTexture);
+			shaderMaterial.physicalDescriptorTexture = textureIndex(material.metallicRoughnessTexture);
 		}
-		// Transparent primitives
-		// TODO: Correct depth sorting
-		for (auto node : model.nodes)
+		if (material.pbrWorkflows.specularGlossiness)
 		{
-			renderNode(node, i, vkglTF::Material::ALPHAMODE_BLEND);
+			if (material.extension.diffuseTexture)
+			{
+				shaderMaterial.colorTexture = textureIndex(material.extension.diffuseTexture);
+			}
+			if (material.extension.specularGlossinessTexture)
+			{
+				shaderMaterial.physicalDescriptorTexture = textureIndex(material.extension.specularGlossinessTexture);
+			}
 		}
+	}
+}
+
+//Start the recording workers, each with its own command pool as pools must not be used from several threads at once
+void Renderer::prepareRecordThreads()
+{
+	uint32_t threadCount = settings.recordThreads;
+	if (threadCount == 0)
+	{
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	std::cout << "Recording the scene on " << threadCount << " thread(s)" << std::endl;
+	threadPool.setThreadCount(threadCount);
+	recordThreads.resize(threadCount);
+	for (auto& thread : recordThreads)
+	{
+		thread.commandPool = device->createCommandPool(swapchain.queueNodeIndex);
+		thread.commandBuffers.resize(renderAhead);
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo{};
+		cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		cmdBufAllocateInfo.commandPool = thread.commandPool;
+		cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		cmdBufAllocateInfo.commandBufferCount = static_cast<uint32_t>(thread.commandBuffers.size());
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(logicalDevice, &cmdBufAllocateInfo, thread.commandBuffers.data()));
+	}
+}
 
-		// User interface
-		ui->draw(currentCB);
+//Create the timestamp query pool used to measure GPU frame times in benchmark mode
+void Renderer::prepareTimestamps()
+{
+	timestampPending.assign(renderAhead, false);
+	if (!benchmark.active)
+	{
+		return;
+	}
+	if (device->queueFamilyProperties[swapchain.queueNodeIndex].timestampValidBits == 0 || device->properties.limits.timestampPeriod == 0.0f)
+	{
+		std::cout << "Timestamp queries not supported on the graphics queue, GPU frame times will not be reported" << std::endl;
+		return;
+	}
+	VkQueryPoolCreateInfo queryPoolCI{};
+	queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCI.queryCount = static_cast<uint32_t>(commandBuffers.size()) * 2;
+	VK_CHECK_RESULT(vkCreateQueryPool(logicalDevice, &queryPoolCI, nullptr, &timestampQueryPool));
+}
 
-		vkCmdEndRenderPass(currentCB);
-		VK_CHECK_RESULT(vkEndCommandBuffer(currentCB));
+//Read back the timestamps of the command buffer last submitted with the given frame fence
+void Renderer::collectTimestamps(uint32_t frame)
+{
+	if (!timestampQueryPool || !timestampPending[frame])
+	{
+		return;
 	}
+	uint64_t timestamps[2];
+	VkResult result = vkGetQueryPoolResults(logicalDevice, timestampQueryPool, frame * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	timestampPending[frame] = false;
+	if (result != VK_SUCCESS)
+	{
+		return;
+	}
+	uint32_t validBits = device->queueFamilyProperties[swapchain.queueNodeIndex].timestampValidBits;
+	uint64_t mask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+	uint64_t ticks = (timestamps[1] - timestamps[0]) & mask;
+	benchmark.addSample("gpuFrame", static_cast<double>(ticks) * device->properties.limits.timestampPeriod / 1000000.0);
 }
 
 void Renderer::prepare()
@@ -192,7 +923,8 @@ void Renderer::prepare()
 	waitFences.resize(renderAhead);
 	presentCompleteSemaphores.resize(renderAhead);
 	renderCompleteSemaphores.resize(renderAhead);
-	commandBuffers.resize(swapchain.imageCount);
+	commandBuffers.resize(renderAhead);
+	sceneCommandBuffers.resize(swapchain.imageCount);
 	uniformBuffers.resize(swapchain.imageCount);
 	descriptorSets.resize(swapchain.imageCount);
 	// Command buffer execution fences
@@ -220,6 +952,26 @@ void Renderer::prepare()
 		cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
 		cmdBufAllocateInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
 		VK_CHECK_RESULT(vkAllocateCommandBuffers(logicalDevice, &cmdBufAllocateInfo, commandBuffers.data()));
+		//Scene pass, executed from the per-frame primary command buffer
+		cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		cmdBufAllocateInfo.commandBufferCount = static_cast<uint32_t>(sceneCommandBuffers.size());
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(logicalDevice, &cmdBufAllocateInfo, sceneCommandBuffers.data()));
+	}
+
+	prepareTimestamps();
+	prepareRecordThreads();
+	//The GPU-driven path needs the draw count read from a buffer, otherwise every draw stays on the CPU path
+	indirect.supported = enabledFeatures12.drawIndirectCount && enabledFeatures.multiDrawIndirect && enabledFeatures.drawIndirectFirstInstance;
+	if (!indirect.supported)
+	{
+		std::cout << "drawIndirectCount not supported, GPU-driven culling disabled" << std::endl;
+	}
+	bindless.supported = settings.bindlessMaterials && enabledFeatures12.runtimeDescriptorArray && enabledFeatures12.descriptorBindingVariableDescriptorCount;
+	if (bindless.supported)
+	{
+		//The scene set already uses three samplers in the fragment stage, some drivers report practically unbounded limits
+		const VkPhysicalDeviceLimits& limits = deviceProperties.limits;
+		bindless.maxTextures = std::min({ limits.maxPerStageDescriptorSamplers, limits.maxPerStageDescriptorSampledImages, limits.maxDescriptorSetSamplers, limits.maxDescriptorSetSampledImages, 65536u }) - 3;
 	}
 
 	loadAssets();
@@ -229,7 +981,7 @@ void Renderer::prepare()
 	setupDescriptors();
 	preparePipelines();
 
-	ui = new UI(device, renderPass, queue, pipelineCache, settings.sampleCount);
+	ui = new UI(device, renderPass, pipelineCache, settings.multiSampling ? settings.sampleCount : VK_SAMPLE_COUNT_1_BIT, renderAhead);
 	updateOverlay();
 
 	recordCommandBuffers();
@@ -248,7 +1000,7 @@ void Renderer::loadAssets()
 	}
 	readDirectory(ENVIRONMENT_PATH, "*.ktx", environments, false);
 
-	textureSet.empty.loadFromFile(TEXTURE_PATH + "empty.ktx", VK_FORMAT_R8G8B8A8_UNORM, device, queue);
+	textureSet.empty.loadFromFile(TEXTURE_PATH + "empty.ktx", VK_FORMAT_R8G8B8A8_UNORM, device);
 
 	std::string sceneFile = MODEL_PATH + "DamagedHelmet/glTF-Embedded/DamagedHelmet.gltf";
 	std::string envMapFile = ENVIRONMENT_PATH + "cyberpunk.ktx";
@@ -281,7 +1033,7 @@ void Renderer::loadAssets()
 	}
 
 	loadScene(sceneFile.c_str());
-	modelSet.skybox.loadFromFile(MODEL_PATH + "Box/glTF-Embedded/Box.gltf", device, queue);
+	modelSet.skybox.loadFromFile(MODEL_PATH + "Box/glTF-Embedded/Box.gltf", device);
 
 	loadEnvironment(envMapFile.c_str());
 }
@@ -294,10 +1046,105 @@ void Renderer::loadScene(std::string filename)
 	animationTimer = 0.0f;
 
 	auto startTm = std::chrono::high_resolution_clock::now();
-	modelSet.scene.loadFromFile(filename, device, queue);
+	modelSet.scene.optimizeMeshes = settings.optimizeMeshes;
+	modelSet.scene.generateLods = settings.lods;
+	modelSet.scene.generateMeshlets = settings.meshlets;
+	modelSet.scene.useSceneCache = settings.sceneCache;
+	modelSet.scene.textureMemoryBudget = size_t(settings.textureBudget) * 1024 * 1024;
+	modelSet.scene.compressTextures = settings.textureCompression;
+	modelSet.scene.floatTexCoords = settings.floatTexCoords;
+	modelSet.scene.loadFromFile(filename, device);
+
+	finishSceneLoad(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTm).count());
+}
+
+//Parse and upload the scene on a worker thread, render() swaps it in once it is complete
+void Renderer::loadSceneAsync(std::string filename)
+{
+	if (pendingScene.loaded.valid())
+	{
+		std::cout << "Still loading " << pendingScene.filename << ", ignoring " << filename << std::endl;
+		return;
+	}
+	std::cout << "Loading scene from " << filename << " in the background" << std::endl;
+	pendingScene.model = std::make_unique<vkglTF::Model>();
+	pendingScene.model->optimizeMeshes = settings.optimizeMeshes;
+	pendingScene.model->generateLods = settings.lods;
+	pendingScene.model->generateMeshlets = settings.meshlets;
+	pendingScene.model->useSceneCache = settings.sceneCache;
+	pendingScene.model->textureMemoryBudget = size_t(settings.textureBudget) * 1024 * 1024;
+	pendingScene.model->compressTextures = settings.textureCompression;
+	pendingScene.model->floatTexCoords = settings.floatTexCoords;
+	pendingScene.filename = filename;
+	pendingScene.startTime = std::chrono::high_resolution_clock::now();
+	vkglTF::Model* model = pendingScene.model.get();
+	//Uploads go through the device's staging ring, its copies run on the transfer queue when there is one
+	pendingScene.loaded = std::async(std::launch::async, [this, model, filename]()
+	{
+		model->loadFromFile(filename, device);
+	});
+}
 
-	auto loadTm = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTm).count();
+//Called at the start of a frame: once the background load is complete, retire the current scene after the
+//frames in flight that reference it have finished and rebuild everything that depends on the scene
+void Renderer::swapPendingScene()
+{
+	if (!pendingScene.loaded.valid() || pendingScene.loaded.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+	{
+		return;
+	}
+	auto loadTm = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pendingScene.startTime).count();
+	std::unique_ptr<vkglTF::Model> model = std::move(pendingScene.model);
+	try
+	{
+		pendingScene.loaded.get();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "could not load \"" << pendingScene.filename << "\": " << e.what() << std::endl;
+		model->destroy(logicalDevice);
+		return;
+	}
+	//loadFromFile reports parse errors itself and leaves the model empty
+	if (model->vertices.buffer == VK_NULL_HANDLE)
+	{
+		model->destroy(logicalDevice);
+		return;
+	}
+
+	VK_CHECK_RESULT(vkWaitForFences(logicalDevice, static_cast<uint32_t>(waitFences.size()), waitFences.data(), VK_TRUE, UINT64_MAX));
+	std::swap(modelSet.scene, *model);
+	model->destroy(logicalDevice);
+	animationIndex = 0;
+	animationTimer = 0.0f;
+
+	finishSceneLoad(loadTm);
+	setupDescriptors();
+	if (modelSet.scene.vertices.layout != pipelineVertexLayout)
+	{
+		destroyPipelines();
+		preparePipelines();
+	}
+	recordCommandBuffers();
+}
+
+void Renderer::finishSceneLoad(double loadTm)
+{
 	std::cout << "Loading took " << loadTm << " ms" << std::endl;
+	vulkan::MemoryAllocator::Stats memoryStats = device->allocator->getStats();
+	std::cout << "GPU memory: " << memoryStats.allocationCount << " allocations in " << memoryStats.blockCount << " blocks + " << memoryStats.dedicatedCount << " dedicated, "
+		<< memoryStats.usedBytes / (1024 * 1024) << " of " << memoryStats.reservedBytes / (1024 * 1024) << " MB used, "
+		<< memoryStats.deviceAllocations << " vkAllocateMemory calls, fragmentation " << memoryStats.fragmentation << std::endl;
+	vulkan::StagingRing::Stats stagingStats = device->staging->getStats();
+	std::cout << "Staging ring: " << stagingStats.uploadedBytes / (1024 * 1024) << " MB uploaded through " << device->staging->getSize() / (1024 * 1024) << " MB in " << stagingStats.submits << " submits, "
+		<< stagingStats.stalls << " stalls, " << stagingStats.oversized << " oversized, copies on the " << (device->staging->hasTransferQueue() ? "transfer" : "graphics") << " queue" << std::endl;
+	if (benchmark.active)
+	{
+		benchmark.addStage("loadScene", loadTm);
+		benchmark.addStage("optimizeMeshes", modelSet.scene.loadTimings.optimize);
+	}
+
+	updateMaterialPushConstants();
 
 	camera.reset();
 }
@@ -310,7 +1157,7 @@ void Renderer::loadEnvironment(std::string filename) {
 		textureSet.irradianceCube.destroy();
 		textureSet.prefilteredCube.destroy();
 	}
-	textureSet.environmentCube.loadFromFile(filename, VK_FORMAT_R16G16B16A16_SFLOAT, device, queue);
+	textureSet.environmentCube.loadFromFile(filename, VK_FORMAT_R16G16B16A16_SFLOAT, device);
 	generateCubemaps();
 }
 //Generate a BRDF integration map storing roughness/NdotV as a look-up-table
@@ -547,8 +1394,6 @@ void Renderer::generateBRDFLUT()
 	vkCmdEndRenderPass(cmdBuf);
 	device->flushCommandBuffer(cmdBuf, queue);
 
-	vkQueueWaitIdle(queue);
-
 	vkDestroyPipeline(logicalDevice, pipeline, nullptr);
 	vkDestroyPipelineLayout(logicalDevice, pipelinelayout, nullptr);
 	vkDestroyRenderPass(logicalDevice, renderpass, nullptr);
@@ -563,6 +1408,10 @@ void Renderer::generateBRDFLUT()
 	auto tEnd = std::chrono::high_resolution_clock::now();
 	auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
 	std::cout << "Generating BRDF LUT took " << tDiff << " ms" << std::endl;
+	if (benchmark.active)
+	{
+		benchmark.addStage("generateBRDFLUT", tDiff);
+	}
 }
 //Offline generation for the cup maps used for PBR lighting
 void Renderer::generateCubemaps()
@@ -658,7 +1507,7 @@ void Renderer::generateCubemaps()
 		{
 			VkImage image;
 			VkImageView view;
-			VkDeviceMemory memory;
+			vulkan::Allocation memory;
 			VkFramebuffer framebuffer;
 		} offscreen;
 
@@ -784,15 +1633,16 @@ void Renderer::generateCubemaps()
 
 		// Pipeline
 		// Vertex input state
-		VkVertexInputBindingDescription vertexInputBinding = { 0, sizeof(vkglTF::Model::Vertex), VK_VERTEX_INPUT_RATE_VERTEX };
-		VkVertexInputAttributeDescription vertexInputAttribute = { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 };
+		const uint32_t positionOnly = 1u << vkglTF::Model::VertexLayout::POSITION;
+		const std::vector<VkVertexInputBindingDescription> vertexInputBindings = modelSet.skybox.vertices.layout.bindingDescriptions(positionOnly);
+		const std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = modelSet.skybox.vertices.layout.attributeDescriptions(positionOnly);
 
 		VkPipelineVertexInputStateCreateInfo vertexInputStateCI{};
 		vertexInputStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		vertexInputStateCI.vertexBindingDescriptionCount = 1;
-		vertexInputStateCI.pVertexBindingDescriptions = &vertexInputBinding;
-		vertexInputStateCI.vertexAttributeDescriptionCount = 1;
-		vertexInputStateCI.pVertexAttributeDescriptions = &vertexInputAttribute;
+		vertexInputStateCI.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInputBindings.size());
+		vertexInputStateCI.pVertexBindingDescriptions = vertexInputBindings.data();
+		vertexInputStateCI.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexInputAttributes.size());
+		vertexInputStateCI.pVertexAttributeDescriptions = vertexInputAttributes.data();
 		// Input assembly
 		VkPipelineInputAssemblyStateCreateInfo inputAssemblyStateCI{};
 		inputAssemblyStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -980,9 +1830,9 @@ void Renderer::generateCubemaps()
 
 		vkDestroyRenderPass(logicalDevice, renderpass, nullptr);
 		vkDestroyFramebuffer(logicalDevice, offscreen.framebuffer, nullptr);
-		vkFreeMemory(logicalDevice, offscreen.memory, nullptr);
 		vkDestroyImageView(logicalDevice, offscreen.view, nullptr);
 		vkDestroyImage(logicalDevice, offscreen.image, nullptr);
+		device->freeMemory(offscreen.memory);
 		vkDestroyDescriptorPool(logicalDevice, descriptorpool, nullptr);
 		vkDestroyDescriptorSetLayout(logicalDevice, descriptorsetlayout, nullptr);
 		vkDestroyPipeline(logicalDevice, pipeline, nullptr);
@@ -1005,6 +1855,10 @@ void Renderer::generateCubemaps()
 		auto tEnd = std::chrono::high_resolution_clock::now();
 		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
 		std::cout << "Generating cube map with " << numMips << " mip levels took " << tDiff << " ms" << std::endl;
+		if (benchmark.active)
+		{
+			benchmark.addStage(target == IRRADIANCE ? "generateIrradianceCube" : "generatePrefilteredCube", tDiff);
+		}
 	}
 }
 //Prepare and initialize uniform buffers containing shader parameters
@@ -1019,14 +1873,32 @@ void Renderer::prepareUniformBuffers()
 	updateUniformBuffers();
 }
 
+//One persistently mapped matrix palette per swapchain image, sized to the scene's node and joint matrices
+void Renderer::prepareNodeBuffers()
+{
+	const VkDeviceSize size = std::max<uint32_t>(modelSet.scene.matrixCount, 1) * sizeof(glm::mat4);
+	for (auto& uniformBuffer : uniformBuffers)
+	{
+		if (uniformBuffer.nodeMatrices.buffer != VK_NULL_HANDLE)
+		{
+			uniformBuffer.nodeMatrices.destroy();
+		}
+		uniformBuffer.nodeMatrices.create(device, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, size);
+		modelSet.scene.writeMatrices(static_cast<glm::mat4*>(uniformBuffer.nodeMatrices.mapped));
+	}
+}
+
 void Renderer::setupDescriptors()
 {
+	prepareBindlessMaterials();
+
+	prepareNodeBuffers();
+
 	/*
 		Descriptor Pool
 	*/
 	uint32_t imageSamplerCount = 0;
 	uint32_t materialCount = 0;
-	uint32_t meshCount = 0;
 
 	// Environment samplers (radiance, irradiance, brdf lut)
 	imageSamplerCount += 3;
@@ -1034,29 +1906,34 @@ void Renderer::setupDescriptors()
 	std::vector<vkglTF::Model*> modellist = { &modelSet.skybox, &modelSet.scene };
 	for (auto& model : modellist)
 	{
+		//Bindless scene materials live in their own pool
 		for (auto& material : model->materials)
 		{
-			imageSamplerCount += 5;
-			materialCount++;
-		}
-		for (auto node : model->linearNodes)
-		{
-			if (node->mesh)
+			if (model == &modelSet.scene && bindless.active)
 			{
-				meshCount++;
+				break;
 			}
+			imageSamplerCount += 5;
+			materialCount++;
 		}
 	}
 
+	//Scene, skybox and node sets per swapchain image, the node set holds the matrix palette
 	std::vector<VkDescriptorPoolSize> poolSizes = {
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, (4 + meshCount) * swapchain.imageCount },
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageSamplerCount * swapchain.imageCount }
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4 * swapchain.imageCount },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageSamplerCount * swapchain.imageCount },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, swapchain.imageCount }
 	};
 	VkDescriptorPoolCreateInfo descriptorPoolCI{};
 	descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	descriptorPoolCI.poolSizeCount = 2;
+	descriptorPoolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	descriptorPoolCI.pPoolSizes = poolSizes.data();
-	descriptorPoolCI.maxSets = (2 + materialCount + meshCount) * swapchain.imageCount;
+	descriptorPoolCI.maxSets = (3 + materialCount) * swapchain.imageCount;
+	//Sets of the previous scene or environment go with their pool, callers have waited for the frames using them
+	if (descriptorPool != VK_NULL_HANDLE)
+	{
+		vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
+	}
 	VK_CHECK_RESULT(vkCreateDescriptorPool(logicalDevice, &descriptorPoolCI, nullptr, &descriptorPool));
 
 	//Descriptor sets
@@ -1073,7 +1950,10 @@ void Renderer::setupDescriptors()
 		descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 		descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
 		descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
-		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.scene));
+		if (descriptorSetLayouts.scene == VK_NULL_HANDLE)
+		{
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.scene));
+		}
 
 		for (auto i = 0; i < descriptorSets.size(); i++)
 		{
@@ -1139,11 +2019,19 @@ void Renderer::setupDescriptors()
 		descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 		descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
 		descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
-		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.material));
+		if (descriptorSetLayouts.material == VK_NULL_HANDLE)
+		{
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.material));
+		}
 
 		// Per-Material descriptor sets
 		for (auto& material : modelSet.scene.materials)
 		{
+			if (bindless.active)
+			{
+				material.descriptorSet = VK_NULL_HANDLE;
+				continue;
+			}
 			VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
 			descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 			descriptorSetAllocInfo.descriptorPool = descriptorPool;
@@ -1199,21 +2087,38 @@ void Renderer::setupDescriptors()
 			vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
 		}
 
-		// Model node (matrices)
+		// Model nodes (matrix palette), draws select their slot with push constants
 		{
 			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-				{ 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr },
+				{ 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr },
 			};
 			VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
 			descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 			descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
 			descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
-			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.node));
+			if (descriptorSetLayouts.node == VK_NULL_HANDLE)
+			{
+				VK_CHECK_RESULT(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCI, nullptr, &descriptorSetLayouts.node));
+			}
 
-			// Per-Node descriptor set
-			for (auto& node : modelSet.scene.nodes)
+			for (size_t i = 0; i < descriptorSets.size(); i++)
 			{
-				setupNodeDescriptorSet(node);
+				VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
+				descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+				descriptorSetAllocInfo.descriptorPool = descriptorPool;
+				descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayouts.node;
+				descriptorSetAllocInfo.descriptorSetCount = 1;
+				VK_CHECK_RESULT(vkAllocateDescriptorSets(logicalDevice, &descriptorSetAllocInfo, &descriptorSets[i].node));
+
+				VkWriteDescriptorSet writeDescriptorSet{};
+				writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writeDescriptorSet.descriptorCount = 1;
+				writeDescriptorSet.dstSet = descriptorSets[i].node;
+				writeDescriptorSet.dstBinding = 0;
+				writeDescriptorSet.pBufferInfo = &uniformBuffers[i].nodeMatrices.descriptor;
+
+				vkUpdateDescriptorSets(logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
 			}
 		}
 
@@ -1254,32 +2159,25 @@ void Renderer::setupDescriptors()
 
 		vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
 	}
-}
 
-void Renderer::setupNodeDescriptorSet(vkglTF::Node* node)
-{
-	if (node->mesh)
+	// GPU-driven draws (storage buffers shared by the culling pass and the indirect pipelines)
+	if (indirect.supported)
 	{
-		VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
-		descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		descriptorSetAllocInfo.descriptorPool = descriptorPool;
-		descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayouts.node;
-		descriptorSetAllocInfo.descriptorSetCount = 1;
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(logicalDevice, &descriptorSetAllocInfo, &node->mesh->uniformBuffer.descriptorSet));
-
-		VkWriteDescriptorSet writeDescriptorSet{};
-		writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		writeDescriptorSet.descriptorCount = 1;
-		writeDescriptorSet.dstSet = node->mesh->uniformBuffer.descriptorSet;
-		writeDescriptorSet.dstBinding = 0;
-		writeDescriptorSet.pBufferInfo = &node->mesh->uniformBuffer.descriptor;
-
-		vkUpdateDescriptorSets(logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
-	}
-	for (auto& child : node->children)
-	{
-		setupNodeDescriptorSet(child);
+		if (indirect.descriptorSetLayout == VK_NULL_HANDLE)
+		{
+			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+				{ 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+				{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+				{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+				{ 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			};
+			VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
+			descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+			descriptorSetLayoutCI.pBindings = setLayoutBindings.data();
+			descriptorSetLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(logicalDevice, &descriptorSetLayoutCI, nullptr, &indirect.descriptorSetLayout));
+		}
+		prepareIndirectBuffers();
 	}
 }
 
@@ -1321,6 +2219,7 @@ void Renderer::preparePipelines()
 	VkPipelineMultisampleStateCreateInfo multisampleStateCI{};
 	multisampleStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
 
+	multisampleStateCI.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 	if (settings.multiSampling)
 	{
 		multisampleStateCI.rasterizationSamples = settings.sampleCount;
@@ -1345,31 +2244,48 @@ void Renderer::preparePipelines()
 	pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCI.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
 	pipelineLayoutCI.pSetLayouts = setLayouts.data();
-	VkPushConstantRange pushConstantRange{};
-	pushConstantRange.size = sizeof(PushConstBlockMaterial);
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	pipelineLayoutCI.pushConstantRangeCount = 1;
-	pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+	//Node palette slot for the vertex stage followed by the material block for the fragment stage
+	std::array<VkPushConstantRange, 2> pushConstantRanges = { {
+		{ VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(NodePushConstants) },
+		{ VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(NodePushConstants), sizeof(PushConstBlockMaterial) }
+	} };
+	pipelineLayoutCI.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+	pipelineLayoutCI.pPushConstantRanges = pushConstantRanges.data();
 	VK_CHECK_RESULT(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCI, nullptr, &pipelineLayout));
 
 	// Vertex bindings an attributes
-	VkVertexInputBindingDescription vertexInputBinding = { 0, sizeof(vkglTF::Model::Vertex), VK_VERTEX_INPUT_RATE_VERTEX };
-	std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = {
-		{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 },
-		{ 1, 0, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3 },
-		{ 2, 0, VK_FORMAT_R32G32_SFLOAT, sizeof(float) * 6 },
-		{ 3, 0, VK_FORMAT_R32G32_SFLOAT, sizeof(float) * 8 },
-		{ 4, 0, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(float) * 10 },
-		{ 5, 0, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(float) * 14 },
-		{ 6, 0, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(float) * 18 }
-	};
+	//One binding per vertex stream of the scene, the constant stream supplies the attributes it leaves out
+	pipelineVertexLayout = modelSet.scene.vertices.layout;
+	const std::vector<VkVertexInputBindingDescription> vertexInputBindings = pipelineVertexLayout.bindingDescriptions();
+	const std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = pipelineVertexLayout.attributeDescriptions();
 	VkPipelineVertexInputStateCreateInfo vertexInputStateCI{};
 	vertexInputStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputStateCI.vertexBindingDescriptionCount = 1;
-	vertexInputStateCI.pVertexBindingDescriptions = &vertexInputBinding;
+	vertexInputStateCI.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInputBindings.size());
+	vertexInputStateCI.pVertexBindingDescriptions = vertexInputBindings.data();
 	vertexInputStateCI.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexInputAttributes.size());
 	vertexInputStateCI.pVertexAttributeDescriptions = vertexInputAttributes.data();
 
+	//The skybox only reads positions from its own model
+	const uint32_t positionOnly = 1u << vkglTF::Model::VertexLayout::POSITION;
+	const std::vector<VkVertexInputBindingDescription> skyboxInputBindings = modelSet.skybox.vertices.layout.bindingDescriptions(positionOnly);
+	const std::vector<VkVertexInputAttributeDescription> skyboxInputAttributes = modelSet.skybox.vertices.layout.attributeDescriptions(positionOnly);
+	VkPipelineVertexInputStateCreateInfo skyboxInputStateCI{};
+	skyboxInputStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	skyboxInputStateCI.vertexBindingDescriptionCount = static_cast<uint32_t>(skyboxInputBindings.size());
+	skyboxInputStateCI.pVertexBindingDescriptions = skyboxInputBindings.data();
+	skyboxInputStateCI.vertexAttributeDescriptionCount = static_cast<uint32_t>(skyboxInputAttributes.size());
+	skyboxInputStateCI.pVertexAttributeDescriptions = skyboxInputAttributes.data();
+
+	//Depth prepass, positions and for skinned scenes the skinning stream, nothing else is fetched
+	const std::vector<VkVertexInputBindingDescription> depthInputBindings = pipelineVertexLayout.bindingDescriptions(vkglTF::Model::VertexLayout::DEPTH_ATTRIBUTES);
+	const std::vector<VkVertexInputAttributeDescription> depthInputAttributes = pipelineVertexLayout.attributeDescriptions(vkglTF::Model::VertexLayout::DEPTH_ATTRIBUTES);
+	VkPipelineVertexInputStateCreateInfo depthInputStateCI{};
+	depthInputStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	depthInputStateCI.vertexBindingDescriptionCount = static_cast<uint32_t>(depthInputBindings.size());
+	depthInputStateCI.pVertexBindingDescriptions = depthInputBindings.data();
+	depthInputStateCI.vertexAttributeDescriptionCount = static_cast<uint32_t>(depthInputAttributes.size());
+	depthInputStateCI.pVertexAttributeDescriptions = depthInputAttributes.data();
+
 	// Pipelines
 	std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages;
 
@@ -1378,7 +2294,7 @@ void Renderer::preparePipelines()
 	pipelineCI.layout = pipelineLayout;
 	pipelineCI.renderPass = renderPass;
 	pipelineCI.pInputAssemblyState = &inputAssemblyStateCI;
-	pipelineCI.pVertexInputState = &vertexInputStateCI;
+	pipelineCI.pVertexInputState = &skyboxInputStateCI;
 	pipelineCI.pRasterizationState = &rasterizationStateCI;
 	pipelineCI.pColorBlendState = &colorBlendStateCI;
 	pipelineCI.pMultisampleState = &multisampleStateCI;
@@ -1399,6 +2315,24 @@ void Renderer::preparePipelines()
 		vkDestroyShaderModule(logicalDevice, shaderStage.module, nullptr);
 	}
 
+	// Depth prepass pipelines, vertex stage only and no color writes
+	VkPipelineShaderStageCreateInfo depthStage = loadShader(logicalDevice, "depth.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+	pipelineCI.pVertexInputState = &depthInputStateCI;
+	pipelineCI.stageCount = 1;
+	pipelineCI.pStages = &depthStage;
+	blendAttachmentState.colorWriteMask = 0;
+	depthStencilStateCI.depthWriteEnable = VK_TRUE;
+	depthStencilStateCI.depthTestEnable = VK_TRUE;
+	VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &pipelineSet.depthPrepass));
+	rasterizationStateCI.cullMode = VK_CULL_MODE_NONE;
+	VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &pipelineSet.depthPrepassDoubleSided));
+	vkDestroyShaderModule(logicalDevice, depthStage.module, nullptr);
+	pipelineCI.pVertexInputState = &vertexInputStateCI;
+	pipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
+	pipelineCI.pStages = shaderStages.data();
+	blendAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	rasterizationStateCI.cullMode = VK_CULL_MODE_BACK_BIT;
+
 	// PBR pipeline
 	shaderStages = {
 		loadShader(logicalDevice, "pbr.vert.spv", VK_SHADER_STAGE_VERTEX_BIT),
@@ -1425,6 +2359,132 @@ void Renderer::preparePipelines()
 	{
 		vkDestroyShaderModule(logicalDevice, shaderStage.module, nullptr);
 	}
+
+	// GPU-driven pipelines, node matrices are read from a storage buffer indexed by the draw
+	if (indirect.supported)
+	{
+		const std::vector<VkDescriptorSetLayout> indirectSetLayouts = {
+			descriptorSetLayouts.scene, descriptorSetLayouts.material, indirect.descriptorSetLayout
+		};
+		pipelineLayoutCI.setLayoutCount = static_cast<uint32_t>(indirectSetLayouts.size());
+		pipelineLayoutCI.pSetLayouts = indirectSetLayouts.data();
+		VK_CHECK_RESULT(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCI, nullptr, &indirect.pipelineLayout));
+
+		shaderStages = {
+			loadShader(logicalDevice, "pbr_indirect.vert.spv", VK_SHADER_STAGE_VERTEX_BIT),
+			loadShader(logicalDevice, "pbr_khr.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT)
+		};
+		pipelineCI.layout = indirect.pipelineLayout;
+		blendAttachmentState.blendEnable = VK_FALSE;
+		rasterizationStateCI.cullMode = VK_CULL_MODE_BACK_BIT;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &indirect.pbr));
+		rasterizationStateCI.cullMode = VK_CULL_MODE_NONE;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &indirect.pbrDoubleSided));
+		for (auto shaderStage : shaderStages)
+		{
+			vkDestroyShaderModule(logicalDevice, shaderStage.module, nullptr);
+		}
+
+		VkPushConstantRange cullPushConstantRange{ VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants) };
+		VkPipelineLayoutCreateInfo cullPipelineLayoutCI{};
+		cullPipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		cullPipelineLayoutCI.setLayoutCount = 1;
+		cullPipelineLayoutCI.pSetLayouts = &indirect.descriptorSetLayout;
+		cullPipelineLayoutCI.pushConstantRangeCount = 1;
+		cullPipelineLayoutCI.pPushConstantRanges = &cullPushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(logicalDevice, &cullPipelineLayoutCI, nullptr, &indirect.cullPipelineLayout));
+
+		VkComputePipelineCreateInfo computePipelineCI{};
+		computePipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		computePipelineCI.layout = indirect.cullPipelineLayout;
+		computePipelineCI.stage = loadShader(logicalDevice, "cull.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(logicalDevice, pipelineCache, 1, &computePipelineCI, nullptr, &indirect.cullPipeline));
+		vkDestroyShaderModule(logicalDevice, computePipelineCI.stage.module, nullptr);
+	}
+
+	// Bindless material pipelines, set 1 holds the material buffer and the texture array
+	if (bindless.supported)
+	{
+		const std::vector<VkDescriptorSetLayout> bindlessSetLayouts = {
+			descriptorSetLayouts.scene, bindless.descriptorSetLayout, descriptorSetLayouts.node
+		};
+		VkPushConstantRange materialIndexRange{ VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(NodePushConstants) };
+		pipelineLayoutCI.setLayoutCount = static_cast<uint32_t>(bindlessSetLayouts.size());
+		pipelineLayoutCI.pSetLayouts = bindlessSetLayouts.data();
+		pipelineLayoutCI.pushConstantRangeCount = 1;
+		pipelineLayoutCI.pPushConstantRanges = &materialIndexRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCI, nullptr, &bindless.pipelineLayout));
+
+		shaderStages = {
+			loadShader(logicalDevice, "pbr_bindless.vert.spv", VK_SHADER_STAGE_VERTEX_BIT),
+			loadShader(logicalDevice, "pbr_khr_bindless.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT)
+		};
+		pipelineCI.layout = bindless.pipelineLayout;
+		blendAttachmentState.blendEnable = VK_FALSE;
+		rasterizationStateCI.cullMode = VK_CULL_MODE_BACK_BIT;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &bindless.pbr));
+		rasterizationStateCI.cullMode = VK_CULL_MODE_NONE;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &bindless.pbrDoubleSided));
+		blendAttachmentState.blendEnable = VK_TRUE;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &bindless.pbrAlphaBlend));
+		vkDestroyShaderModule(logicalDevice, shaderStages[0].module, nullptr);
+
+		// The indirect vertex shader reads the material index from the draw data
+		if (indirect.supported)
+		{
+			const std::vector<VkDescriptorSetLayout> indirectSetLayouts = {
+				descriptorSetLayouts.scene, bindless.descriptorSetLayout, indirect.descriptorSetLayout
+			};
+			pipelineLayoutCI.setLayoutCount = static_cast<uint32_t>(indirectSetLayouts.size());
+			pipelineLayoutCI.pSetLayouts = indirectSetLayouts.data();
+			pipelineLayoutCI.pushConstantRangeCount = 0;
+			pipelineLayoutCI.pPushConstantRanges = nullptr;
+			VK_CHECK_RESULT(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCI, nullptr, &bindless.indirectPipelineLayout));
+
+			shaderStages[0] = loadShader(logicalDevice, "pbr_indirect.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+			pipelineCI.layout = bindless.indirectPipelineLayout;
+			blendAttachmentState.blendEnable = VK_FALSE;
+			rasterizationStateCI.cullMode = VK_CULL_MODE_BACK_BIT;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &bindless.indirectPbr));
+			rasterizationStateCI.cullMode = VK_CULL_MODE_NONE;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &bindless.indirectPbrDoubleSided));
+			vkDestroyShaderModule(logicalDevice, shaderStages[0].module, nullptr);
+		}
+		vkDestroyShaderModule(logicalDevice, shaderStages[1].module, nullptr);
+	}
+}
+
+//Everything preparePipelines creates, the descriptor set layouts stay
+void Renderer::destroyPipelines()
+{
+	vkDestroyPipeline(logicalDevice, pipelineSet.skybox, nullptr);
+	vkDestroyPipeline(logicalDevice, pipelineSet.pbr, nullptr);
+	vkDestroyPipeline(logicalDevice, pipelineSet.pbrDoubleSided, nullptr);
+	vkDestroyPipeline(logicalDevice, pipelineSet.pbrAlphaBlend, nullptr);
+	vkDestroyPipeline(logicalDevice, pipelineSet.depthPrepass, nullptr);
+	vkDestroyPipeline(logicalDevice, pipelineSet.depthPrepassDoubleSided, nullptr);
+	vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+	if (indirect.supported)
+	{
+		vkDestroyPipeline(logicalDevice, indirect.pbr, nullptr);
+		vkDestroyPipeline(logicalDevice, indirect.pbrDoubleSided, nullptr);
+		vkDestroyPipeline(logicalDevice, indirect.cullPipeline, nullptr);
+		vkDestroyPipelineLayout(logicalDevice, indirect.pipelineLayout, nullptr);
+		vkDestroyPipelineLayout(logicalDevice, indirect.cullPipelineLayout, nullptr);
+	}
+	if (bindless.supported)
+	{
+		vkDestroyPipeline(logicalDevice, bindless.pbr, nullptr);
+		vkDestroyPipeline(logicalDevice, bindless.pbrDoubleSided, nullptr);
+		vkDestroyPipeline(logicalDevice, bindless.pbrAlphaBlend, nullptr);
+		vkDestroyPipelineLayout(logicalDevice, bindless.pipelineLayout, nullptr);
+		if (indirect.supported)
+		{
+			vkDestroyPipeline(logicalDevice, bindless.indirectPbr, nullptr);
+			vkDestroyPipeline(logicalDevice, bindless.indirectPbrDoubleSided, nullptr);
+			vkDestroyPipelineLayout(logicalDevice, bindless.indirectPipelineLayout, nullptr);
+		}
+	}
 }
 
 void Renderer::updateUniformBuffers()
@@ -1455,6 +2515,12 @@ void Renderer::updateUniformBuffers()
 	skyboxUBO.projection = camera.matrices.perspective;
 	skyboxUBO.view = camera.matrices.view;
 	skyboxUBO.model = glm::mat4(glm::mat3(camera.matrices.view));
+	//Baked passes keep the skybox draw so the toggle needs no re-record, hiding the background collapses it to a
+	//point there so no fragments are drawn
+	if (!displayBackground && !settings.perFrameRecording)
+	{
+		skyboxUBO.model = glm::scale(glm::mat4(1.0f), glm::vec3(0.0f));
+	}
 }
 
 void Renderer::updateParams()
@@ -1469,7 +2535,7 @@ void Renderer::updateParams()
 void Renderer::windowResized()
 {
 	recordCommandBuffers();
-	vkDeviceWaitIdle(logicalDevice);
+	device->waitIdle();
 	updateUniformBuffers();
 	updateOverlay();
 }
@@ -1526,15 +2592,16 @@ void Renderer::updateOverlay()
 #endif		
 			if (!filename.empty())
 			{
-				vkDeviceWaitIdle(logicalDevice);
-				loadScene(filename);
-				setupDescriptors();
-				updateCBs = true;
+				loadSceneAsync(filename);
 			}
 		}
+		if (pendingScene.loaded.valid())
+		{
+			ui->text("Loading %s ...", pendingScene.filename.c_str());
+		}
 		if (ui->combo("Environment", selectedEnvironment, environments))
 		{
-			vkDeviceWaitIdle(logicalDevice);
+			device->waitIdle();
 			loadEnvironment(environments[selectedEnvironment]);
 			setupDescriptors();
 			updateCBs = true;
@@ -1574,8 +2641,31 @@ void Renderer::updateOverlay()
 	{
 		if (ui->checkbox("Specular-Glossiness Workflow", &settings.SpecularGlossiness))
 		{
+			shaderValuesParams.forceSpecularGlossiness = static_cast<float>(settings.SpecularGlossiness);
 			updateShaderParams = true;
 		}
+		if (ui->checkbox("Frustum culling", &settings.perFrameRecording))
+		{
+			updateCBs = true;
+		}
+		if (indirect.supported && settings.perFrameRecording)
+		{
+			ui->checkbox("GPU culling", &settings.indirectDrawing);
+		}
+		if (ui->checkbox("Depth prepass", &settings.depthPrepass))
+		{
+			updateCBs = true;
+		}
+		if (modelSet.scene.lodStats.levels > 0 && settings.perFrameRecording)
+		{
+			ui->checkbox("Levels of detail", &settings.lods);
+			ui->slider("LOD threshold", &settings.lodThreshold, 0.25f, 8.0f);
+		}
+		ui->text("%u drawn, %u culled", drawStats.drawn, drawStats.culled);
+		ui->text("%u triangles, %u at full detail", drawStats.triangles, drawStats.fullTriangles);
+		ui->text("Binds saved: %u pipeline, %u material, %u node", drawStats.drawn - drawStats.pipelineBinds, drawStats.drawn - drawStats.materialBinds, drawStats.drawn - drawStats.nodeBinds);
+		vulkan::MemoryAllocator::Stats memoryStats = device->allocator->getStats();
+		ui->text("GPU memory: %.1f / %.1f MB, %u blocks, %.0f%% fragmented", memoryStats.usedBytes / (1024.0f * 1024.0f), memoryStats.reservedBytes / (1024.0f * 1024.0f), memoryStats.blockCount, memoryStats.fragmentation * 100.0f);
 		const std::vector<std::string> debugNamesInputs = {
 			"PBR", "Blinn-Phong", "Normal", "Occlusion", "Emissive", "Metallic", "Roughness"
 		};
@@ -1612,51 +2702,6 @@ void Renderer::updateOverlay()
 	ImGui::End();
 	ImGui::Render();
 
-	ImDrawData* imDrawData = ImGui::GetDrawData();
-
-	// Check if ui buffers need to be recreated
-	if (imDrawData)
-	{
-		VkDeviceSize vertexBufferSize = imDrawData->TotalVtxCount * sizeof(ImDrawVert);
-		VkDeviceSize indexBufferSize = imDrawData->TotalIdxCount * sizeof(ImDrawIdx);
-
-		bool updateBuffers = (ui->vertexBuffer.buffer == VK_NULL_HANDLE) || (ui->vertexBuffer.count != imDrawData->TotalVtxCount) || (ui->indexBuffer.buffer == VK_NULL_HANDLE) || (ui->indexBuffer.count != imDrawData->TotalIdxCount);
-
-		if (updateBuffers)
-		{
-			vkDeviceWaitIdle(logicalDevice);
-			if (ui->vertexBuffer.buffer)
-			{
-				ui->vertexBuffer.destroy();
-			}
-			ui->vertexBuffer.create(device, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, vertexBufferSize);
-			ui->vertexBuffer.count = imDrawData->TotalVtxCount;
-			if (ui->indexBuffer.buffer)
-			{
-				ui->indexBuffer.destroy();
-			}
-			ui->indexBuffer.create(device, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, indexBufferSize);
-			ui->indexBuffer.count = imDrawData->TotalIdxCount;
-		}
-
-		// Upload data
-		ImDrawVert* vtxDst = (ImDrawVert*)ui->vertexBuffer.mapped;
-		ImDrawIdx* idxDst = (ImDrawIdx*)ui->indexBuffer.mapped;
-		for (int n = 0; n < imDrawData->CmdListsCount; n++)
-		{
-			const ImDrawList* cmd_list = imDrawData->CmdLists[n];
-			memcpy(vtxDst, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
-			memcpy(idxDst, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
-			vtxDst += cmd_list->VtxBuffer.Size;
-			idxDst += cmd_list->IdxBuffer.Size;
-		}
-
-		ui->vertexBuffer.flush();
-		ui->indexBuffer.flush();
-
-		updateCBs = updateCBs || updateBuffers;
-	}
-
 	if (lastDisplaySize.x != io.DisplaySize.x || lastDisplaySize.y != io.DisplaySize.y)
 	{
 		updateCBs = true;
@@ -1666,11 +2711,12 @@ void Renderer::updateOverlay()
 	{
 		windowResize();
 	}
-	if (updateCBs)
+	//Per-frame recording picks every change up with the next frame, only baked passes need the idle and re-record
+	if (updateCBs && !settings.perFrameRecording)
 	{
-		vkDeviceWaitIdle(logicalDevice);
+		device->waitIdle();
 		recordCommandBuffers();
-		vkDeviceWaitIdle(logicalDevice);
+		device->waitIdle();
 	}
 
 	if (updateShaderParams)
@@ -1686,10 +2732,13 @@ void Renderer::render()
 		return;
 	}
 
+	swapPendingScene();
+
 	updateOverlay();
 
 	VK_CHECK_RESULT(vkWaitForFences(logicalDevice, 1, &waitFences[frameIndex], VK_TRUE, UINT64_MAX));
 	VK_CHECK_RESULT(vkResetFences(logicalDevice, 1, &waitFences[frameIndex]));
+	collectTimestamps(frameIndex);
 
 	VkResult acquire = swapchain.acquireNextImage(presentCompleteSemaphores[frameIndex], &currentBuffer);
 	if ((acquire == VK_ERROR_OUT_OF_DATE_KHR) || (acquire == VK_SUBOPTIMAL_KHR))
@@ -1707,6 +2756,11 @@ void Renderer::render()
 	memcpy(currentUB.scene.mapped, &sceneUBO, sizeof(sceneUBO));
 	memcpy(currentUB.params.mapped, &shaderValuesParams, sizeof(shaderValuesParams));
 	memcpy(currentUB.skybox.mapped, &skyboxUBO, sizeof(skyboxUBO));
+	modelSet.scene.writeMatrices(static_cast<glm::mat4*>(currentUB.nodeMatrices.mapped));
+
+	//The frame's fence has signaled, so its UI buffers and command buffers are free to be rewritten
+	ui->update(frameIndex);
+	recordFrameCommandBuffer(frameIndex, currentBuffer);
 
 	const VkPipelineStageFlags waitDstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	VkSubmitInfo submitInfo{};
@@ -1716,11 +2770,23 @@ void Renderer::render()
 	submitInfo.waitSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = &renderCompleteSemaphores[frameIndex];
 	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffers[currentBuffer];
+	submitInfo.pCommandBuffers = &commandBuffers[frameIndex];
 	submitInfo.commandBufferCount = 1;
-	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[frameIndex]));
+	//Offscreen images are neither acquired nor presented
+	if (swapchain.headless)
+	{
+		submitInfo.waitSemaphoreCount = 0;
+		submitInfo.signalSemaphoreCount = 0;
+	}
+	VkResult present;
+	{
+		//A background scene load may be flushing uploads on the same queue
+		std::lock_guard<std::mutex> lock(device->queueMutex);
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, waitFences[frameIndex]));
+		present = swapchain.queuePresent(queue, currentBuffer, renderCompleteSemaphores[frameIndex]);
+	}
+	timestampPending[frameIndex] = true;
 
-	VkResult present = swapchain.queuePresent(queue, currentBuffer, renderCompleteSemaphores[frameIndex]);
 	if (!((present == VK_SUCCESS) || (present == VK_SUBOPTIMAL_KHR)))
 	{
 		if (present == VK_ERROR_OUT_OF_DATE_KHR)
@@ -1754,7 +2820,12 @@ void Renderer::render()
 			{
 				animationTimer -= modelSet.scene.animations[animationIndex].end;
 			}
+			auto tStart = std::chrono::high_resolution_clock::now();
 			modelSet.scene.updateAnimation(animationIndex, animationTimer);
+			if (benchmark.active)
+			{
+				benchmark.addSample("updateAnimation", std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count());
+			}
 		}
 		updateParams();
 		if (rotateModel)
@@ -1770,8 +2841,5 @@ void Renderer::render()
 
 void Renderer::fileDropped(std::string filename)
 {
-	vkDeviceWaitIdle(logicalDevice);
-	loadScene(filename);
-	setupDescriptors();
-	recordCommandBuffers();
+	loadSceneAsync(filename);
 }
\ No newline at end of file
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "algorithm"
+#include <future>
+#include <memory>
 
 #include "../Base/vulkan_example_base.h"
 #include "../Base/vulkan_texture.h"
 #include "../Base/vulkan_glTF_model_loader.h"
 #include "../Base/ui.h"
+#include "../Base/thread_pool.h"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -31,12 +34,22 @@ public:
 		vkglTF::Model scene;
 		vkglTF::Model skybox;
 	} modelSet;
+	//Scene loading on a worker thread while the current one keeps rendering, swapped in at the start of a frame
+	struct PendingScene
+	{
+		std::future<void> loaded;
+		std::unique_ptr<vkglTF::Model> model;
+		std::string filename;
+		std::chrono::high_resolution_clock::time_point startTime;
+	} pendingScene;
 
 	struct UniformBufferSet
 	{
 		Buffer scene;
 		Buffer skybox;
 		Buffer params;
+		//Node and joint matrices of the scene, see vkglTF::Mesh::matrixOffset
+		Buffer nodeMatrices;
 	};
 
 	struct UBOMatrices
@@ -56,6 +69,7 @@ public:
 		float scaleIBLAmbient = 1.0f;
 		float debugViewInputs = 0.0f;
 		float debugViewEquation = 0.0f;
+		float forceSpecularGlossiness = 0.0f;
 	} shaderValuesParams;
 
 	VkPipelineLayout pipelineLayout;
@@ -66,25 +80,126 @@ public:
 		VkPipeline pbr;
 		VkPipeline pbrDoubleSided;
 		VkPipeline pbrAlphaBlend;
+		VkPipeline depthPrepass;
+		VkPipeline depthPrepassDoubleSided;
 	} pipelineSet;
-	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	//Scene vertex layout the pipelines were built for, a scene with a different one rebuilds them
+	vkglTF::Model::VertexLayout pipelineVertexLayout;
 
 	struct DescriptorSetLayouts
 	{
-		VkDescriptorSetLayout scene;
-		VkDescriptorSetLayout material;
-		VkDescriptorSetLayout node;
+		VkDescriptorSetLayout scene = VK_NULL_HANDLE;
+		VkDescriptorSetLayout material = VK_NULL_HANDLE;
+		VkDescriptorSetLayout node = VK_NULL_HANDLE;
 	} descriptorSetLayouts;
 
 	struct DescriptorSets
 	{
 		VkDescriptorSet scene;
 		VkDescriptorSet skybox;
+		VkDescriptorSet node;
 	};
 
 	std::vector<DescriptorSets> descriptorSets;
 
+	//Primary command buffers, one per frame in flight, re-recorded every frame
 	std::vector<VkCommandBuffer> commandBuffers;
+	//Secondary command buffers holding the scene pass, one per swapchain image
+	std::vector<VkCommandBuffer> sceneCommandBuffers;
+	Frustum frustum;
+	//Primitives drawn and culled and state actually bound in the last recorded scene pass
+	struct DrawStats
+	{
+		uint32_t drawn = 0;
+		uint32_t culled = 0;
+		uint32_t pipelineBinds = 0;
+		uint32_t materialBinds = 0;
+		uint32_t nodeBinds = 0;
+		//Triangles submitted by the CPU-recorded draws, and what they would have been at full detail
+		uint32_t triangles = 0;
+		uint32_t fullTriangles = 0;
+	} drawStats;
+	//Screen-space LOD selection of the frame being recorded
+	struct LodSelection
+	{
+		bool active = false;
+		//Scene space (after the y flip of the shaders) to view space and its uniform scale
+		glm::mat4 sceneToView = glm::mat4(1.0f);
+		float scale = 1.0f;
+		//Pixels covered by one unit at distance one
+		float pixelsPerUnit = 1.0f;
+	} lodSelection;
+	//Scene pass recorded fresh every frame with frustum culling, split across workers that each
+	//own a command pool and one secondary command buffer per frame in flight
+	struct RecordThread
+	{
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> commandBuffers;
+		DrawStats stats;
+		double recordTime = 0.0;
+	};
+	std::vector<RecordThread> recordThreads;
+	//GPU-driven path: a compute pass culls the opaque, non-skinned draws and writes indirect commands
+	//Mirrors DrawData in cull.comp and pbr_indirect.vert (std430)
+	struct IndirectDrawData
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t node;
+		uint32_t batch;
+		uint32_t commandOffset;
+		uint32_t material;
+		int32_t vertexOffset;
+		uint32_t padding;
+		glm::vec4 bbMin;
+		//w is 1 for valid bounds
+		glm::vec4 bbMax;
+		//Meshlet bounds and normal cone in mesh space, sphere.w is negative for whole primitives
+		glm::vec4 sphere;
+		glm::vec4 cone;
+	};
+	//Adjacent draws sharing pipeline, index type and material (no material with bindless materials), drawn with one vkCmdDrawIndexedIndirectCount
+	struct IndirectBatch
+	{
+		uint8_t pipeline;
+		uint8_t wideIndices;
+		uint32_t material;
+		uint32_t commandOffset;
+		uint32_t maxDrawCount;
+	};
+	struct IndirectFrame
+	{
+		Buffer commands;
+		Buffer counts;
+		//Per swapchain image, selecting its node matrices
+		std::vector<VkDescriptorSet> descriptorSets;
+	};
+	struct CullPushConstants
+	{
+		glm::vec4 planes[6];
+		glm::vec4 cameraPos;
+		uint32_t drawCount;
+	};
+	struct Indirect
+	{
+		bool supported = false;
+		uint32_t drawCount = 0;
+		Buffer draws;
+		//Per draw list item, set when the item is drawn by the GPU-driven path
+		std::vector<uint8_t> drawFlags;
+		std::vector<IndirectBatch> batches;
+		std::vector<IndirectFrame> frames;
+		VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+		VkPipeline cullPipeline = VK_NULL_HANDLE;
+		VkPipeline pbr = VK_NULL_HANDLE;
+		VkPipeline pbrDoubleSided = VK_NULL_HANDLE;
+	} indirect;
+	ThreadPool threadPool;
+	//Below this many draws per worker the hand-off costs more than it saves
+	const size_t minDrawsPerThread = 64;
 
 	std::vector<UniformBufferSet> uniformBuffers;
 
@@ -95,6 +210,9 @@ public:
 
 	const uint32_t renderAhead = 2;
 	uint32_t frameIndex = 0;
+	//GPU timestamps for the benchmark, two queries per frame in flight
+	VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+	std::vector<bool> timestampPending;
 	//Animation
 	bool animate = true;
 	int32_t animationIndex = 0;
@@ -115,6 +233,15 @@ public:
 	glm::vec3 modelrot = glm::vec3(0.0f);
 	glm::vec3 modelPos = glm::vec3(0.0f);
 
+	//Vertex stage push constants, the material block follows them
+	struct NodePushConstants
+	{
+		uint32_t matrixOffset;
+		uint32_t jointCount;
+		//Only read with bindless materials
+		uint32_t materialIndex;
+		uint32_t padding;
+	};
 	struct PushConstBlockMaterial
 	{
 		glm::vec4 baseColorFactor;
@@ -131,7 +258,39 @@ public:
 		float roughnessFactor;
 		float alphaMask;
 		float alphaMaskCutoff;
-	} pushConstBlockMaterial;
+	};
+	//Indexed by material
+	std::vector<PushConstBlockMaterial> materialPushConstants;
+	//Bindless materials: all scene textures in one descriptor array, material parameters in a storage buffer
+	//Mirrors MaterialData in pbr_khr.frag (std430), texture members index the array where 0 is the empty texture
+	struct ShaderMaterial
+	{
+		PushConstBlockMaterial params;
+		int32_t colorTexture;
+		int32_t physicalDescriptorTexture;
+		int32_t normalTexture;
+		int32_t occlusionTexture;
+		int32_t emissiveTexture;
+		int32_t padding;
+	};
+	struct Bindless
+	{
+		bool supported = false;
+		//Set per scene, scenes with more textures than the device can index fall back to per-material sets
+		bool active = false;
+		uint32_t maxTextures = 0;
+		Buffer materials;
+		VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VkPipelineLayout indirectPipelineLayout = VK_NULL_HANDLE;
+		VkPipeline pbr = VK_NULL_HANDLE;
+		VkPipeline pbrDoubleSided = VK_NULL_HANDLE;
+		VkPipeline pbrAlphaBlend = VK_NULL_HANDLE;
+		VkPipeline indirectPbr = VK_NULL_HANDLE;
+		VkPipeline indirectPbrDoubleSided = VK_NULL_HANDLE;
+	} bindless;
 	//Environments
 	std::map<std::string, std::string> environments;
 	std::string selectedEnvironment = "cyberpunk";
@@ -145,15 +304,35 @@ public:
 
 	~Renderer()
 	{
-		vkDestroyPipeline(logicalDevice, pipelineSet.skybox, nullptr);
-		vkDestroyPipeline(logicalDevice, pipelineSet.pbr, nullptr);
-		vkDestroyPipeline(logicalDevice, pipelineSet.pbrAlphaBlend, nullptr);
-
-		vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+		if (pendingScene.loaded.valid())
+		{
+			pendingScene.loaded.wait();
+			pendingScene.model->destroy(logicalDevice);
+		}
+		destroyPipelines();
 		vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayouts.scene, nullptr);
 		vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayouts.material, nullptr);
 		vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayouts.node, nullptr);
 
+		if (timestampQueryPool)
+		{
+			vkDestroyQueryPool(logicalDevice, timestampQueryPool, nullptr);
+		}
+		for (auto& thread : recordThreads)
+		{
+			vkDestroyCommandPool(logicalDevice, thread.commandPool, nullptr);
+		}
+		destroyIndirectBuffers();
+		destroyBindlessMaterials();
+		if (bindless.supported)
+		{
+			vkDestroyDescriptorSetLayout(logicalDevice, bindless.descriptorSetLayout, nullptr);
+		}
+		if (indirect.supported)
+		{
+			vkDestroyDescriptorSetLayout(logicalDevice, indirect.descriptorSetLayout, nullptr);
+		}
+
 		modelSet.scene.destroy(logicalDevice);
 		modelSet.skybox.destroy(logicalDevice);
 
@@ -162,6 +341,7 @@ public:
 			buffer.params.destroy();
 			buffer.scene.destroy();
 			buffer.skybox.destroy();
+			buffer.nodeMatrices.destroy();
 		}
 		for (auto fence : waitFences)
 		{
@@ -187,22 +367,43 @@ public:
 			delete ui;
 		}
 	}
-	void renderNode(vkglTF::Node* node, uint32_t cbIndex, vkglTF::Material::AlphaMode alphaMode);
+	void updateMaterialPushConstants();
+	void recordDrawList(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool cull, size_t first, size_t last, DrawStats& stats);
+	void recordDepthPrepass(VkCommandBuffer commandBuffer, uint32_t imageIndex, bool cull);
+	void recordScene(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frame, bool cull, size_t first, size_t last, DrawStats& stats, bool firstRange);
+	bool useIndirect() const;
+	//Coarsest level of a draw whose error stays below the pixel threshold, 0 is the full primitive
+	uint32_t selectLod(size_t draw, const glm::mat4& matrix) const;
+	void prepareIndirectBuffers();
+	void destroyIndirectBuffers();
+	void recordIndirectCulling(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t imageIndex);
+	void recordIndirectDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t frame);
+	void prepareBindlessMaterials();
+	void destroyBindlessMaterials();
+	void updateBindlessMaterials();
 	void recordCommandBuffers();
+	void recordFrameCommandBuffer(uint32_t frame, uint32_t imageIndex);
 
 	void loadScene(std::string filename);
+	void loadSceneAsync(std::string filename);
+	void swapPendingScene();
+	void finishSceneLoad(double loadTime);
 	void loadEnvironment(std::string filename);
 	void generateCubemaps();
 	void loadAssets();
-	void setupNodeDescriptorSet(vkglTF::Node* node);
+	void prepareNodeBuffers();
 	void setupDescriptors();
 	void preparePipelines();
+	void destroyPipelines();
 	void generateBRDFLUT();
 	void prepareUniformBuffers();
 	void updateUniformBuffers();
 	void updateParams();
 	void windowResized();
 	void prepare();
+	void prepareTimestamps();
+	void prepareRecordThreads();
+	void collectTimestamps(uint32_t frame);
 	void updateOverlay();
 	virtual void render();
 	virtual void fileDropped(std::string filename);